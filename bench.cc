@@ -0,0 +1,166 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "physon_bench.hh"
+
+#include "physon.hh"
+#include "physon_types.hh"
+
+
+/**
+    Stage benchmarks of the parser and serializer, with baseline regression gating.
+
+    Build and run:
+        g++ -std=gnu++17 -O2 bench.cc -o build/bench
+        ./build/bench --write-baseline bench_baseline.txt        # on the reference commit
+        ./build/bench --baseline bench_baseline.txt              # after a change; exit code 1 on regression
+
+    Options:
+        --file PATH         document for the parse and stringify stages, instead of a generated one
+        --runs N            measured runs per stage
+        --threshold X       allowed growth of time, cycles and instructions, e.g. 0.05 for 5%
+ */
+
+
+std::string bench_load_file(const std::string& path){
+    std::ifstream file (path, std::ios::binary);
+    if(!file.is_open())
+        throw std::runtime_error("Bench: cannot open " + path);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+/** Records with nested objects, arrays, escaped strings, integers and floats */
+std::string bench_document(size_t records){
+    std::string document = "[\n";
+    for(size_t i = 0; i < records; i++){
+        if(i > 0)
+            document += ",\n";
+        document += "  {\"id\": " + std::to_string(i)
+                  + ", \"name\": \"record " + std::to_string(i) + (i % 8 == 0 ? "\\n\\\"quoted\\\"" : "") + "\""
+                  + ", \"position\": [" + std::to_string(i * 0.125) + ", " + std::to_string(-(double)i / 3) + "]"
+                  + ", \"active\": " + (i % 2 ? "true" : "false")
+                  + ", \"tags\": [\"alpha\", \"beta\", null]"
+                  + ", \"meta\": {\"weight\": " + std::to_string(i % 97) + ".5e-3, \"count\": " + std::to_string(i * 7919) + "}}";
+    }
+    document += "\n]";
+    return document;
+}
+
+
+int main(int argc, char** argv){
+
+    std::string file_path;
+    std::string baseline_path;
+    std::string write_baseline_path;
+    double threshold = 0.05;
+    size_t runs = 15;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(arg == "--file" && has_value)                    file_path = argv[++i];
+        else if(arg == "--baseline" && has_value)           baseline_path = argv[++i];
+        else if(arg == "--write-baseline" && has_value)     write_baseline_path = argv[++i];
+        else if(arg == "--threshold" && has_value)          threshold = std::stod(argv[++i]);
+        else if(arg == "--runs" && has_value)               runs = std::stoul(argv[++i]);
+        else {
+            std::cerr << "usage: bench [--file PATH] [--runs N] [--baseline FILE] [--write-baseline FILE] [--threshold X]" << std::endl;
+            return 2;
+        }
+    }
+
+    PhysonBench bench;
+    bench.runs = runs;
+
+
+    // skip_whitespace : one long run of mixed whitespace
+    {
+        std::string whitespace;
+        for(size_t i = 0; i < (1 << 20); i++)
+            whitespace += " \t\n\r"[i % 7 == 0 ? 1 + i % 3 : 0];
+        Physon physon (whitespace + "0");
+
+        bench.run("skip_whitespace", whitespace.size(), [&](){
+            const char* c = physon.content.data();
+            physon.skip_whitespace<PhysonStrictPolicy>(c);
+            if(*c != '0')
+                throw std::runtime_error("Bench: skip_whitespace stopped early.");
+        });
+    }
+
+    // parse_string_literal : strings of varied length, some with escapes, separated by one space
+    {
+        std::string strings;
+        size_t count = 0;
+        while(strings.size() < (1 << 20)){
+            strings += "\"" + std::string(4 + count % 40, 'a' + count % 26) + (count % 5 == 0 ? "\\t\\u00e9" : "") + "\" ";
+            count++;
+        }
+        Physon physon (strings);
+        std::string out;
+
+        bench.run("parse_string_literal", strings.size(), [&](){
+            const char* c = physon.content.data();
+            for(size_t i = 0; i < count; i++){
+                out.clear();
+                physon.parse_string_literal(c, out);
+                c++;
+            }
+        });
+    }
+
+    // parse_number_literal : integers and floats separated by one space
+    {
+        std::string numbers;
+        size_t count = 0;
+        while(numbers.size() < (1 << 20)){
+            numbers += count % 3 == 0 ? std::to_string(count * 131) : std::to_string(count * 0.37) + (count % 6 == 1 ? "e-7" : "");
+            numbers += " ";
+            count++;
+        }
+        Physon physon (numbers);
+
+        bench.run("parse_number_literal", numbers.size(), [&](){
+            const char* c = physon.content.data();
+            for(size_t i = 0; i < count; i++){
+                physon.parse_number_literal(c);
+                c++;
+            }
+        });
+    }
+
+
+    std::string document = file_path.empty() ? bench_document(40000) : bench_load_file(file_path);
+    Physon physon (document);
+    physon.parse();
+
+    bench.run("parse", document.size(), [&](){
+        physon.parse();
+    });
+
+    bench.run("build_string", document.size(), [&](){
+        physon.build_string(physon.root_wrapper);
+    }, [&](){
+        physon.stringify_string.clear();
+    });
+
+    bench.run("stringify", document.size(), [&](){
+        physon.stringify();
+    });
+
+
+    bench.print();
+
+    int regressions = 0;
+    if(!baseline_path.empty()){
+        std::cout << std::endl << "Against " << baseline_path << " (threshold " << threshold * 100 << "%) :" << std::endl;
+        regressions = bench.compare(baseline_path, threshold);
+        std::cout << regressions << " regression(s)" << std::endl;
+    }
+    if(!write_baseline_path.empty())
+        bench.write_baseline(write_baseline_path);
+
+    return regressions > 0 ? 1 : 0;
+}
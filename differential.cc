@@ -0,0 +1,297 @@
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "physon.hh"
+#include "physon_types.hh"
+#include "physon_traverse.hh"
+#include "physon_projection.hh"
+#include "physon_pipeline.hh"
+
+
+/**
+    Differential test of the parsers that re-implement the grammar of Physon::parse().
+
+    Every case is parsed by parse() and by the parser under test, for several policies, and the outcomes must agree :
+        validate()                  true exactly when a lazy parse(), which decodes no numbers, succeeds
+        physon_parse_projected()    with the "" projection : throws when parse() does, otherwise the same store
+        reparse()                   of a random edit : the same error, or the same store and spans, as parse() of the edited content
+        physon_parse_pipelined()    forced onto two threads : the same error, or the same store and spans
+    Cases are fixed documents, including broken ones, and random garbles of a generated document.
+
+    Build and run:
+        g++ -std=gnu++17 -O2 differential.cc -o build/differential -lpthread
+        ./build/differential                    # exit code 1 on a mismatch
+
+    Options:
+        --garbles N         garbled documents, and as many edits of the intact one
+        --seed N            seed of the garbling
+ */
+
+
+/** Comments and trailing commas, without the duplicate key check the pipeline leaves to parse() */
+struct DifferentialLenientPolicy : PhysonStrictPolicy {
+    static constexpr bool allow_comments = true;
+    static constexpr bool allow_trailing_commas = true;
+};
+
+
+struct Differential {
+
+    size_t cases = 0;
+    size_t mismatches = 0;
+
+    /** Stringified store and spans in store order */
+    static std::string outcome(Physon& physon){
+        std::string out = physon.stringify();
+        for(SourceSpan span : physon.array_spans)
+            out += " [" + std::to_string(span.start) + "," + std::to_string(span.end);
+        for(SourceSpan span : physon.object_spans)
+            out += " {" + std::to_string(span.start) + "," + std::to_string(span.end);
+        return out;
+    }
+
+    /** json_traverse() visitor listing the spans of the reachable containers in document order */
+    struct SpanVisitor {
+        Physon& physon;
+        std::string out;
+        bool enter(const TraverseEntry& entry){
+            SourceSpan& span = physon.span_of(entry.value);
+            out += " " + std::to_string(span.start) + "," + std::to_string(span.end);
+            return true;
+        }
+        void leave(const TraverseEntry&){}
+        void scalar(const TraverseEntry&){}
+    };
+
+    /** Stringified store and spans in document order. A reparsed store also holds unreachable containers. */
+    static std::string document_outcome(Physon& physon){
+        SpanVisitor visitor { physon, physon.stringify() };
+        json_traverse(physon.store, physon.root_wrapper, visitor);
+        return visitor.out;
+    }
+
+    template<typename Policy>
+    static std::string parse_outcome(const std::string& document, std::string (*describe)(Physon&) = outcome){
+        Physon physon (document);
+        try {
+            physon.parse<Policy>();
+        }
+        catch(const std::runtime_error& error){
+            return std::string("error : ") + error.what();
+        }
+        return describe(physon);
+    }
+
+    void report(const char* parser, const char* policy, const std::string& document, const std::string& expected, const std::string& actual){
+        mismatches++;
+        std::cout << "MISMATCH " << parser << " " << policy << std::endl
+                  << "  document : " << document.substr(0, 200) << std::endl
+                  << "  parse()  : " << expected.substr(0, 300) << std::endl
+                  << "  " << parser << " : " << actual.substr(0, 300) << std::endl;
+    }
+
+    /** physon_parse_pipelined() forced onto two threads. Content parse() accepts must not take the fallback. */
+    template<typename Policy>
+    void pipeline(const char* policy, const std::string& document){
+        cases++;
+        std::string expected = parse_outcome<Policy>(document);
+
+        Physon physon (document);
+        std::string actual;
+        try {
+            bool pipelined = physon_parse_pipelined<Policy>(physon, 0, 0);
+            actual = outcome(physon);
+            if(!pipelined)
+                actual = "fell back to parse() : " + actual;
+        }
+        catch(const std::runtime_error& error){
+            actual = std::string("error : ") + error.what();
+        }
+
+        if(actual != expected)
+            report("pipeline", policy, document, expected, actual);
+    }
+
+    /** Syntax only, so checked against a parse that leaves numbers, and their range errors, undecoded */
+    void validate(const std::string& document){
+        cases++;
+        std::string expected = parse_outcome<PhysonLazyPolicy>(document);
+        bool parses = expected.compare(0, 5, "error") != 0;
+
+        Physon physon (document);
+        bool valid = physon.validate();
+
+        if(valid != parses)
+            report("validate", "strict", document, expected, valid ? "valid" : "invalid");
+    }
+
+    /** The whole document selected. The projected parse leaves the spans empty and its messages may differ. */
+    template<typename Policy>
+    void projected(const char* policy, const std::string& document){
+        cases++;
+        std::string expected = parse_outcome<Policy>(document, [](Physon& physon){ return physon.stringify(); });
+
+        Physon physon (document);
+        std::string actual;
+        try {
+            physon_parse_projected<Policy>(physon, PhysonProjection { "" });
+            actual = physon.stringify();
+        }
+        catch(const std::runtime_error& error){
+            actual = std::string("error : ") + error.what();
+        }
+
+        bool expected_error = expected.compare(0, 5, "error") == 0;
+        bool actual_error = actual.compare(0, 5, "error") == 0;
+        if(expected_error != actual_error || (!expected_error && actual != expected))
+            report("projected", policy, document, expected, actual);
+    }
+
+    /** Edit of a document parse() accepts, against a full parse of the edited content */
+    template<typename Policy>
+    void reparse(const char* policy, const std::string& document, size_t start, size_t removed_length, const std::string& replacement){
+
+        std::string edited = document;
+        edited.replace(start, removed_length, replacement);
+        if(edited.empty())
+            return;
+
+        Physon physon (document);
+        try {
+            physon.parse<Policy>();
+        }
+        catch(const std::runtime_error&){
+            return;
+        }
+        cases++;
+
+        std::string expected = parse_outcome<Policy>(edited, document_outcome);
+
+        std::string actual;
+        try {
+            physon.reparse<Policy>(start, removed_length, replacement);
+            actual = document_outcome(physon);
+        }
+        catch(const std::runtime_error& error){
+            actual = std::string("error : ") + error.what();
+        }
+
+        if(actual != expected)
+            report("reparse", policy, document + "  <- " + std::to_string(start) + "," + std::to_string(removed_length) + " \"" + replacement + "\"", expected, actual);
+    }
+
+    template<typename Policy>
+    void all(const char* policy, const std::string& document, size_t start, size_t removed_length, const std::string& replacement){
+        projected<Policy>(policy, document);
+        reparse<Policy>(policy, document, start, removed_length, replacement);
+        pipeline<Policy>(policy, document);
+    }
+
+    /** Every parser on document, with one edit for reparse() */
+    void all_policies(const std::string& document, size_t start, size_t removed_length, const std::string& replacement){
+        validate(document);
+        all<PhysonStrictPolicy>("strict", document, start, removed_length, replacement);
+        all<PhysonTrustedPolicy>("trusted", document, start, removed_length, replacement);
+        all<PhysonLazyNumberPolicy>("lazy_number", document, start, removed_length, replacement);
+        all<PhysonLazyPolicy>("lazy", document, start, removed_length, replacement);
+        all<DifferentialLenientPolicy>("lenient", document, start, removed_length, replacement);
+    }
+};
+
+
+/** Records with nested containers, escapes, unicode, integers, floats and literals */
+std::string differential_document(size_t records){
+    std::string document = "[";
+    for(size_t i = 0; i < records; i++){
+        if(i > 0)
+            document += ",\n ";
+        document += "{\"id\": " + std::to_string(i)
+                  + ", \"name\": \"rec\\\"ord " + std::to_string(i) + "\\u00e9\\ud83d\\ude00\""
+                  + ", \"pos\": [" + std::to_string(i * 0.125) + ", -1e3, true, false, null]"
+                  + ", \"meta\": {\"w\": " + std::to_string(i % 97) + ".5e-3, \"\\u00e9k\": {}, \"big\": 123456789012345678}"
+                  + ", \"e\": []}";
+    }
+    return document + "]";
+}
+
+
+int main(int argc, char** argv){
+
+    size_t garbles = 300;
+    unsigned seed = 1;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(arg == "--garbles" && has_value)         garbles = std::stoul(argv[++i]);
+        else if(arg == "--seed" && has_value)       seed = std::stoul(argv[++i]);
+        else {
+            std::cerr << "usage: differential [--garbles N] [--seed N]" << std::endl;
+            return 2;
+        }
+    }
+
+    Differential differential;
+
+    std::vector<std::string> documents = {
+        "{\"a\": [1, 2.5, \"x\\ny\", true, false, null, {}, []], \"b\\\"c\": {\"d\": -0}}",
+        "5", "-0.5e-7", "\"s\"", "true", "null", "[]", "{}", " [ [ [ ] ] ] ", "{\"a\": {\"a\": {\"a\": []}}}",
+        "[\"\\u0041\\u00e9\\u4e2d\\ud834\\udd1e\", \"\\/\\b\\f\\r\\t\"]", "[\"\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80\"]",
+        "[1, /* block */ 2 // line\n]", "[1, 2,]", "{\"a\": 1,}", "[1, 2] // tail",
+        "[1 2]", "[1,]", "{\"a\" 1}", "{1: 2}", "[1, x]", "[tru]", "[nul]", "[\"abc", "   ", "[1] 2", "[1] tru", "[1]]",
+        "{\"a\": 1]", "[1}", "[", "{\"a\":", "{\"a\"", "99999999999999999999", "[1e999]", "[01]", "[1.]", "[.5]", "[-]",
+        "[\"\\x\"]", "[\"a\x01\"]", "[\"\\ud800\"]", "[\"\\udc00\"]", "[\"\\u12\"]", "{,}", "[,1]", "[1,,2]", "\xff", "[\"\xc3\"]",
+        "[/* open", "[1, 2 /", "{\"a\", 1}", "{\"a\": 1 \"b\": 2}", "{\"a\":}", "{:1}", "[1:2]", "{\"a\": 1}}", "[[]", "{\"a\": [}]",
+        "{\"a\": 1, \"a\": 2}", "[1, {\"b\": [true, {\"c\": null}], \"d\": \"\"}]"
+    };
+
+    // Large enough to wrap the token ring of the pipeline
+    std::string generated = differential_document(1000);
+    documents.push_back(generated);
+
+    std::mt19937 rng (seed);
+
+    // Edits for reparse() : values, containers and broken text, replacing up to a few chars anywhere
+    const std::vector<std::string> replacements = {
+        "", "7", "-2.5e3", "\"x\\ny\"", "true", "null", "[]", "{}", "[1, [2]]", "{\"k\": {\"m\": []}}", "1, 2", "\"a\": 3, \"b\"",
+        ",", "]", "}", "[", "{", "\"", "\\", ":", "/* c */", "x"
+    };
+    auto edit_of = [&](const std::string& document, size_t& start, size_t& removed_length, std::string& replacement){
+        start = rng() % (document.size() + 1);
+        removed_length = std::min<size_t>(rng() % 4, document.size() - start);
+        replacement = replacements[rng() % replacements.size()];
+    };
+
+    size_t start;
+    size_t removed_length;
+    std::string replacement;
+
+    for(const std::string& document : documents){
+        edit_of(document, start, removed_length, replacement);
+        differential.all_policies(document, start, removed_length, replacement);
+    }
+
+    // A few bytes of the generated document replaced by structural chars, digits, letters and escapes
+    std::string garble_document = differential_document(40);
+    const std::string garble_chars = "[]{},:\"\\ 1a-.e/u*\n";
+    for(size_t i = 0; i < garbles; i++){
+        std::string document = garble_document;
+        size_t changes = 1 + rng() % 3;
+        for(size_t k = 0; k < changes; k++)
+            document[rng() % document.size()] = garble_chars[rng() % garble_chars.size()];
+        edit_of(document, start, removed_length, replacement);
+        differential.all_policies(document, start, removed_length, replacement);
+    }
+
+    // Edits of the intact document, which parse() always accepts
+    for(size_t i = 0; i < garbles; i++){
+        edit_of(garble_document, start, removed_length, replacement);
+        differential.all_policies(garble_document, start, removed_length, replacement);
+    }
+
+    std::cout << differential.cases << " cases, " << differential.mismatches << " mismatch(es)" << std::endl;
+
+    return differential.mismatches > 0 ? 1 : 0;
+}
@@ -1,5 +1,8 @@
+#pragma once
+
 #include <string>
 #include <vector>
+#include <map>
 
 #include "../physon.hh"
 #include "../physon_types.hh"
@@ -13,5 +16,77 @@ struct Config {
     std::string physon_string;
 
     Config(std::string physon_str) : physon {Physon(physon_str) } {};
+    virtual ~Config() = default;
+
+    /** 
+        Called by reload() for each top-level key whose value changed. 
+        value is a NONE wrapper when the key was removed. 
+     */
+    virtual void load_section(std::string key, JsonWrapper value) {};
+
+    /** 
+        Parse new_physon_str and re-run load_section() only for top-level keys that differ from the current document.
+        On a parse error the current document is kept. Returns the changed keys.
+        Parsed with PhysonConfigPolicy : comments and trailing commas are accepted, duplicate keys are not.
+     */
+    std::vector<std::string> reload(std::string new_physon_str);
 };
 
+
+std::vector<std::string> Config::reload(std::string new_physon_str){
+
+    Physon new_physon (new_physon_str);
+    new_physon.parse<PhysonConfigPolicy>();
+
+    if(new_physon.root_wrapper.type() != JSON_TYPE::OBJECT)
+        throw std::runtime_error("Config reload: root value is not an object.");
+
+    // Sections of the current document. Empty if never parsed.
+    std::map<std::string, JsonWrapper> old_sections;
+    if(physon.root_wrapper.type() == JSON_TYPE::OBJECT){
+        for(JsonWrapper kv_wrapper : physon.unwrap_object(physon.root_wrapper)){
+            json_kv_wrap& kv = physon.unwrap_kv(kv_wrapper);
+            old_sections[kv.first] = kv.second;
+        }
+    }
+
+    std::vector<std::string> changed_keys;
+    for(JsonWrapper kv_wrapper : new_physon.unwrap_object(new_physon.root_wrapper)){
+        json_kv_wrap& kv = new_physon.unwrap_kv(kv_wrapper);
+
+        auto old_section = old_sections.find(kv.first);
+        bool unchanged = old_section != old_sections.end()
+                         && json_equal(physon.store, old_section->second, new_physon.store, kv.second);
+
+        if(!unchanged)
+            changed_keys.push_back(kv.first);
+
+        if(old_section != old_sections.end())
+            old_sections.erase(old_section);
+    }
+
+    // Whatever is left was removed
+    std::vector<std::string> removed_keys;
+    for(auto& old_section : old_sections)
+        removed_keys.push_back(old_section.first);
+
+
+    physon = std::move(new_physon);
+    physon_string = new_physon_str;
+
+    for(std::string& key : changed_keys){
+        for(JsonWrapper kv_wrapper : physon.unwrap_object(physon.root_wrapper)){
+            json_kv_wrap& kv = physon.unwrap_kv(kv_wrapper);
+            if(kv.first == key){
+                load_section(key, kv.second);
+                break;
+            }
+        }
+    }
+    for(std::string& key : removed_keys)
+        load_section(key, JsonWrapper());
+
+    changed_keys.insert(changed_keys.end(), removed_keys.begin(), removed_keys.end());
+    return changed_keys;
+}
+
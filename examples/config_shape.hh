@@ -1,5 +1,6 @@
 #include <string>
 #include <vector>
+#include <algorithm>
 
 #include "../physon.hh"
 #include "../physon_types.hh"
@@ -8,88 +9,103 @@
 #include "config.hh"
 
 
-class ConfigShape : Config {
+class ConfigShape : public Config {
 
     std::vector<Shape> shapes;
+    /** Top-level key of each entry in shapes */
+    std::vector<std::string> shape_names;
     /** Returns the float 2d-points of a json-point array, e.g. [[0.0, 0.0],[1.0, 1.0]] */
-    std::vector<Point> unwrap_point_array(json_array_wrap point_array);
+    std::vector<Point> unwrap_point_array(JsonArrayView point_array);
 
 public:
 
     ConfigShape(std::string config_string) :  Config(config_string) {};
     std::vector<Shape>& load_shapes();
+    /** Build, replace or remove the shape of a single top-level key. Called by Config::reload() for changed keys. */
+    void load_section(std::string key, JsonWrapper value) override;
 };
 
 
 
 
-std::vector<Point> ConfigShape::unwrap_point_array(json_array_wrap point_array){
+std::vector<Point> ConfigShape::unwrap_point_array(JsonArrayView point_array){
     std::vector<Point> points;
+    points.reserve(point_array.size());
 
-    for(int i = 0; i < point_array.size(); i++){
+    for(JsonRef point : point_array){
+        Point new_point = {point[0].as<double>(), point[1].as<double>()};
+        points.push_back(new_point);
+    }
 
-        JsonWrapper point_wrapper = point_array[i];
+    return points;
+}
 
-        // Unwrap point
-        json_array_wrap point_array = physon.unwrap_array(point_wrapper);
 
-        json_float point_x = physon.unwrap_float(point_array[0]);
-        json_float point_y = physon.unwrap_float(point_array[1]);
 
-        Point point = {point_x, point_y};
-        points.push_back(point);
+std::vector<Shape>& ConfigShape::load_shapes(){
 
-    }
+    physon.parse<PhysonConfigPolicy>();
 
-    return points;
+    shapes.clear();
+    shape_names.clear();
+    
+    // Loop shapes
+    for(JsonMember section : physon.root().as<JsonObjectView>())
+        load_section(std::string(section.key), section.value.wrapper);
+
+    return shapes;
 }
 
 
 
-std::vector<Shape>& ConfigShape::load_shapes(){
+void ConfigShape::load_section(std::string key, JsonWrapper value){
 
-    physon.parse();
-    
-    JsonWrapper root_object_wrapper = physon.root_wrapper;
-    json_object_wrap root_object = physon.unwrap_object(root_object_wrapper);
+    size_t shape_index = std::find(shape_names.begin(), shape_names.end(), key) - shape_names.begin();
 
-    // Loop shapes
-    for(JsonWrapper kv_wrap : root_object){
-        json_kv_wrap kv = physon.unwrap_kv(kv_wrap);
-
-        Shape new_shape;
-
-        std::string shape_name = kv.first;
-        json_array_wrap point_array = physon.unwrap_array(kv.second);
-
-
-        if(shape_name == "line"){
-            new_shape.type = SHAPE::LINE;
-
-            // JsonWrapper point_1_wrapper = point_array[0];
-            // JsonWrapper point_2_wrapper = point_array[1];
-
-            // // Unwrap point 1
-            // json_array_wrap point_1_array = physon.unwrap_array(point_1_wrapper);
-            // json_float point_1_x = physon.unwrap_float(point_1_array[0]);
-            // json_float point_1_y = physon.unwrap_float(point_1_array[1]);
-            // Point point_1 = {point_1_x, point_1_y};
-            // new_shape.points.push_back(point_1);
-            
-            // // Unwrap point 2
-            // json_array_wrap point_2_array = physon.unwrap_array(point_2_wrapper);
-            // json_float point_2_x = physon.unwrap_float(point_2_array[0]);
-            // json_float point_2_y = physon.unwrap_float(point_2_array[1]);
-            // Point point_2 = {point_2_x, point_2_y};
-            // new_shape.points.push_back(point_2);
+    // Removed shape
+    if(value.type() == JSON_TYPE::NONE){
+        if(shape_index < shapes.size()){
+            shapes.erase(shapes.begin() + shape_index);
+            shape_names.erase(shape_names.begin() + shape_index);
         }
+        return;
+    }
 
+    Shape new_shape;
 
-        new_shape.points = unwrap_point_array(point_array);
+    std::string shape_name = key;
+    JsonArrayView point_array = physon.view(value).as<JsonArrayView>();
 
-        shapes.push_back(new_shape);
 
+    if(shape_name == "line"){
+        new_shape.type = SHAPE::LINE;
+
+        // JsonWrapper point_1_wrapper = point_array[0];
+        // JsonWrapper point_2_wrapper = point_array[1];
+
+        // // Unwrap point 1
+        // json_array_wrap point_1_array = physon.unwrap_array(point_1_wrapper);
+        // json_float point_1_x = physon.unwrap_float(point_1_array[0]);
+        // json_float point_1_y = physon.unwrap_float(point_1_array[1]);
+        // Point point_1 = {point_1_x, point_1_y};
+        // new_shape.points.push_back(point_1);
+        
+        // // Unwrap point 2
+        // json_array_wrap point_2_array = physon.unwrap_array(point_2_wrapper);
+        // json_float point_2_x = physon.unwrap_float(point_2_array[0]);
+        // json_float point_2_y = physon.unwrap_float(point_2_array[1]);
+        // Point point_2 = {point_2_x, point_2_y};
+        // new_shape.points.push_back(point_2);
     }
 
-    return shapes;
+
+    new_shape.points = unwrap_point_array(point_array);
+
+    if(shape_index < shapes.size()){
+        shapes[shape_index] = new_shape;
+    }
+    else {
+        shapes.push_back(new_shape);
+        shape_names.push_back(shape_name);
+    }
 }
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "config.hh"
+
+
+/** 
+    Reloads configs when their files change on disk.
+    The containing directory is watched so that editors replacing the file by rename are also picked up.
+  */
+struct ConfigWatcher {
+
+    struct Watch {
+        int watch_descriptor;
+        std::string directory;
+        std::string file_name;
+        Config* config;
+    };
+
+    struct Failure {
+        std::string path;
+        std::string error;
+    };
+
+    int inotify_fd = -1;
+    std::vector<Watch> watches;
+    /** Configs whose reload failed in the last poll(). They keep their previous document. */
+    std::vector<Failure> failures;
+
+    ConfigWatcher();
+    ~ConfigWatcher();
+
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+    void watch(Config& config, std::string path);
+    /** 
+        Non-blocking. Reloads each config whose file was written since the last poll, at most once per poll.
+        Returns the number of reloaded configs. inotify_fd can be added to an event loop to know when to poll.
+        A file that cannot be read or parsed, e.g. caught mid-write or gone during a rename, does not stop the
+        other reloads : it is listed in failures, and its next write triggers a new attempt.
+     */
+    int poll();
+
+    std::string read_file(std::string path);
+};
+
+
+ConfigWatcher::ConfigWatcher(){
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd < 0)
+        throw std::runtime_error("ConfigWatcher: inotify_init1 failed.");
+}
+
+ConfigWatcher::~ConfigWatcher(){
+    if(inotify_fd >= 0)
+        close(inotify_fd);
+}
+
+void ConfigWatcher::watch(Config& config, std::string path){
+
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+    std::string file_name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    int watch_descriptor = inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if(watch_descriptor < 0)
+        throw std::runtime_error("ConfigWatcher: failed to watch directory " + directory);
+
+    watches.push_back({watch_descriptor, directory, file_name, &config});
+}
+
+int ConfigWatcher::poll(){
+
+    std::vector<Watch*> changed;
+
+    alignas(struct inotify_event) char buffer[4096];
+
+    while(true){
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if(length <= 0)
+            break;
+
+        for(char* c = buffer; c < buffer + length; ){
+            struct inotify_event* event = reinterpret_cast<struct inotify_event*>(c);
+            c += sizeof(struct inotify_event) + event->len;
+
+            if(event->len == 0)
+                continue;
+
+            for(Watch& watch : watches){
+                bool is_watched_file = watch.watch_descriptor == event->wd && watch.file_name == event->name;
+                bool already_changed = std::find(changed.begin(), changed.end(), &watch) != changed.end();
+                if(is_watched_file && !already_changed)
+                    changed.push_back(&watch);
+            }
+        }
+    }
+
+    failures.clear();
+    int reloaded = 0;
+
+    for(Watch* watch : changed){
+        std::string path = watch->directory + "/" + watch->file_name;
+        try {
+            watch->config->reload(read_file(path));
+            reloaded++;
+        }
+        catch(const std::exception& error){
+            failures.push_back({path, error.what()});
+        }
+    }
+
+    return reloaded;
+}
+
+std::string ConfigWatcher::read_file(std::string path){
+
+    std::ifstream file(path);
+    if(!file.is_open())
+        throw std::runtime_error("ConfigWatcher: failed to open " + path);
+
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
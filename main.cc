@@ -71,7 +71,7 @@ int main (int argc, char **argv) {
     // Shape config
     ConfigShape shape_config {_json_string};
     std::vector<Shape>& shapes = shape_config.load_shapes();
-    for(Shape shape : shapes){
+    for(Shape& shape : shapes){
         shape.print();
     }
 
@@ -7,8 +7,15 @@
 #include <sstream>
 #include <iomanip> // setprecision
 #include <climits> // LLONG_MAX
+#include <cstring>
+#include <charconv> // from_chars
+#include <algorithm>
+#include <string_view>
 
 #include "physon_types.hh"
+#include "physon_unicode.hh"
+#include "physon_traverse.hh"
+#include "physon_view.hh"
 
 
 #define log(x) std::cout << x << std::endl;
@@ -17,6 +24,9 @@
 #define SOLLIDUS            '\u002F'
 #define SOLLIDUS_BACKWARDS  '\u005C'
 
+#define PHYSON_VALIDATE_MAX_DEPTH 1024 /** Max container nesting accepted by validate() */
+#define PHYSON_STRINGIFY_CACHE_MIN_SIZE 64 /** Containers with shorter json text are rebuilt instead of cached */
+
 
 struct Physon {
     std::string content;
@@ -29,7 +39,7 @@ struct Physon {
     std::vector<Token> tokens;
 
     
-    Physon(std::string json_str) : content {json_str} {
+    Physon(std::string json_str) : content {std::move(json_str)} {
         if(content.size() == 0)
             json_error("Error: json content string is empty. ");
     }; 
@@ -38,29 +48,76 @@ struct Physon {
     // PRINT
     void print_original();
 
+    /** Heap bytes used and reserved by the store and the parser buffers */
+    PhysonMemoryReport memory_report();
+
     /** Temporary string for stringification. */
     std::string stringify_string;
     /** returns full json structure as string */
     std::string stringify();            
-    /** recursive string builder */    
+    /** returns json string of value and its subtree */
+    std::string stringify(JsonWrapper value);
+    /** Nesting limit of stringify(). Deeper values throw instead of being serialized. */
+    int stringify_max_depth = PHYSON_TRAVERSE_MAX_DEPTH;
+    /** Appends json text of value to stringify_string, walking containers with json_traverse() */
     void build_string(JsonWrapper value);
+    /** Appends json text of a non-container value */
+    void build_scalar_string(JsonWrapper value);
     std::string float_to_json_representation(json_float float_);
     /** Converts a std::string to is JSON equivelence. e.g. <I "mean" it..> --> <"I \"mean\" it.."> */
     std::string string_to_json_representation(std::string cpp_string);
+
+    /** Serialized container text reused by stringify() until a mutation touches the container. */
+    bool stringify_cache_enabled = false;
+    StringifyCache stringify_cache;
+    void enable_stringify_cache();
+    bool append_cached_string(JsonWrapper container);
+    void cache_string(JsonWrapper container, size_t start_index);
+    /** Record parent of value. A container already placed elsewhere becomes shared. */
+    void set_parent(JsonWrapper value, JsonWrapper parent);
+    /** Forget parent of removed once container no longer holds it */
+    void unset_parent(JsonWrapper container, JsonWrapper removed);
+    /** Record parents of the containers below from */
+    void record_parents(JsonWrapper from);
+    /** Record parents of the whole document if not done since the last clear of the cache */
+    void track_parents();
+    /** Drop cached text of container and every ancestor */
+    void mark_dirty(JsonWrapper container);
+    /** Throws if value is container or one of its ancestors */
+    void check_placement(JsonWrapper container, JsonWrapper value);
     
 
     // QUERYING
-    json_float& unwrap_float(JsonWrapper float_wrapper){
-        return store.get_float(float_wrapper.store_id);
+    /** A lazy NUMBER is decoded on the first unwrap and cached */
+    json_float unwrap_float(JsonWrapper float_wrapper){
+        if(float_wrapper.type() == JSON_TYPE::NUMBER)
+            store.decode_number(float_wrapper);
+        return store.get_float(float_wrapper);
+    }
+    json_int unwrap_int(JsonWrapper int_wrapper){
+        if(int_wrapper.type() == JSON_TYPE::NUMBER)
+            store.decode_number(int_wrapper);
+        return store.get_integer(int_wrapper);
+    }
+    /** A lazy string with escapes is unescaped on the first unwrap. The view lives as long as the store. */
+    std::string_view unwrap_string(JsonWrapper string_wrapper){
+        return store.get_string_view(string_wrapper);
     }
     json_array_wrap& unwrap_array(JsonWrapper array_wrapper){
-        return store.get_array(array_wrapper.store_id);
+        return store.get_array(array_wrapper.store_id());
     }
     json_object_wrap& unwrap_object(JsonWrapper object_wrapper){
-        return store.get_object(object_wrapper.store_id);
+        return store.get_object(object_wrapper.store_id());
     }
     json_kv_wrap& unwrap_kv(JsonWrapper kv_wrapper){
-        return store.get_kv(kv_wrapper.store_id);
+        return store.get_kv(kv_wrapper.store_id());
+    }
+    /** Typed, non-owning handle of value, see physon_view.hh */
+    JsonRef view(JsonWrapper value){
+        return JsonRef(store, value);
+    }
+    JsonRef root(){
+        return JsonRef(store, root_wrapper);
     }
     JsonWrapper& find(std::string key);      // for json_object_wrap - not recursive
     json_object_wrap& get_object();              // for json_object_wrap
@@ -69,61 +126,95 @@ struct Physon {
     // UNWRAPPING
     json_bool& unwrap_bool(JsonWrapper wrapper);
 
+    // MUTATION
+    // New values are created with the store, e.g. store.new_float(1.0), and then placed with these methods.
+    /** Set value of key in object. Adds a new kv if the key is missing. */
+    void set(JsonWrapper object_wrapper, std::string key, JsonWrapper value);
+    /** Replace array entry at index */
+    void set(JsonWrapper array_wrapper, size_t index, JsonWrapper value);
+    void insert(JsonWrapper array_wrapper, size_t index, JsonWrapper value);
+    void push_back(JsonWrapper array_wrapper, JsonWrapper value);
+    /** Returns false if key is not found */
+    bool erase(JsonWrapper object_wrapper, std::string key);
+    void erase(JsonWrapper array_wrapper, size_t index);
+    void mutation_error(std::string error_msg);
+    /** Set by physon_deduplicate() : containers may be shared by several parents, so mutation throws until the next parse() */
+    bool shared_subtrees = false;
+    void check_mutable();
+
     // PARSING
 
     JSON_PARSE_STATE state;
 
-    void before_root_value();
-    void end_of_root_value();
-    bool root_no_container();
-
-    void array_entered();
-    
-    void index_advance();
-    void comma_skip(); /** Branching based on the container. */
-    void colon_skip();
-    void value_at_new_value_char();
-    void value_end_of_value();
-
     std::string state_to_string();
     void json_error(std::string error_msg);
-
-    void add_value_to_current_container(JsonWrapper value);
-    
-    void parse();                   /** Parse the content string */
+    /** json_error() reporting c as the content index */
+    void json_error_at(const char* c, std::string error_msg);
+
+    /** Limits of parse() with a Policy that sets enforce_budget, e.g. PhysonUntrustedPolicy */
+    PhysonBudget budget;
+    /** 
+        Values and store bytes the last parse() charged against budget, set when it enforced one.
+        reparse() charges its sub-parse on top, since replaced subtrees stay in the store.
+     */
+    bool budget_charged = false;
+    size_t budget_values = 0;
+    size_t budget_store_bytes = 0;
+    /** Throws PhysonBudgetError with code, reporting c as the content index */
+    void budget_error(const char* c, PHYSON_BUDGET code, std::string error_msg);
+
+    /** 
+        Parse the content string.
+        One pass over content dispatching on char_class_table, with open containers kept in cursor.container_trace.
+        Policy selects the accepted syntax and checks at compile time, see PhysonStrictPolicy.
+     */
+    template<typename Policy = PhysonStrictPolicy>
+    void parse();
+    /** Moves c past whitespace, and past comments when Policy allows them */
+    template<typename Policy>
+    void skip_whitespace(const char*& c);
+    /** c at '/'. Moves c past the line or block comment. */
+    void skip_comment(const char*& c);
+    /** Throws if two kvs of the object entries share a key. keys is scratch space. */
+    void check_duplicate_keys(const JsonWrapper* first, const JsonWrapper* last, std::vector<std::string_view>& keys, const char* c);
+
+    // INCREMENTAL REPARSE
+    /** Content spans of containers, indexed by store id. Recorded during parse. */
+    std::vector<SourceSpan> array_spans;
+    std::vector<SourceSpan> object_spans;
+    /** 
+        Replace removed_length chars at start with replacement and update the store.
+        Only the smallest container whose brackets lie outside the edit is re-parsed; falls back to a full parse otherwise.
+        Assumes the store still matches content, i.e. no mutations since the last parse.
+        Replaced subtrees stay in the store as unreachable entries until the next full parse.
+     */
+    template<typename Policy = PhysonStrictPolicy>
+    void reparse(size_t start, size_t removed_length, std::string replacement);
+    SourceSpan& span_of(JsonWrapper container);
+    /** 
+        Smallest container with opening char before start and closing char at or after end. NONE if root does not qualify.
+        depth, if given, is set to the number of containers around it.
+     */
+    JsonWrapper enclosing_container(size_t start, size_t end, size_t* depth = nullptr);
+
+    // VALIDATION
+    /** Check that content is well-formed json. Nothing is written to the store. */
+    bool validate();
+    bool validate_string(const char*& c, const char* end);  /** c at opening quotation mark. Moves past closing mark. */
+    bool validate_number(const char*& c, const char* end);  /** c at first char of number. Moves past last digit. */
 
     void print_tokens();
 
-    void array_enter();
-    void array_close();
-
-    void object_enter();
-    void object_parse_key_comma();
-    void object_close();
-
-    void value_parse_literal(); /** Parse literal with cursor confirmed pointing at first char in literal */
-    JsonWrapper parse_string_literal();  /** parse and progress index. */
-    std::string parse_digits();
-    bool integer_within_limits(std::string int_);
-    JsonWrapper parse_number_literal();  /** parse and progress index. */
-    JsonWrapper parse_true_literal();    /** confirm "true" chars and progress index. */
-    JsonWrapper parse_false_literal();   /** confirm "false" chars and progress index. */
-    JsonWrapper parse_null_literal();    /** confirm "null" chars and progress index. */
-
-    char current_char();
-    bool is_new_value_char();   /** is_new_literal_char() U is_new_container_char() */
-    bool is_quotation_mark();
-    bool is_new_literal_char();
-    bool is_new_container_char();
-    bool is_new_array_char();
-    bool is_close_array_char();
-    bool is_new_object_char();
-    bool is_close_object_char();
-    bool is_valid_number_char(){
-        char c = current_char();
-        bool is_number_char = (c >= '0' && c <= '9') || c == '-' || c == '+' || c == 'e' || c == 'E' || c == '.';
-        return is_number_char;
-    };
+    /** c at opening quotation mark. Appends the unescaped string to out and moves c past the closing mark. */
+    void parse_string_literal(const char*& c, std::string& out);
+    /** parse_string_literal() that only checks the string unless Decode. Returns true if the string has escapes. */
+    template<bool Decode>
+    bool scan_string_literal(const char*& c, std::string* out);
+    /** c at first char of number. Moves c past the last char of the number. */
+    JsonWrapper parse_number_literal(const char*& c);
+    /** c at first char of number. Checks the number grammar and moves c past its last char. Returns true for a fraction or exponent. */
+    bool scan_number_literal(const char*& c);
+
     bool is_digit(char c){
         return (c >= '0' && c <= '9') ? true : false;
     };
@@ -132,26 +223,26 @@ struct Physon {
     };
 
     bool is_whitespace(char ch);
-    void gobble_ws();               /** progress index until cursor not pointing at whitespace */
 
     bool is_literal(JSON_TYPE type);
     bool is_container(JSON_TYPE type);
-
-    JsonWrapper current_container();
-    bool current_container_is_array();
-    bool current_container_is_object();
-    JSON_TYPE current_container_type();
     
 };
 
 
+/** Deep value equality of two subtrees, possibly in different stores. Object key order is ignored. */
+bool json_equal(json_store& a_store, JsonWrapper a, json_store& b_store, JsonWrapper b);
+/** Deep copy of value from one store into another (or the same) store. Returns the wrapper of the copy. */
+JsonWrapper json_copy(json_store& from_store, JsonWrapper value, json_store& to_store);
+
+
 // json_bool& Physon::unwrap_bool(JsonWrapper wrapper){
-//     bool is_false = wrapper.type == JSON_TYPE::FALSE;
-//     bool is_true = wrapper.type == JSON_TYPE::TRUE;
-//     if(wrapper.type == JSON_TYPE::TRUE)
-//         return store.get_bool(wrapper.store_id);
-//     if(wrapper.type == JSON_TYPE::FALSE)
-//         return store.get_bool(wrapper.store_id);
+//     bool is_false = wrapper.type() == JSON_TYPE::FALSE;
+//     bool is_true = wrapper.type() == JSON_TYPE::TRUE;
+//     if(wrapper.type() == JSON_TYPE::TRUE)
+//         return store.get_bool(wrapper.store_id());
+//     if(wrapper.type() == JSON_TYPE::FALSE)
+//         return store.get_bool(wrapper.store_id());
 //     else
 //         json_error("Tried to unwrap a non-boolean wrapper as boolan.");
 // }
@@ -164,10 +255,40 @@ void Physon::print_original() {
     << "------" << std::endl;
 }
 
+PhysonMemoryReport Physon::memory_report(){
+
+    PhysonMemoryReport report;
+
+    store.memory_report(report);
+
+    report.tokens = memory_of(tokens);
+    report.content = memory_of(content);
+    report.stringify_string = memory_of(stringify_string);
+    report.stringify_cache = stringify_cache.memory_usage();
+    report.spans = memory_of(array_spans);
+    report.spans += memory_of(object_spans);
+    report.parser = memory_of(cursor.container_trace);
+    report.parser += memory_of(cursor.entry_stack);
+    report.parser += memory_of(cursor.entry_starts);
+
+    for(MemoryUsage usage : { report.bools, report.integers, report.strings, report.numbers, report.source, report.arrays, report.objects, report.kvs,
+                              report.tokens, report.content, report.stringify_string, report.stringify_cache, report.spans, report.parser })
+        report.total += usage;
+
+    report.input_bytes = content.size();
+    report.amplification = content.empty() ? 0.0 : (double)report.total.reserved / content.size();
+
+    return report;
+}
+
 std::string Physon::stringify(){
+    return stringify(root_wrapper);
+}
+
+std::string Physon::stringify(JsonWrapper value){
     stringify_string = "";
 
-    build_string(root_wrapper);
+    build_string(value);
 
     return stringify_string;
 }
@@ -229,9 +350,6 @@ std::string Physon::string_to_json_representation(std::string cpp_string){
         if(ch == QUOTATION_MARK){
             json_representation += "\\\"";
         }
-        else if (ch == SOLLIDUS){
-            json_representation += "/\\";
-        }
         else if(ch == SOLLIDUS_BACKWARDS){
             json_representation += "\\\\";
         }
@@ -251,9 +369,10 @@ std::string Physon::string_to_json_representation(std::string cpp_string){
             json_representation += "\\r";
         }
         else if( (ch >= '\u0000' && ch < '\u0020') ){
-            json_representation += "\\u00XX";
-            // TODO: CONVERT ch to hex-string and append
-            json_representation += std::to_string(ch);
+            const char* hex_digits = "0123456789abcdef";
+            json_representation += "\\u00";
+            json_representation += hex_digits[ch >> 4];
+            json_representation += hex_digits[ch & 0x0F];
         }
         else {
             json_representation += ch;
@@ -266,1072 +385,1671 @@ std::string Physon::string_to_json_representation(std::string cpp_string){
     return json_representation;
 }
 
-void Physon::build_string(JsonWrapper value){
-    
-    if(is_literal(value.type)){
+/** json_traverse() visitor appending json text to physon.stringify_string */
+struct StringifyVisitor {
 
-        switch (value.type)
-        {
-        case JSON_TYPE::NULL_:
-            stringify_string.append("null");
-            break;
-        case JSON_TYPE::TRUE:
-            stringify_string.append("true");
-            break;
-        case JSON_TYPE::FALSE:
-            stringify_string.append("false");
-            break;
-        case JSON_TYPE::FLOAT:
-            {
-                json_float float_ = store.get_float(value.store_id);
-                std::string float_str = float_to_json_representation(float_);
+    Physon& physon;
+    /** stringify_string size at each open container, for the stringify cache */
+    std::vector<size_t> start_indices;
+    /** Per open container : holds a shared container, whose changes may not reach it, so it is not cached */
+    std::vector<bool> holds_shared;
 
-                stringify_string.append( float_str );
-            }
-            break;
-        case JSON_TYPE::INTEGER:
-            stringify_string.append( std::to_string(store.get_integer(value.store_id) ) );
-            break;
+    StringifyVisitor(Physon& _physon) : physon {_physon} {};
 
-        case JSON_TYPE::STRING:
-            // 1) Grab value from store
-            // 2) convert to json representation
-            // 3) append to stringify-string
-            stringify_string.append(
-                string_to_json_representation(
-                    store.get_string(value.store_id)
-                )
-            );
-            break;
-        default:
-            break;
+    /** Comma and key before an entry */
+    void append_separator(const TraverseEntry& entry){
+        if(entry.depth > 0 && entry.index > 0)
+            physon.stringify_string.append(", ");
+        if(entry.key != nullptr){
+            physon.stringify_string.append(physon.string_to_json_representation(*entry.key));
+            physon.stringify_string.append(": ");
         }
-
-        return;
     }
 
-    // Print array
-    if(value.type == JSON_TYPE::ARRAY){
-        stringify_string.append("[");
+    bool enter(const TraverseEntry& entry){
 
-        json_array_wrap array =  store.get_array(value.store_id);
+        append_separator(entry);
 
-        for(JsonWrapper array_entry : array){
-            build_string(array_entry);
-            stringify_string.append(", ");
+        if(physon.stringify_cache_enabled){
+            bool cached = physon.append_cached_string(entry.value);
+            if(physon.stringify_cache.is_shared(entry.value) && !holds_shared.empty())
+                holds_shared.back() = true;
+            if(cached)
+                return false;
         }
 
-        // no comma after last entry
-        if(array.size() > 0)
-            stringify_string.erase(stringify_string.size()-2);
-
-        stringify_string.append("]");
+        start_indices.push_back(physon.stringify_string.size());
+        holds_shared.push_back(false);
+        physon.stringify_string.push_back(entry.value.type() == JSON_TYPE::ARRAY ? '[' : '{');
+        return true;
     }
-    else if(value.type == JSON_TYPE::KV){
 
-        json_kv_wrap& kv = store.get_kv(value.store_id);
+    void leave(const TraverseEntry& entry){
 
-        stringify_string.append("\"");
-        stringify_string.append(kv.first);
-        stringify_string.append("\": ");
+        physon.stringify_string.push_back(entry.value.type() == JSON_TYPE::ARRAY ? ']' : '}');
 
-        build_string(kv.second);
-    }
-    else if(value.type == JSON_TYPE::OBJECT){
-        stringify_string.append("{");
+        size_t start_index = start_indices.back();
+        start_indices.pop_back();
+        bool shared = holds_shared.back();
+        holds_shared.pop_back();
 
-        json_object_wrap object =  store.get_object(value.store_id);
+        if(physon.stringify_cache_enabled && !shared)
+            physon.cache_string(entry.value, start_index);
+        if(shared && !holds_shared.empty())
+            holds_shared.back() = true;
+    }
 
-        for(JsonWrapper kv : object){
-            
-            build_string(kv);
+    void scalar(const TraverseEntry& entry){
+        append_separator(entry);
+        physon.build_scalar_string(entry.value);
+    }
+};
 
-            stringify_string.append(", ");
-        }
+/** json_traverse() visitor recording the parent of each container below from */
+struct ParentVisitor {
 
-        // no comma after last entry
-        if(object.size() > 0)
-            stringify_string.erase(stringify_string.size()-2);
+    Physon& physon;
+    JsonWrapper from;
 
-        stringify_string.append("}");
-    }
-}
+    ParentVisitor(Physon& _physon, JsonWrapper _from) : physon {_physon}, from {_from} {};
 
+    bool enter(const TraverseEntry& entry){
 
-void Physon::array_entered(){
+        if(entry.depth == 0)
+            return true;
 
-    gobble_ws();
+        // Reached a second time : keep the first parent and do not walk it again.
+        // Only deduplicated documents, which are never mutated, get here after a parse.
+        JsonWrapper& parent = physon.stringify_cache.parent(entry.value);
+        if(entry.value == from || physon.is_container(parent.type())){
+            physon.stringify_cache.set_shared(entry.value);
+            return false;
+        }
 
-    if(is_close_array_char()){
-        state = JSON_PARSE_STATE::ARRAY_CLOSE;
+        parent = entry.parent;
+        return true;
     }
-    else if(is_new_value_char()){
-        state = JSON_PARSE_STATE::VALUE_AT_NEW_VALUE_CHAR;
-    }
-    else {
-        json_error("Error: not a valid character during state JSON_PARSE_STATE::ARRAY_ENTERED. Content index = " + std::to_string(cursor.index));
-    }
-}
 
-void Physon::index_advance(){
-    cursor.index++;
-    gobble_ws();
-}
+    void leave(const TraverseEntry&){}
+    void scalar(const TraverseEntry&){}
+};
 
-void Physon::comma_skip(){
+void Physon::build_string(JsonWrapper value){
+    StringifyVisitor visitor (*this);
+    json_traverse(store, value, visitor, stringify_max_depth);
+}
 
-    if(current_char() != ',')
-        json_error("Unexpected char instead of comma. Index = " + std::to_string(cursor.index));
+void Physon::build_scalar_string(JsonWrapper value){
 
-    index_advance();
+    switch (value.type())
+    {
+    case JSON_TYPE::NULL_:
+        stringify_string.append("null");
+        break;
+    case JSON_TYPE::TRUE:
+        stringify_string.append("true");
+        break;
+    case JSON_TYPE::FALSE:
+        stringify_string.append("false");
+        break;
+    case JSON_TYPE::FLOAT:
+        {
+            json_float float_ = store.get_float(value);
+            std::string float_str = float_to_json_representation(float_);
 
-    if(current_container_is_object())
-        state = JSON_PARSE_STATE::OBJECT_PARSE_KEY_COMMA;
-    else
-        state = JSON_PARSE_STATE::VALUE_AT_NEW_VALUE_CHAR;
+            stringify_string.append( float_str );
+        }
+        break;
+    case JSON_TYPE::INTEGER:
+        stringify_string.append( std::to_string(store.get_integer(value) ) );
+        break;
+    case JSON_TYPE::NUMBER:
+        // Source text of a lazy number is already json, and exact
+        stringify_string.append(store.get_number_text(value));
+        break;
 
+    case JSON_TYPE::STRING:
+        // Source text of a lazy string is already json
+        if(value.is_lazy_string()){
+            stringify_string += QUOTATION_MARK;
+            stringify_string.append(store.get_string_source(value));
+            stringify_string += QUOTATION_MARK;
+            break;
+        }
+        // 1) Grab value from store
+        // 2) convert to json representation
+        // 3) append to stringify-string
+        stringify_string.append(
+            string_to_json_representation(
+                store.get_string(value.store_id())
+            )
+        );
+        break;
+    default:
+        break;
+    }
 }
 
-void Physon::colon_skip(){
-    if(current_char() != ':')
-        json_error("Unexpected char during colon skip. Index = " + std::to_string(cursor.index));
 
-    index_advance();
+void Physon::enable_stringify_cache(){
+    stringify_cache_enabled = true;
+    stringify_cache.clear();
 }
 
-void Physon::value_at_new_value_char(){
-    gobble_ws();
+bool Physon::append_cached_string(JsonWrapper container){
 
-    // if in an object, we only accept string-keys!
-    // if(current_container_is_object() && is_quotation_mark()){
-    //     state = JSON_PARSE_STATE::OBJECT_PARSE_KEY_COMMA;
-    // }
+    stringify_cache.fit(store);
 
-    if(is_new_literal_char())
-        state = JSON_PARSE_STATE::VALUE_PARSE_LITERAL;
-    else if(is_new_array_char())
-        state = JSON_PARSE_STATE::ARRAY_ENTER;
-    else if(is_new_object_char())
-        state = JSON_PARSE_STATE::OBJECT_ENTER;
-    else 
-        json_error("Error: not a valid character during state JSON_PARSE_STATE::VALUE_AT_NEW_VALUE_CHAR. Content index = " + std::to_string(cursor.index));
+    if(container.type() == JSON_TYPE::ARRAY && stringify_cache.array_valid[container.store_id()]){
+        stringify_string.append(stringify_cache.array_strings[container.store_id()]);
+        return true;
+    }
+    if(container.type() == JSON_TYPE::OBJECT && stringify_cache.object_valid[container.store_id()]){
+        stringify_string.append(stringify_cache.object_strings[container.store_id()]);
+        return true;
+    }
 
+    return false;
 }
 
+void Physon::cache_string(JsonWrapper container, size_t start_index){
 
-void Physon::value_end_of_value(){
-    gobble_ws();
+    size_t length = stringify_string.size() - start_index;
+    if(length < PHYSON_STRINGIFY_CACHE_MIN_SIZE)
+        return;
 
-    if (root_no_container()){
-        state = JSON_PARSE_STATE::ROOT_END_OF_VALUE;
-    }
-    else if(current_char() == ','){
-        comma_skip();
-    }
-    else if(is_close_array_char()){
-        state = JSON_PARSE_STATE::ARRAY_CLOSE;
-    }
-    else if(is_close_object_char()){
-        state = JSON_PARSE_STATE::OBJECT_CLOSE;
+    stringify_cache.fit(store);
+
+    if(container.type() == JSON_TYPE::ARRAY){
+        stringify_cache.array_strings[container.store_id()].assign(stringify_string, start_index, length);
+        stringify_cache.array_valid[container.store_id()] = true;
     }
-    else {
-        json_error("Invalid character encountered after end of value.");
+    else if(container.type() == JSON_TYPE::OBJECT){
+        stringify_cache.object_strings[container.store_id()].assign(stringify_string, start_index, length);
+        stringify_cache.object_valid[container.store_id()] = true;
     }
-
 }
 
-void Physon::before_root_value(){
+void Physon::set_parent(JsonWrapper value, JsonWrapper parent){
 
+    if(!is_container(value.type()))
+        return;
 
-    gobble_ws();
-    
-    // Nothing except whitespace
-    if(cursor.index == content.size())
-        json_error("Error: No valid JSON values.");
-    
-
-    // A single literal value in the json content string
-    if(is_new_literal_char()){
-        value_parse_literal();
-        gobble_ws();
+    stringify_cache.fit(store);
 
-        if(cursor.index != content.size())
-            json_error("Invalid JSON: Extra characters after root literal at index " + std::to_string(cursor.index));
-        
+    JsonWrapper& current = stringify_cache.parent(value);
+    if(is_container(current.type()) && !(current == parent)){
+        // Changes of value can no longer reach every ancestor, so drop the cached text of the old ones now
+        // and let stringify() skip caching anything that holds it from here on
+        mark_dirty(value);
+        stringify_cache.set_shared(value);
         return;
     }
 
-    // Root container
-    if(is_new_array_char())
-        state = JSON_PARSE_STATE::ARRAY_ENTER;
-    else if(is_new_object_char())
-        state = JSON_PARSE_STATE::OBJECT_ENTER;
-    else
-        json_error("Invalid JSON: No valid first character of root element.");
-
+    current = parent;
 }
 
-void Physon::end_of_root_value(){
-    gobble_ws();
-
-    if(cursor.index != content.size())
-        json_error("Invalid JSON: Extra characters after root container. Found at index " + std::to_string(cursor.index) + ".");
+void Physon::unset_parent(JsonWrapper container, JsonWrapper removed){
 
-    state = JSON_PARSE_STATE::DONE;
-    return;
-}
+    if(!stringify_cache_enabled || !is_container(removed.type()))
+        return;
 
+    stringify_cache.fit(store);
 
-bool Physon::root_no_container(){
-    return cursor.container_trace.empty();
-}
+    JsonWrapper& current = stringify_cache.parent(removed);
+    if(!(current == container))
+        return;
 
-void Physon::print_tokens() {
-    for (const auto& token : tokens) {
-        std::cout << "Token Type: " << static_cast<int>(token.type) 
-                  << ", Start Index: " << token.str_start_i
-                  << ", Length: " << token.str_length << std::endl;
+    if(container.type() == JSON_TYPE::ARRAY){
+        for(JsonWrapper entry : store.get_array(container.store_id()))
+            if(entry == removed)
+                return;
+    }
+    else {
+        for(JsonWrapper kv_wrapper : store.get_object(container.store_id()))
+            if(store.get_kv(kv_wrapper.store_id()).second == removed)
+                return;
     }
-}
 
-bool Physon::is_literal(JSON_TYPE type){
-    return  type == JSON_TYPE::NULL_ ||
-            type == JSON_TYPE::TRUE ||
-            type == JSON_TYPE::FALSE ||
-            type == JSON_TYPE::NUMBER ||
-            type == JSON_TYPE::FLOAT ||
-            type == JSON_TYPE::INTEGER ||
-            type == JSON_TYPE::STRING;
-}
-bool Physon::is_container(JSON_TYPE type){
-    return  type == JSON_TYPE::ARRAY ||
-            type == JSON_TYPE::OBJECT;
+    current = JsonWrapper();
 }
 
-JsonWrapper Physon::current_container(){
-    JsonWrapper empty_value;
-    return cursor.container_trace.empty() ? empty_value : cursor.container_trace.top();
-}
-bool Physon::current_container_is_array(){
-    return cursor.container_trace.top().type == JSON_TYPE::ARRAY;
-}
-bool Physon::current_container_is_object(){
-    return cursor.container_trace.top().type == JSON_TYPE::OBJECT;
-}
-JSON_TYPE Physon::current_container_type(){
-    return cursor.container_trace.empty() ? JSON_TYPE::NONE : cursor.container_trace.top().type;
+void Physon::record_parents(JsonWrapper from){
+    stringify_cache.fit(store);
+    ParentVisitor visitor (*this, from);
+    json_traverse(store, from, visitor, stringify_max_depth);
 }
 
+void Physon::track_parents(){
 
-void Physon::value_parse_literal(){
-
-    gobble_ws();
+    if(stringify_cache.parents_recorded)
+        return;
 
-    JsonWrapper new_value;
+    stringify_cache.parents_recorded = true;
+    record_parents(root_wrapper);
+}
 
-    char current_char = content[cursor.index];
+void Physon::mark_dirty(JsonWrapper container){
 
+    if(!stringify_cache_enabled)
+        return;
 
-    if     (current_char == 't')
-        new_value = parse_true_literal();
+    track_parents();
+    stringify_cache.fit(store);
 
-    else if(current_char == 'f')
-        new_value = parse_false_literal();
+    // Cached ancestors contain the old text of container, so walk all the way to the root
+    while(is_container(container.type())){
 
-    else if(current_char == 'n')
-        new_value = parse_null_literal();
+        if(container.type() == JSON_TYPE::ARRAY){
+            stringify_cache.array_valid[container.store_id()] = false;
+            std::string().swap(stringify_cache.array_strings[container.store_id()]);
+            container = stringify_cache.array_parents[container.store_id()];
+        }
+        else {
+            stringify_cache.object_valid[container.store_id()] = false;
+            std::string().swap(stringify_cache.object_strings[container.store_id()]);
+            container = stringify_cache.object_parents[container.store_id()];
+        }
+    }
+}
 
-    else if(current_char == '"')
-        new_value = parse_string_literal();
 
-    else if(current_char == '-' || is_digit(current_char) )
-        new_value = parse_number_literal();
-        // json_error("Number parsing not yet implemented.");
 
-    else
-        json_error("Unexpected first literal character.");
-    
+void Physon::check_placement(JsonWrapper container, JsonWrapper value){
 
-    gobble_ws();
+    if(!is_container(value.type()))
+        return;
 
-    // if(current_container_is_object()){
-    //     if(new_value.type != JSON_TYPE::STRING)
-    //         json_error("Parsed a non-string literal as new value inside an object container.");
-        
+    if(value == container)
+        mutation_error("a container can not be placed inside itself.");
 
-    // }
-    add_value_to_current_container(new_value);
+    if(!stringify_cache_enabled)
+        return;
 
-    state = JSON_PARSE_STATE::VALUE_END_OF_VALUE;
+    track_parents();
+    stringify_cache.fit(store);
 
+    for(JsonWrapper ancestor = stringify_cache.parent(container); is_container(ancestor.type()); ancestor = stringify_cache.parent(ancestor))
+        if(ancestor == value)
+            mutation_error("a container can not be placed inside one of its descendants.");
 }
 
+void Physon::set(JsonWrapper object_wrapper, std::string key, JsonWrapper value){
 
-void Physon::array_enter(){
+    check_mutable();
 
-    index_advance();
+    if(object_wrapper.type() != JSON_TYPE::OBJECT)
+        mutation_error("set(key) on a non-object wrapper.");
 
-    JsonWrapper new_array = store.new_array();
+    check_placement(object_wrapper, value);
 
-    add_value_to_current_container(new_array);
+    bool found = false;
+    JsonWrapper replaced;
+    for(JsonWrapper kv_wrapper : store.get_object(object_wrapper.store_id())){
+        json_kv_wrap& kv = store.get_kv(kv_wrapper.store_id());
+        if(kv.first == key){
+            replaced = kv.second;
+            kv.second = value;
+            found = true;
+            break;
+        }
+    }
 
-    cursor.container_trace.push(new_array);
+    if(!found){
+        JsonWrapper kv = store.new_kv(key);
+        store.get_kv(kv.store_id()).second = value;
+        store.get_object(object_wrapper.store_id()).push_back(kv);
+    }
 
-    state = JSON_PARSE_STATE::ARRAY_ENTERED;
+    mark_dirty(object_wrapper);
+    if(stringify_cache_enabled){
+        unset_parent(object_wrapper, replaced);
+        set_parent(value, object_wrapper);
+    }
+}
 
-};
+void Physon::set(JsonWrapper array_wrapper, size_t index, JsonWrapper value){
 
-void Physon::array_close(){
+    check_mutable();
 
-    if(! current_container_is_array())
-        json_error("Error: Tried to close an array when currently not in an array container.");
+    if(array_wrapper.type() != JSON_TYPE::ARRAY)
+        mutation_error("set(index) on a non-array wrapper.");
 
-    index_advance();
+    json_array_wrap& array = store.get_array(array_wrapper.store_id());
+    if(index >= array.size())
+        mutation_error("set(index) out of range. Index = " + std::to_string(index));
 
-    cursor.container_trace.pop();
-    state = JSON_PARSE_STATE::VALUE_END_OF_VALUE;
+    check_placement(array_wrapper, value);
 
-    // Closed root array
-    if(cursor.container_trace.size() == 0)
-        state = JSON_PARSE_STATE::ROOT_END_OF_VALUE;
+    JsonWrapper replaced = array[index];
+    array[index] = value;
 
-};
+    mark_dirty(array_wrapper);
+    if(stringify_cache_enabled){
+        unset_parent(array_wrapper, replaced);
+        set_parent(value, array_wrapper);
+    }
+}
 
+void Physon::insert(JsonWrapper array_wrapper, size_t index, JsonWrapper value){
 
+    check_mutable();
 
-void Physon::object_enter(){
+    if(array_wrapper.type() != JSON_TYPE::ARRAY)
+        mutation_error("insert() on a non-array wrapper.");
 
-    if(! is_new_object_char())
-        json_error("Invalid JSON: Unexpected first char '" + content.substr(cursor.index, 1) + "' in enter object. Occured at index " + std::to_string(cursor.index));
+    json_array_wrap& array = store.get_array(array_wrapper.store_id());
+    if(index > array.size())
+        mutation_error("insert() out of range. Index = " + std::to_string(index));
 
-    // move past start_object token
-    index_advance();
+    check_placement(array_wrapper, value);
 
-    JsonWrapper new_object = store.new_object();
-    add_value_to_current_container(new_object);
+    array.insert(array.begin() + index, value);
 
+    mark_dirty(array_wrapper);
+    if(stringify_cache_enabled)
+        set_parent(value, array_wrapper);
+}
 
-    if(current_char() == '}'){
-        index_advance();
-        state = JSON_PARSE_STATE::VALUE_END_OF_VALUE;
-        return;
-    }
-    else if (current_char() == '"'){
-        cursor.container_trace.push(new_object);
-        state = JSON_PARSE_STATE::OBJECT_PARSE_KEY_COMMA;
-    }
-    else {
-        json_error("Invalid char encountered when entering object.");
-    }
+void Physon::push_back(JsonWrapper array_wrapper, JsonWrapper value){
 
+    if(array_wrapper.type() != JSON_TYPE::ARRAY)
+        mutation_error("push_back() on a non-array wrapper.");
 
-    return;
+    insert(array_wrapper, store.get_array(array_wrapper.store_id()).size(), value);
+}
 
-};
+bool Physon::erase(JsonWrapper object_wrapper, std::string key){
 
-void Physon::object_parse_key_comma(){
+    check_mutable();
 
-    if(content[cursor.index] != '"')
-        json_error("Invalid JSON: Unexpected char '" + content.substr(cursor.index, 1) + "' when entered object. Occured at index " + std::to_string(cursor.index));
-    
+    if(object_wrapper.type() != JSON_TYPE::OBJECT)
+        mutation_error("erase(key) on a non-object wrapper.");
 
-    JsonWrapper key = parse_string_literal();
-    colon_skip();
+    json_object_wrap& object = store.get_object(object_wrapper.store_id());
 
+    for(size_t i = 0; i < object.size(); i++){
+        if(store.get_kv(object[i].store_id()).first == key){
+            JsonWrapper removed = store.get_kv(object[i].store_id()).second;
+            object.erase(object.begin() + i);
+            mark_dirty(object_wrapper);
+            unset_parent(object_wrapper, removed);
+            return true;
+        }
+    }
 
-    JsonWrapper kv = store.new_kv(store.get_string(key.store_id));
+    return false;
+}
 
-    add_value_to_current_container(kv);
+void Physon::erase(JsonWrapper array_wrapper, size_t index){
 
-    
-    state = JSON_PARSE_STATE::VALUE_AT_NEW_VALUE_CHAR;
-}
+    check_mutable();
 
-void Physon::object_close(){
+    if(array_wrapper.type() != JSON_TYPE::ARRAY)
+        mutation_error("erase(index) on a non-array wrapper.");
 
-    if(content[cursor.index] != '}')
-        json_error("Invalid JSON: Unexpected char when trying to close object. Occured at index " + std::to_string(cursor.index));
+    json_array_wrap& array = store.get_array(array_wrapper.store_id());
+    if(index >= array.size())
+        mutation_error("erase(index) out of range. Index = " + std::to_string(index));
 
-    // Skip close curly brace
-    index_advance();
+    JsonWrapper removed = array[index];
+    array.erase(array.begin() + index);
 
-    cursor.container_trace.pop();
-    state = JSON_PARSE_STATE::VALUE_END_OF_VALUE;
+    mark_dirty(array_wrapper);
+    unset_parent(array_wrapper, removed);
+}
 
-    if(cursor.container_trace.size() == 0)
-        state = JSON_PARSE_STATE::ROOT_END_OF_VALUE;
+void Physon::mutation_error(std::string error_msg){
+    throw std::runtime_error("Mutation error: " + error_msg);
+}
 
-};
+void Physon::check_mutable(){
+    if(shared_subtrees)
+        mutation_error("document was deduplicated and its containers are shared. Parse it again to edit it.");
+}
 
-std::string Physon::parse_digits(){
-    std::string digit_string = "";
 
-    while(is_digit(current_char())){
-        digit_string += current_char();
-        cursor.index++;
+void Physon::print_tokens() {
+    for (const auto& token : tokens) {
+        std::cout << "Token Type: " << static_cast<int>(token.type) 
+                  << ", Start Index: " << token.str_start_i
+                  << ", Length: " << token.str_length << std::endl;
     }
+}
 
-    return digit_string;
+bool Physon::is_literal(JSON_TYPE type){
+    return  type == JSON_TYPE::NULL_ ||
+            type == JSON_TYPE::TRUE ||
+            type == JSON_TYPE::FALSE ||
+            type == JSON_TYPE::NUMBER ||
+            type == JSON_TYPE::FLOAT ||
+            type == JSON_TYPE::INTEGER ||
+            type == JSON_TYPE::STRING;
+}
+bool Physon::is_container(JSON_TYPE type){
+    return  type == JSON_TYPE::ARRAY ||
+            type == JSON_TYPE::OBJECT;
 }
 
-bool Physon::integer_within_limits(std::string str){
+bool Physon::is_whitespace(char ch) {
 
-    // TODO: Catch edge cases of integers.  LLONG_MAX < int < e19
+    char space = '\u0020';
+    char tab = '\u0009';
+    char new_line = '\u000A';
+    char c_return = '\u000D';
 
-    if(str[0] == '-')
-        str = str.substr(1, str.size()-1);
+    return ch == space || ch == tab || ch == new_line || ch == c_return;
 
-    if(str.length() > std::to_string(LLONG_MAX).length() )
-        return false;
-    
-    return true;
 }
 
-JsonWrapper Physon::parse_number_literal(){
 
-    enum class NUMBER_STATE {
-        NEGATIVE,
-        LEADING_ZERO,
-        INTEGRAL_DIGITS,
-        FRACTION,
-        FRACTIONAL_DIGITS,
-        EXPONENT_E,
-        EXPONENT_SIGN,
-        EXPONENT_DIGITS,
-        END,
-    } number_state = NUMBER_STATE::NEGATIVE;
+std::string Physon::state_to_string(){
 
-    bool is_fractional = false;
-    
-    std::string string_to_parse = "";
+    switch (state){
 
-    // FIRST CHECKS
-    if(current_char() == '-'){
-        string_to_parse += "-";
-        cursor.index++;
-    }
-    number_state = NUMBER_STATE::LEADING_ZERO;
+    case JSON_PARSE_STATE::ARRAY_CLOSE :
+        return std::string("ARRAY_CLOSE");
+        break;
     
-    if (current_char() == '0'){
-        string_to_parse += "0";
-        cursor.index++;
+    case JSON_PARSE_STATE::ARRAY_ENTER :
+        return std::string("ARRAY_ENTER");
+        break;
+    case JSON_PARSE_STATE::ARRAY_ENTERED :
+        return std::string("ARRAY_ENTERED");
+        break;
 
-        if(is_digit(current_char()))
-            json_error("Additional leading zeros.");
+    case JSON_PARSE_STATE::DONE :
+        return std::string("DONE");
+        break;
+    case JSON_PARSE_STATE::ERROR :
+        return std::string("ERROR");
+        break;
 
-    }
-    else if (is_non_zero_digit(current_char())) {
-        string_to_parse += parse_digits();
-    }
-    else {
-        json_error("First digit in number not valid. ");
-    }
-    number_state = NUMBER_STATE::FRACTION;
+    case JSON_PARSE_STATE::ROOT_BEFORE_VALUE :
+        return std::string("ROOT_BEFORE_VALUE");
+        break;
+    case JSON_PARSE_STATE::ROOT_END_OF_VALUE :
+        return std::string("ROOT_END_OF_VALUE");
+        break;
 
-    if(current_char() == '.'){
-        is_fractional = true;
-        string_to_parse += ".";
-        cursor.index++;
+    case JSON_PARSE_STATE::OBJECT_ENTER :
+        return std::string("OBJECT_ENTER");
+        break;
+    case JSON_PARSE_STATE::OBJECT_PARSE_KEY_COMMA :
+        return std::string("OBJECT_PARSE_KEY_COMMA");
+        break;
+    case JSON_PARSE_STATE::OBJECT_CLOSE :
+        return std::string("OBJECT_CLOSE");
+        break;
 
-        if(! is_digit(current_char()))
-            json_error("Fraction delimiter must be followed by digit.");
+    case JSON_PARSE_STATE::VALUE_AT_NEW_VALUE_CHAR :
+        return std::string("VALUE_AT_NEW_VALUE_CHAR");
+        break;
+    case JSON_PARSE_STATE::VALUE_PARSE_LITERAL :
+        return std::string("VALUE_PARSE_LITERAL");
+        break;
+    case JSON_PARSE_STATE::VALUE_END_OF_VALUE :
+        return std::string("VALUE_END_OF_VALUE");
+        break;
+    
 
-        string_to_parse += parse_digits();
+    default:
+        return std::string("NO_STRING_REPRESENTATION_FOR_STATE");
+        break;
     }
-    number_state = NUMBER_STATE::EXPONENT_E;
 
-    if(current_char() == 'e' || current_char() == 'E'){
+}
 
-        string_to_parse += current_char();
-        cursor.index++;
-        number_state = NUMBER_STATE::EXPONENT_SIGN;
+void Physon::json_error(std::string error_msg){
 
-        bool e_trail_ok = is_digit(current_char()) || current_char() == '+' || current_char() == '-';
-        if(! e_trail_ok)
-            json_error("Exponent char not trailed by sign nor digit.");
-        
-        if(current_char() == '+' || current_char() == '-'){
-            string_to_parse += current_char();
-            cursor.index++;
-        }
-        number_state = NUMBER_STATE::EXPONENT_DIGITS;
 
-        if(! is_digit(current_char()))
-            json_error("No exponent digits detected during number parsing.");
+    std::string state_string = " ... State: " + state_to_string() + ". ";
 
-        string_to_parse += parse_digits();
-    }
+    std::string index_msg = "Content index : " + std::to_string(cursor.index) + ", Char: '" + content.substr(cursor.index, 1) + "'.";
+
+    std::string full_error_msg = error_msg + state_string + index_msg;
+
+
+    state = JSON_PARSE_STATE::ERROR;
+    throw std::runtime_error(full_error_msg);
+
+}
+
+void Physon::json_error_at(const char* c, std::string error_msg){
+    cursor.index = c - content.data();
+    json_error(error_msg);
+}
+
+void Physon::budget_error(const char* c, PHYSON_BUDGET code, std::string error_msg){
+    cursor.index = c - content.data();
+    state = JSON_PARSE_STATE::ERROR;
+    throw PhysonBudgetError(code, cursor.index, "Budget exceeded: " + error_msg + " Content index : " + std::to_string(cursor.index) + ".");
+}
+
+template<typename Policy>
+void Physon::parse() {
+
+    cursor.index = 0;
+    cursor.container_trace.clear();
+    cursor.entry_stack.clear();
+    cursor.entry_starts.clear();
+    store.clear();
+    tokens.clear();
+    stringify_cache.clear();
+    shared_subtrees = false;
+    budget_charged = false;
+    array_spans.clear();
+    object_spans.clear();
+    state = JSON_PARSE_STATE::ROOT_BEFORE_VALUE;
+
+    if constexpr (Policy::validate_utf8){
+        if(!utf8_validate(content.data(), content.size()))
+            json_error("Error: content is not valid UTF-8.");
+    }
+
+    const char* begin = content.data();
+    const char* end = begin + content.size();   // *end is the terminating '\0'
+    const char* c = begin;
+
+    // Lazy numbers and strings reference their text by span, so the store gets its own copy of content in one go
+    if constexpr (!Policy::decode_numbers || !Policy::decode_strings)
+        store.source_text.assign(content);
+
+    std::vector<JsonWrapper>& nesting = cursor.container_trace;
+    std::vector<JsonWrapper>& entry_stack = cursor.entry_stack;
+    std::vector<size_t>& entry_starts = cursor.entry_starts;
+    // kv waiting for its value. Always the last kv of the innermost object.
+    int pending_kv = 0;
+    std::string key;
+    JsonWrapper value;
+    // Only used with Policy::reject_duplicate_keys
+    std::vector<std::string_view> duplicate_scratch;
+
+    // Only used with Policy::enforce_budget. A limit of 0 becomes the largest size, so each check is one compare.
+    auto budget_limit = [](size_t max){ return max == 0 ? SIZE_MAX : max; };
+    const size_t max_depth = budget_limit(budget.max_depth);
+    const size_t max_string_bytes = budget_limit(budget.max_string_bytes);
+    const size_t max_values = budget_limit(budget.max_values);
+    const size_t max_store_bytes = budget_limit(budget.max_store_bytes);
+    size_t value_count = 0;
+    size_t store_bytes = store.source_text.size();
+    // Counts a new value of bytes store entries, plus its slot in the parent container
+    auto charge_value = [&](const char* at, size_t bytes){
+        if(++value_count > max_values)
+            budget_error(at, PHYSON_BUDGET::VALUES, "more than " + std::to_string(max_values) + " values.");
+        store_bytes += bytes + sizeof(JsonWrapper);
+        if(store_bytes > max_store_bytes)
+            budget_error(at, PHYSON_BUDGET::STORE_BYTES, "store larger than " + std::to_string(max_store_bytes) + " bytes.");
+    };
+    auto charge_string = [&](const char* at, size_t length){
+        if(length > max_string_bytes)
+            budget_error(at, PHYSON_BUDGET::STRING_BYTES, "string longer than " + std::to_string(max_string_bytes) + " bytes.");
+    };
+    // Scans the string literal at c without copying, so an oversized string is rejected before it is decoded
+    auto check_string_budget = [&](const char* at){
+        const char* text_start = at + 1;
+        scan_string_literal<false>(at, nullptr);
+        charge_string(text_start, at - 1 - text_start);
+    };
 
-    number_state = NUMBER_STATE::END;
+    // Each dispatch point switches on the char class table on its own, so every site gets its own jump table
+    // and branch history, like a computed goto, without leaving standard C++.
 
-    JsonWrapper wrapper;
-    if(is_fractional){
-        json_float float_ = std::stod(string_to_parse);
-        wrapper = store.new_float(float_);
+parse_value:
+    skip_whitespace<Policy>(c);
+
+    switch (char_class_table.of(*c)){
+
+    case CHAR_CLASS::STRING:
+        if constexpr (Policy::decode_strings){
+            // Decoded in place into the new store string
+            const char* text_start = c + 1;
+            if constexpr (Policy::enforce_budget)
+                check_string_budget(c);
+            parse_string_literal(c, store.strings.emplace_back());
+            value = JsonWrapper(store.strings.size() - 1, JSON_TYPE::STRING);
+            if constexpr (Policy::enforce_budget)
+                charge_value(text_start, sizeof(std::string) + store.strings.back().size());
+        }
+        else {
+            // Checked but not copied. The span indexes the copy of content in store.source_text.
+            const char* text_start = c + 1;
+            bool has_escapes = scan_string_literal<false>(c, nullptr);
+            value = store.add_lazy_string(text_start - begin, c - 1 - text_start, has_escapes);
+            if constexpr (Policy::enforce_budget){
+                charge_string(text_start, c - 1 - text_start);
+                charge_value(text_start, sizeof(json_lazy_string));
+            }
+        }
+        goto add_value;
+
+    case CHAR_CLASS::NUMBER:
+        if constexpr (Policy::decode_numbers){
+            value = parse_number_literal(c);
+            if constexpr (Policy::enforce_budget)
+                charge_value(c, value.is_inline() ? 0 : sizeof(json_int));
+        }
+        else {
+            // Checked but not converted
+            const char* number_start = c;
+            bool is_fractional = scan_number_literal(c);
+            if((size_t)(c - number_start) > PHYSON_LAZY_NUMBER_MAX_LENGTH)
+                json_error_at(number_start, "Number text too long for a lazy number.");
+            value = store.add_number(number_start - begin, c - number_start, !is_fractional);
+            if constexpr (Policy::enforce_budget)
+                charge_value(c, sizeof(json_lazy_number));
+        }
+        goto add_value;
+
+    // Literal names are a single 4-byte compare of the chars following the first one
+    case CHAR_CLASS::TRUE_:
+        if(end - c < 4 || std::memcmp(c, "true", 4) != 0)
+            json_error_at(c, "Invalid true-literal at index " + std::to_string(c - begin));
+        tokens.emplace_back(token_type::TRUE, c - begin, 4);
+        c += 4;
+        value = JsonWrapper(JSON_TYPE::TRUE);
+        if constexpr (Policy::enforce_budget)
+            charge_value(c, 0);
+        goto add_value;
+    case CHAR_CLASS::FALSE_:
+        if(end - c < 5 || std::memcmp(c + 1, "alse", 4) != 0)
+            json_error_at(c, "Invalid false-literal at index " + std::to_string(c - begin));
+        tokens.emplace_back(token_type::FALSE, c - begin, 5);
+        c += 5;
+        value = JsonWrapper(JSON_TYPE::FALSE);
+        if constexpr (Policy::enforce_budget)
+            charge_value(c, 0);
+        goto add_value;
+    case CHAR_CLASS::NULL_:
+        if(end - c < 4 || std::memcmp(c, "null", 4) != 0)
+            json_error_at(c, "Invalid null-literal at index " + std::to_string(c - begin));
+        tokens.emplace_back(token_type::NULL_, c - begin, 4);
+        c += 4;
+        value = JsonWrapper(JSON_TYPE::NULL_);
+        if constexpr (Policy::enforce_budget)
+            charge_value(c, 0);
+        goto add_value;
+
+    case CHAR_CLASS::ARRAY_OPEN:
+        value = store.new_array();
+        array_spans.push_back({ (size_t)(c - begin), 0 });
+        goto add_container;
+    case CHAR_CLASS::OBJECT_OPEN:
+        value = store.new_object();
+        object_spans.push_back({ (size_t)(c - begin), 0 });
+        goto add_container;
+
+    default:
+        if(c == end)
+            json_error_at(c, nesting.empty() ? "Error: No valid JSON values." : "Error: Unexpected end of content, expected a value.");
+        json_error_at(c, "Error: not a valid first character of a value.");
+    }
+
+
+add_container:
+    if constexpr (Policy::enforce_budget){
+        if(nesting.size() >= max_depth)
+            budget_error(c, PHYSON_BUDGET::DEPTH, "nesting deeper than " + std::to_string(max_depth) + ".");
+        charge_value(c, sizeof(json_array_wrap) + sizeof(SourceSpan));
+    }
+
+    // Containers are attached to their parent on entry, so only the innermost pending kv is ever needed
+    if(nesting.empty())
+        root_wrapper = value;
+    else if(nesting.back().type() == JSON_TYPE::ARRAY)
+        entry_stack.push_back(value);
+    else
+        store.get_kv(pending_kv).second = value;
+
+    nesting.push_back(value);
+    entry_starts.push_back(entry_stack.size());
+    c++;
+
+    skip_whitespace<Policy>(c);
+
+    if(value.type() == JSON_TYPE::ARRAY){
+        if(*c != ']')
+            goto parse_value;
     }
     else {
+        if(*c != '}')
+            goto parse_key;
+    }
+    // Empty container : close it right away
+    goto end_of_value;
 
-        if(! integer_within_limits(string_to_parse))
-            json_error("Integer too large for internal representation.");
 
-        json_int int_ = std::stol(string_to_parse);
-        wrapper = store.new_integer(int_);
+add_value:
+    if(nesting.empty())
+        root_wrapper = value;
+    else if(nesting.back().type() == JSON_TYPE::ARRAY)
+        entry_stack.push_back(value);
+    else
+        store.get_kv(pending_kv).second = value;
+
+
+end_of_value:
+    state = JSON_PARSE_STATE::VALUE_END_OF_VALUE;
+
+    skip_whitespace<Policy>(c);
+
+    if(nesting.empty())
+        goto end_of_root;
+
+    switch (char_class_table.of(*c)){
+
+    case CHAR_CLASS::COMMA:
+        c++;
+        if constexpr (Policy::allow_trailing_commas){
+            skip_whitespace<Policy>(c);
+            if(*c == ']' || *c == '}')
+                goto end_of_value;
+        }
+        if(nesting.back().type() == JSON_TYPE::OBJECT)
+            goto parse_key;
+        goto parse_value;
+
+    case CHAR_CLASS::ARRAY_CLOSE:
+        if(nesting.back().type() != JSON_TYPE::ARRAY)
+            json_error_at(c, "Error: Tried to close an array when currently not in an array container.");
+        array_spans[nesting.back().store_id()].end = c - begin;
+        goto close_container;
+
+    case CHAR_CLASS::OBJECT_CLOSE:
+        if(nesting.back().type() != JSON_TYPE::OBJECT)
+            json_error_at(c, "Invalid JSON: Unexpected char when trying to close object. Occured at index " + std::to_string(c - begin));
+        object_spans[nesting.back().store_id()].end = c - begin;
+        goto close_container;
+
+    default:
+        json_error_at(c, "Invalid character encountered after end of value.");
     }
 
-    return wrapper;
 
-    // else if (is_digit(current_char())){
-    //     number_state = NUMBER_STATE::INTEGRAL_DIGITS;
-    // }
-    // else {
-        
-    // }
+close_container:
+    {
+        // Arrays and objects share the entry vector type
+        json_array_wrap& entries = nesting.back().type() == JSON_TYPE::ARRAY
+                                    ? store.get_array(nesting.back().store_id())
+                                    : store.get_object(nesting.back().store_id());
+        if constexpr (Policy::reject_duplicate_keys){
+            if(nesting.back().type() == JSON_TYPE::OBJECT)
+                check_duplicate_keys(entry_stack.data() + entry_starts.back(), entry_stack.data() + entry_stack.size(), duplicate_scratch, c);
+        }
+        entries.assign(entry_stack.begin() + entry_starts.back(), entry_stack.end());
+        entry_stack.resize(entry_starts.back());
 
-    // while (!end_of_number)
-    // {
-        
-    //     switch (number_state){
-        
-    //     case NUMBER_STATE::LEADING_ZERO:
-    //         {
-    //             if(current_char() == '0'){
-    //                 is_leading_zero = true;
-    //                 string_to_parse += "0";
-    //                 cursor.index++;
-    //                 number_state = NUMBER_STATE::FRACTION;
-    //             }
-    //             else if ( is_digit(current_char()) ){
-    //                 number_state = NUMBER_STATE::INTEGRAL_DIGITS;
-    //             }
-    //             else {
-    //                 json_error("Invalid char when checking for leading zero in number literal.");
-    //             }
-    //         }
-    //         break;
-        
-    //     case NUMBER_STATE::INTEGRAL_DIGITS:
-    //         {
-    //             if(is_digit(current_char())){
-    //                 string_to_parse += current_char();
-    //                 cursor.index++;
-    //             }
-    //             else {
-    //                 number_state = NUMBER_STATE::FRACTION;
-    //             }
-
-    //         }
-    //         break;
-
-    //     case NUMBER_STATE::FRACTION:
-    //         {
-    //             if(current_char() == '.'){
-    //                 is_fractional = true;
-    //                 string_to_parse += '.';
-    //                 cursor.index++;
-    //                 number_state = NUMBER_STATE::FRACTIONAL_DIGITS;
-    //             }
-    //             else if (current_char() == 'e' || current_char() == 'E') {
-    //                 number_state = NUMBER_STATE::EXPONENT_E;
-    //             }
-    //             else {
-    //                 number_state = NUMBER_STATE::END;
-    //             }
-                
-    //         }
-    //         break;
-
-    //     case NUMBER_STATE::FRACTIONAL_DIGITS:
-    //         {
-    //             if(is_digit(current_char())){
-    //                 string_to_parse += current_char();
-    //                 cursor.index++;
-    //             }
-    //             else {
-    //                 number_state = NUMBER_STATE::EXPONENT_E;
-    //             }
-                
-    //         }
-    //         break;
-
-    //     case NUMBER_STATE::EXPONENT_E:
-    //         {
-    //             enum class EXPONENT_STATE {
-    //                 E,
-    //                 SIGN,
-    //                 DIGITS,
-    //                 DONE,
-    //             };
-
-    //             EXPONENT_STATE exponent_state = EXPONENT_STATE::E;
-
-    //             while(exponent_state != EXPONENT_STATE::DONE){
-
-    //                 switch (exponent_state){
-
-    //                 case EXPONENT_STATE::E :
-    //                     {
-    //                         if(current_char() == 'e' || current_char() == 'E'){
-    //                             string_to_parse += current_char();
-    //                             cursor.index++;
-    //                             exponent_state = EXPONENT_STATE::SIGN;
-    //                         }
-    //                         else {
-    //                             json_error("Failed to identify 'e'/'E' character while in exponent state during number parse. ");
-    //                         }
-    //                     }
-    //                     break;
-
-    //                 case EXPONENT_STATE::SIGN :
-    //                     {
-    //                         if(current_char() == '+' || current_char() == '-'){
-    //                             string_to_parse += current_char();
-    //                             cursor.index++;
-    //                         }
-    //                         exponent_state = EXPONENT_STATE::DIGITS;
-
-    //                     }
-    //                     break;
-
-    //                 case EXPONENT_STATE::DIGITS :
-    //                     {
-    //                         if( is_digit(current_char()) ){
-    //                             string_to_parse += current_char();
-    //                             cursor.index++;
-    //                         }
-    //                         else {
-    //                             exponent_state = EXPONENT_STATE::DONE;
-    //                         }
-                            
-    //                     }
-    //                     break;
-                    
-    //                 default:
-    //                     break;
-    //                 }
-                    
-    //             }
-                
-    //             number_state = NUMBER_STATE::END;
-    //         }
-    //         break;
-        
-    //     default:
-    //         break;
-    //     }
-    // }
+        entry_starts.pop_back();
+        nesting.pop_back();
+        c++;
+    }
+    goto end_of_value;
 
-    
-    
-    // type = JSON_TYPE::FLOAT;
-    // if(type == JSON_TYPE::FLOAT){
-    //     const char* str_cnst = string_to_parse.c_str();
-    //     char * c_str = (char*)str_cnst;
-    //     char * c_str_end = c_str;
-    //     char ** str_end = &c_str_end;
-    //     json_float fl = strtod(str_cnst, str_end);
-    //     std::cout << fl << std::endl;
-        
-    // }
-    // else if (type == JSON_TYPE::INTEGER){
-    //     // json_int integer = std::to_integer(string_to_parse);
-    // }
-    // else {
-    //     json_error("Failed to determine number type during parsing of literal.");
-    // }
-
-    // return store.new_integer(1);
+
+parse_key:
+    state = JSON_PARSE_STATE::OBJECT_PARSE_KEY_COMMA;
+
+    skip_whitespace<Policy>(c);
+
+    if(*c != '"')
+        json_error_at(c, "Invalid JSON: Unexpected char '" + std::string(1, *c) + "' when expecting an object key. Occured at index " + std::to_string(c - begin));
+
+    // Keys go straight into the kv, never through the string store
+    key.clear();
+    {
+        if constexpr (Policy::enforce_budget)
+            check_string_budget(c);
+        parse_string_literal(c, key);
+        if constexpr (Policy::enforce_budget)
+            store_bytes += sizeof(json_kv_wrap) + sizeof(JsonWrapper) + key.size();
+    }
+
+    skip_whitespace<Policy>(c);
+    if(*c != ':')
+        json_error_at(c, "Unexpected char during colon skip. Index = " + std::to_string(c - begin));
+    c++;
+
+    {
+        JsonWrapper kv = store.new_kv(key);
+        entry_stack.push_back(kv);
+        pending_kv = kv.store_id();
+    }
+
+    state = JSON_PARSE_STATE::VALUE_AT_NEW_VALUE_CHAR;
+    goto parse_value;
+
+
+end_of_root:
+    state = JSON_PARSE_STATE::ROOT_END_OF_VALUE;
+
+    if(c != end)
+        json_error_at(c, "Invalid JSON: Extra characters after root value. Found at index " + std::to_string(c - begin) + ".");
+
+    if constexpr (Policy::enforce_budget){
+        budget_charged = true;
+        budget_values = value_count;
+        budget_store_bytes = store_bytes;
+    }
+
+    cursor.index = c - begin;
+    state = JSON_PARSE_STATE::DONE;
 }
 
-JsonWrapper Physon::parse_string_literal(){
+template<typename Policy>
+void Physon::skip_whitespace(const char*& c){
+    while(true){
+        while(char_class_table.of(*c) == CHAR_CLASS::WHITESPACE)
+            c++;
+
+        if constexpr (Policy::allow_comments){
+            if(*c == '/'){
+                skip_comment(c);
+                continue;
+            }
+        }
+        return;
+    }
+}
+
+void Physon::skip_comment(const char*& c){
+
+    const char* end = content.data() + content.size();
+
+    if(c[1] == '/'){
+        while(c != end && *c != '\n')
+            c++;
+        return;
+    }
+    if(c[1] != '*')
+        json_error_at(c, "Error: '/' does not start a comment.");
+
+    const char* start = c;
+    c += 2;
+    while(!(c[0] == '*' && c[1] == '/')){
+        if(c == end)
+            json_error_at(start, "Error: Unclosed block comment.");
+        c++;
+    }
+    c += 2;
+}
+
+void Physon::check_duplicate_keys(const JsonWrapper* first, const JsonWrapper* last, std::vector<std::string_view>& keys, const char* c){
+
+    keys.clear();
+    for(const JsonWrapper* kv = first; kv != last; kv++)
+        keys.emplace_back(store.get_kv(kv->store_id()).first);
+
+    std::sort(keys.begin(), keys.end());
+    auto duplicate = std::adjacent_find(keys.begin(), keys.end());
+    if(duplicate != keys.end())
+        json_error_at(c, "Error: Duplicate key \"" + std::string(*duplicate) + "\" in object.");
+}
+
+void Physon::parse_string_literal(const char*& c, std::string& out){
+    scan_string_literal<true>(c, &out);
+}
+
+template<bool Decode>
+bool Physon::scan_string_literal(const char*& c, std::string* out){
+
+    const char* end = content.data() + content.size();
+
+    bool has_escapes = false;
 
     // Skip quotation mark, but no gobbling in string literal
-    cursor.index++;
+    c++;
 
-    std::string new_string = "";
+    while(true){
 
-    while(content[cursor.index] != QUOTATION_MARK ){
+        // Copy the run of plain chars in one go
+        const char* run = c;
+        while(!char_class_table.string_stop[(unsigned char)*c])
+            c++;
+        if constexpr (Decode)
+            out->append(run, c - run);
 
-        // Current char
-        char ch = content[cursor.index];
-        
-        if( ch >= '\u0000' && ch < '\u0020'){
-            json_error("Error: unescaped control character in string. Found at index " + std::to_string(content[cursor.index]) );
+        if(*c == QUOTATION_MARK)
+            break;
+
+        if(*c != SOLLIDUS_BACKWARDS){
+            if(c == end)
+                json_error_at(c, "Error: Unclosed string literal. Expected closing quotation mark before end of content string.");
+            json_error_at(c, "Error: unescaped control character in string. Found at index " + std::to_string(c - content.data()));
         }
-        else if(ch == SOLLIDUS_BACKWARDS){
 
-            // skip backwards sollidus
-            cursor.index++;
-            ch = content[cursor.index];
+        // skip backwards sollidus
+        c++;
+        has_escapes = true;
+
+        switch (*c)
+        {
+
+        case QUOTATION_MARK:
+            if constexpr (Decode) *out += QUOTATION_MARK;
+            break;
+        case SOLLIDUS:
+            if constexpr (Decode) *out += SOLLIDUS;
+            break;
+        case SOLLIDUS_BACKWARDS:
+            if constexpr (Decode) *out += SOLLIDUS_BACKWARDS;
+            break;
 
-            switch (ch)
+        case 'b':
+            if constexpr (Decode) *out += '\u0008';
+            break;
+        case 'f':
+            if constexpr (Decode) *out += '\u000C';
+            break;
+        case 'n':
+            if constexpr (Decode) *out += '\u000A';
+            break;
+        case 'r':
+            if constexpr (Decode) *out += '\u000D';
+            break;
+        case 't':
+            if constexpr (Decode) *out += '\u0009';
+            break;
+
+        case 'u':
+            // Parse unicode : '\uXXXX', with surrogate pairs as '\uD83D\uDE00'
             {
+                if(end - c <= 4)
+                    json_error_at(c, "Error: Unicode escape runs past end of content.");
+
+                int code_unit = hex4_value(c + 1);
+                if(code_unit < 0)
+                    json_error_at(c, "Error: Invalid hex digits in unicode escape.");
+
+                uint32_t code_point = code_unit;
+
+                if(is_high_surrogate(code_unit)){
+                    bool has_low_escape = end - c > 10 && c[5] == SOLLIDUS_BACKWARDS && c[6] == 'u';
+                    int low_unit = has_low_escape ? hex4_value(c + 7) : -1;
+
+                    if(low_unit < 0 || !is_low_surrogate(low_unit))
+                        json_error_at(c, "Error: High surrogate in unicode escape not followed by a low surrogate.");
+
+                    code_point = 0x10000 + ((code_unit - 0xD800) << 10) + (low_unit - 0xDC00);
+
+                    // move past first escape
+                    c += 6;
+                }
+                else if(is_low_surrogate(code_unit)){
+                    json_error_at(c, "Error: Unpaired low surrogate in unicode escape.");
+                }
+
+                if constexpr (Decode)
+                    append_utf8(*out, code_point);
+            }
+            // move to last unicode digit
+            c += 4;
+            break;
+
+        default:
+            if(c == end)
+                json_error_at(c, "Error: Unclosed string literal. Expected closing quotation mark before end of content string.");
+            json_error_at(c, "Error: Invalid escape character in string.");
+            break;
+        }
+
+        // Char after escape
+        c++;
+    }
+
+    // Move past closing quotation mark
+    c++;
+
+    return has_escapes;
+}
+
+JsonWrapper Physon::parse_number_literal(const char*& c){
+
+    const char* start = c;
+    bool negative = *c == '-';
+
+    if(scan_number_literal(c)){
+        json_float float_;
+        std::from_chars_result result = std::from_chars(start, c, float_);
+        if(result.ec != std::errc())
+            json_error_at(start, "Float out of range for internal representation.");
+        return store.new_float(float_);
+    }
+
+    // Integer text is the sign and the digits only
+    const char* digits_start = negative ? start + 1 : start;
+    const char* digits_end = c;
+
+    // At most 19 digits fit an unsigned 64 bit accumulator without overflow
+    if(digits_end - digits_start > 19)
+        json_error_at(start, "Integer too large for internal representation.");
+
+    uint64_t magnitude = 0;
+    for(const char* digit = digits_start; digit < digits_end; digit++)
+        magnitude = magnitude * 10 + (*digit - '0');
 
+    uint64_t limit = negative ? (uint64_t)LLONG_MAX + 1 : (uint64_t)LLONG_MAX;
+    if(magnitude > limit)
+        json_error_at(start, "Integer too large for internal representation.");
+
+    return store.new_integer(negative ? (json_int)(0 - magnitude) : (json_int)magnitude);
+}
+
+bool Physon::scan_number_literal(const char*& c){
+
+    if(*c == '-')
+        c++;
+
+    if(*c == '0'){
+        c++;
+        if(is_digit(*c))
+            json_error_at(c, "Additional leading zeros.");
+    }
+    else if(is_non_zero_digit(*c)){
+        while(is_digit(*c))
+            c++;
+    }
+    else {
+        json_error_at(c, "First digit in number not valid. ");
+    }
+
+    bool is_fractional = false;
+
+    if(*c == '.'){
+        is_fractional = true;
+        c++;
+        if(!is_digit(*c))
+            json_error_at(c, "Fraction delimiter must be followed by digit.");
+        while(is_digit(*c))
+            c++;
+    }
+
+    if(*c == 'e' || *c == 'E'){
+        is_fractional = true;
+        c++;
+        if(*c == '+' || *c == '-')
+            c++;
+        if(!is_digit(*c))
+            json_error_at(c, "No exponent digits detected during number parsing.");
+        while(is_digit(*c))
+            c++;
+    }
+
+    return is_fractional;
+}
+
+
+bool Physon::validate_string(const char*& c, const char* end){
+
+    // Skip opening quotation mark
+    c++;
+
+    // UTF-8 of raw bytes is checked once for the whole content in validate()
+    while(c < end){
+
+        unsigned char ch = *c;
+
+        if(ch == QUOTATION_MARK){
+            c++;
+            return true;
+        }
+        else if(ch < 0x20){
+            return false;
+        }
+        else if(ch == SOLLIDUS_BACKWARDS){
+            c++;
+            if(c >= end)
+                return false;
+
+            switch (*c)
+            {
             case QUOTATION_MARK:
-                new_string += QUOTATION_MARK;
-                break;
             case SOLLIDUS:
-                new_string += SOLLIDUS;
-                break;
             case SOLLIDUS_BACKWARDS:
-                new_string += SOLLIDUS_BACKWARDS;
-                break;
-            
             case 'b':
-                new_string += '\u0008';
-                break;
             case 'f':
-                new_string += '\u000C';
-                break;
             case 'n':
-                new_string += '\u000A';
-                break;
             case 'r':
-                new_string += '\u000D';
-                break;
             case 't':
-                new_string += '\u0009';
+                c++;
                 break;
 
             case 'u':
-                // Parse unicode : '\uXXXX'
-                // Currently only supports ASCII
                 {
-                    std::string unicode_digits = content.substr(cursor.index+1, 4);
-
-                    unsigned int unicode_value_decimal;
-                    std::stringstream _stringstream;
-                    _stringstream << std::hex << unicode_digits;
-                    _stringstream >> unicode_value_decimal;
-
-                    // log(unicode_digits);
-                    // log(unicode_value_decimal);
-
-                    // ASCII
-                    if(unicode_value_decimal < 0x7F){
-                        new_string += static_cast<char>(unicode_value_decimal);
-                    }
-                    else {
-                        json_error("ERROR: non-ASCII unicode values in string are not yet supported.");
+                    c++;
+                    if(end - c < 4)
+                        return false;
+
+                    int code_unit = hex4_value(c);
+                    if(code_unit < 0 || is_low_surrogate(code_unit))
+                        return false;
+                    c += 4;
+
+                    // Same pairing rule as parse_string_literal()
+                    if(is_high_surrogate(code_unit)){
+                        if(end - c < 6 || c[0] != SOLLIDUS_BACKWARDS || c[1] != 'u')
+                            return false;
+                        int low_unit = hex4_value(c + 2);
+                        if(low_unit < 0 || !is_low_surrogate(low_unit))
+                            return false;
+                        c += 6;
                     }
                 }
-                // move to last unicode digit
-                cursor.index += 4;
                 break;
-            
+
             default:
-                break;
+                return false;
             }
-
         }
         else {
-            new_string += content[cursor.index];
+            c++;
         }
-    
+    }
+
+    // Unclosed string
+    return false;
+}
+
+bool Physon::validate_number(const char*& c, const char* end){
+
+    if(c < end && *c == '-')
+        c++;
 
-        // Next char
-        cursor.index++;
+    if(c >= end)
+        return false;
 
-        if(cursor.index >= content.size())
-            json_error("Error: Unclosed string literal. Expected closing quotation mark before end of content string.");
+    if(*c == '0'){
+        c++;
+        // Additional leading zeros
+        if(c < end && is_digit(*c))
+            return false;
+    }
+    else if(is_non_zero_digit(*c)){
+        while(c < end && is_digit(*c))
+            c++;
+    }
+    else {
+        return false;
     }
 
-    // Move past closing quotation mark
-    index_advance();
+    if(c < end && *c == '.'){
+        c++;
+        if(c >= end || !is_digit(*c))
+            return false;
+        while(c < end && is_digit(*c))
+            c++;
+    }
 
-    // Add string to store
-    JsonWrapper new_value;
-    new_value.type = JSON_TYPE::STRING;
-    new_value.store_id = store.add_string(new_string);
+    if(c < end && (*c == 'e' || *c == 'E')){
+        c++;
+        if(c < end && (*c == '+' || *c == '-'))
+            c++;
+        if(c >= end || !is_digit(*c))
+            return false;
+        while(c < end && is_digit(*c))
+            c++;
+    }
 
+    return true;
+}
 
-    return new_value;
-};
+bool Physon::validate(){
 
-JsonWrapper Physon::parse_true_literal(){
+    /** Same grammar as the parse state machine, collapsed to the states that matter for well-formedness. */
+    enum class VALIDATE_STATE {
+        VALUE,              /** Expecting any value */
+        VALUE_OR_CLOSE,     /** Entered array : value or ']' */
+        KEY_OR_CLOSE,       /** Entered object : key or '}' */
+        KEY,                /** After comma in object */
+        END_OF_VALUE,       /** Expecting comma, closing char or end of content */
+    } validate_state = VALIDATE_STATE::VALUE;
 
-    bool is_true_literal = (content[cursor.index + 1] == 'r' && content[cursor.index + 2] == 'u' && content[cursor.index + 3] == 'e');
-    if(!is_true_literal)
-        json_error("Invalid true-literal at index " + std::to_string(cursor.index));
-    
-    std::cout << "true at "  << cursor.index << std::endl;
+    // '[' or '{' per nesting level
+    char container_stack[PHYSON_VALIDATE_MAX_DEPTH];
+    int depth = 0;
 
-    tokens.emplace_back(token_type::TRUE, cursor.index, 4);
-    cursor.index += 4;
+    const char* c = content.data();
+    const char* end = c + content.size();
 
-    JsonWrapper new_value;
-    new_value.type = JSON_TYPE::TRUE;
-    new_value.store_id = 0;
+    if(!utf8_validate(c, content.size()))
+        return false;
 
-    return new_value;
-};
+    while(true){
 
-JsonWrapper Physon::parse_false_literal(){
+        while(c < end && is_whitespace(*c))
+            c++;
 
-    bool is_false_literal = (content[cursor.index + 1] == 'a' && content[cursor.index + 2] == 'l' && content[cursor.index + 3] == 's' && content[cursor.index + 4] == 'e');
-    if(!is_false_literal)
-        json_error("Invalid false-literal at index " + std::to_string(cursor.index));
-    
-    std::cout << "false at "  << cursor.index << std::endl;
+        if(c == end)
+            return depth == 0 && validate_state == VALIDATE_STATE::END_OF_VALUE;
 
-    tokens.emplace_back(token_type::FALSE, cursor.index, 5);
-    cursor.index += 5;
+        switch (validate_state){
 
-    JsonWrapper new_value;
-    new_value.type = JSON_TYPE::FALSE;
-    new_value.store_id = 0;
-    return new_value;
-};
+        case VALIDATE_STATE::KEY_OR_CLOSE:
+            if(*c == '}'){
+                depth--;
+                c++;
+                validate_state = VALIDATE_STATE::END_OF_VALUE;
+                break;
+            }
+            [[fallthrough]];
 
-JsonWrapper Physon::parse_null_literal(){
+        case VALIDATE_STATE::KEY:
+            if(*c != '"' || !validate_string(c, end))
+                return false;
 
-    bool is_null_literal = (content[cursor.index + 1] == 'u' && content[cursor.index + 2] == 'l' && content[cursor.index + 3] == 'l');
-    if(!is_null_literal)
-        json_error("Invalid null-literal at index " + std::to_string(cursor.index));
-    
-    std::cout << "null at "  << cursor.index << std::endl;
+            while(c < end && is_whitespace(*c))
+                c++;
 
-    tokens.emplace_back(token_type::NULL_, cursor.index, 4);
-    cursor.index += 4;
+            if(c == end || *c != ':')
+                return false;
+            c++;
 
-    JsonWrapper new_value;
-    new_value.type = JSON_TYPE::NULL_;
-    new_value.store_id = 0;
-    return new_value;
-};
+            validate_state = VALIDATE_STATE::VALUE;
+            break;
 
+        case VALIDATE_STATE::VALUE_OR_CLOSE:
+            if(*c == ']'){
+                depth--;
+                c++;
+                validate_state = VALIDATE_STATE::END_OF_VALUE;
+                break;
+            }
+            [[fallthrough]];
 
-bool Physon::is_whitespace(char ch) {
+        case VALIDATE_STATE::VALUE:
+            validate_state = VALIDATE_STATE::END_OF_VALUE;
 
-    char space = '\u0020';
-    char tab = '\u0009';
-    char new_line = '\u000A';
-    char c_return = '\u000D';
+            switch (*c){
 
-    return ch == space || ch == tab || ch == new_line || ch == c_return;
+            case '[':
+            case '{':
+                if(depth == PHYSON_VALIDATE_MAX_DEPTH)
+                    return false;
+                container_stack[depth++] = *c;
+                validate_state = *c == '[' ? VALIDATE_STATE::VALUE_OR_CLOSE : VALIDATE_STATE::KEY_OR_CLOSE;
+                c++;
+                break;
 
-}
+            case '"':
+                if(!validate_string(c, end))
+                    return false;
+                break;
 
+            case 't':
+                if(end - c < 4 || c[1] != 'r' || c[2] != 'u' || c[3] != 'e')
+                    return false;
+                c += 4;
+                break;
+            case 'f':
+                if(end - c < 5 || c[1] != 'a' || c[2] != 'l' || c[3] != 's' || c[4] != 'e')
+                    return false;
+                c += 5;
+                break;
+            case 'n':
+                if(end - c < 4 || c[1] != 'u' || c[2] != 'l' || c[3] != 'l')
+                    return false;
+                c += 4;
+                break;
 
-char Physon::current_char(){
-    return content[cursor.index];
-}
-bool Physon::is_new_container_char(){
-    char c = content[cursor.index];
-    bool is_container_char = c == '{' || c == '[';
-    return is_container_char;
-}
-bool Physon::is_new_array_char(){
-    return content[cursor.index] == '[';
-}
-bool Physon::is_close_array_char(){
-    return content[cursor.index] == ']';
-}
-bool Physon::is_new_object_char(){
-    return content[cursor.index] == '{';
-}
-bool Physon::is_close_object_char(){
-    return content[cursor.index] == '}';
-}
+            default:
+                if(!validate_number(c, end))
+                    return false;
+                break;
+            }
+            break;
 
-bool Physon::is_new_value_char(){
-    return is_new_literal_char() || is_new_container_char();
-}
+        case VALIDATE_STATE::END_OF_VALUE:
+            // Extra characters after root value
+            if(depth == 0)
+                return false;
 
-bool Physon::is_quotation_mark(){
-    return content[cursor.index] == '"' ? true : false;
-}
-bool Physon::is_new_literal_char(){
-    char c = content[cursor.index];
-    bool literal_name = c == 't' || c == 'f' || c == 'n';
-    bool number = (c >= '0' && c <= '9') || c == '-';
-    bool string = c == '"';
+            if(*c == ','){
+                validate_state = container_stack[depth-1] == '{' ? VALIDATE_STATE::KEY : VALIDATE_STATE::VALUE;
+            }
+            else if(*c == ']' && container_stack[depth-1] == '['){
+                depth--;
+            }
+            else if(*c == '}' && container_stack[depth-1] == '{'){
+                depth--;
+            }
+            else {
+                return false;
+            }
+            c++;
+            break;
+        }
+    }
 
-    return literal_name || string || number;
 }
 
-void Physon::gobble_ws() {
 
-    while (is_whitespace(content[cursor.index]))
-        cursor.index++;
 
+SourceSpan& Physon::span_of(JsonWrapper container){
+    return container.type() == JSON_TYPE::ARRAY ? array_spans[container.store_id()] : object_spans[container.store_id()];
 }
 
-std::string Physon::state_to_string(){
+JsonWrapper Physon::enclosing_container(size_t start, size_t end, size_t* depth){
 
-    switch (state){
+    auto encloses = [&](JsonWrapper value){
+        if(!is_container(value.type()))
+            return false;
+        std::vector<SourceSpan>& spans = value.type() == JSON_TYPE::ARRAY ? array_spans : object_spans;
+        if((size_t)value.store_id() >= spans.size())
+            return false;
+        SourceSpan& span = spans[value.store_id()];
+        return span.start < start && span.end >= end;
+    };
 
-    case JSON_PARSE_STATE::ARRAY_CLOSE :
-        return std::string("ARRAY_CLOSE");
-        break;
-    
-    case JSON_PARSE_STATE::ARRAY_ENTER :
-        return std::string("ARRAY_ENTER");
-        break;
-    case JSON_PARSE_STATE::ARRAY_ENTERED :
-        return std::string("ARRAY_ENTERED");
-        break;
+    if(depth != nullptr)
+        *depth = 0;
 
-    case JSON_PARSE_STATE::DONE :
-        return std::string("DONE");
-        break;
-    case JSON_PARSE_STATE::ERROR :
-        return std::string("ERROR");
-        break;
+    JsonWrapper container = root_wrapper;
+    if(!encloses(container))
+        return JsonWrapper();
 
-    case JSON_PARSE_STATE::ROOT_BEFORE_VALUE :
-        return std::string("ROOT_BEFORE_VALUE");
-        break;
-    case JSON_PARSE_STATE::ROOT_END_OF_VALUE :
-        return std::string("ROOT_END_OF_VALUE");
-        break;
+    // Descend while a child container also encloses the range
+    while(true){
 
-    case JSON_PARSE_STATE::OBJECT_ENTER :
-        return std::string("OBJECT_ENTER");
-        break;
-    case JSON_PARSE_STATE::OBJECT_PARSE_KEY_COMMA :
-        return std::string("OBJECT_PARSE_KEY_COMMA");
-        break;
-    case JSON_PARSE_STATE::OBJECT_CLOSE :
-        return std::string("OBJECT_CLOSE");
-        break;
+        JsonWrapper enclosing_child;
 
-    case JSON_PARSE_STATE::VALUE_AT_NEW_VALUE_CHAR :
-        return std::string("VALUE_AT_NEW_VALUE_CHAR");
-        break;
-    case JSON_PARSE_STATE::VALUE_PARSE_LITERAL :
-        return std::string("VALUE_PARSE_LITERAL");
-        break;
-    case JSON_PARSE_STATE::VALUE_END_OF_VALUE :
-        return std::string("VALUE_END_OF_VALUE");
-        break;
-    
+        if(container.type() == JSON_TYPE::ARRAY){
+            for(JsonWrapper entry : store.get_array(container.store_id())){
+                if(encloses(entry)){
+                    enclosing_child = entry;
+                    break;
+                }
+            }
+        }
+        else {
+            for(JsonWrapper kv_wrapper : store.get_object(container.store_id())){
+                JsonWrapper kv_value = store.get_kv(kv_wrapper.store_id()).second;
+                if(encloses(kv_value)){
+                    enclosing_child = kv_value;
+                    break;
+                }
+            }
+        }
 
-    default:
-        return std::string("NO_STRING_REPRESENTATION_FOR_STATE");
-        break;
-    }
+        if(enclosing_child.type() == JSON_TYPE::NONE)
+            return container;
 
+        container = enclosing_child;
+        if(depth != nullptr)
+            (*depth)++;
+    }
 }
 
-void Physon::json_error(std::string error_msg){
+template<typename Policy>
+void Physon::reparse(size_t start, size_t removed_length, std::string replacement){
 
+    check_mutable();
 
-    std::string state_string = " ... State: " + state_to_string() + ". ";
+    if(start + removed_length > content.size())
+        json_error("Error: reparse range outside of content. Start = " + std::to_string(start));
 
-    std::string index_msg = "Content index : " + std::to_string(cursor.index) + ", Char: '" + content.substr(cursor.index, 1) + "'.";
+    size_t removed_end = start + removed_length;
+    long delta = (long)replacement.size() - (long)removed_length;
 
-    std::string full_error_msg = error_msg + state_string + index_msg;
+    size_t container_depth = 0;
+    JsonWrapper container = enclosing_container(start, removed_end, &container_depth);
 
+    // Under a budget the sub-parse only gets what the document has left, and starts at the depth of the container.
+    // Anything the sub-parse cannot fit goes to the full parse below, which has the final say.
+    PhysonBudget sub_budget;
+    if constexpr (Policy::enforce_budget){
+        auto exhausted = [](size_t max, size_t used){ return max != 0 && used >= max; };
+        auto remaining = [](size_t max, size_t used){ return max == 0 ? 0 : max - used; };
 
-    state = JSON_PARSE_STATE::ERROR;
-    throw std::runtime_error(full_error_msg);
+        if(!budget_charged || exhausted(budget.max_depth, container_depth)
+           || exhausted(budget.max_values, budget_values) || exhausted(budget.max_store_bytes, budget_store_bytes))
+            container = JsonWrapper();
+        else
+            sub_budget = { remaining(budget.max_depth, container_depth), budget.max_string_bytes,
+                           remaining(budget.max_values, budget_values), remaining(budget.max_store_bytes, budget_store_bytes) };
+    }
 
-}
+    if(container.type() == JSON_TYPE::NONE){
+        content.replace(start, removed_length, replacement);
+        parse<Policy>();
+        return;
+    }
 
-void Physon::add_value_to_current_container(JsonWrapper value){
+    SourceSpan container_span = span_of(container);
 
-    switch (current_container_type()){
+    std::string sub_content = content.substr(container_span.start, start - container_span.start)
+                            + replacement
+                            + content.substr(removed_end, container_span.end + 1 - removed_end);
 
-    case JSON_TYPE::NONE: // Not in container ==> new value is root value
-        root_wrapper = value;
-        break;
+    Physon sub_physon (sub_content);
+    sub_physon.budget = sub_budget;
+    try {
+        sub_physon.parse<Policy>();
+    }
+    catch(const std::runtime_error&) {
+        // Container text no longer stands on its own (e.g. an opened string swallowed the closing bracket)
+        content.replace(start, removed_length, replacement);
+        parse<Policy>();
+        return;
+    }
 
-    case JSON_TYPE::ARRAY:
-        {
-            json_array_wrap& real_array = store.get_array(cursor.container_trace.top().store_id);
-            real_array.push_back(value);
-            
-        }
-        break;
-    case JSON_TYPE::OBJECT:
-        {
-            json_object_wrap& real_object = store.get_object(cursor.container_trace.top().store_id);
-            
-            real_object.push_back(value);
+    content.replace(start, removed_length, replacement);
 
-            // push kv
-            cursor.container_trace.push(value);
 
-        }
-        break;
-    case JSON_TYPE::KV :
-        {
-            json_kv_wrap& real_kv = store.get_kv(cursor.container_trace.top().store_id);
-            
-            real_kv.second = value;
+    // Shift spans located after the edit
+    auto shift = [&](SourceSpan& span){
+        if(span.start >= removed_end)
+            span.start += delta;
+        if(span.end >= removed_end)
+            span.end += delta;
+    };
+    for(SourceSpan& span : array_spans)
+        shift(span);
+    for(SourceSpan& span : object_spans)
+        shift(span);
 
-            // pop kv
-            cursor.container_trace.pop();
-        }
-        break;
-    
-    default:
-        break;
+
+    // Splice new subtree into the store and move its entries into the existing container
+    size_t array_offset = store.arrays.size();
+    size_t object_offset = store.objects.size();
+
+    JsonWrapper sub_root = store.append_store(sub_physon.store, sub_physon.root_wrapper);
+
+    array_spans.resize(array_offset);
+    for(SourceSpan span : sub_physon.array_spans)
+        array_spans.push_back({ span.start + container_span.start, span.end + container_span.start });
+    object_spans.resize(object_offset);
+    for(SourceSpan span : sub_physon.object_spans)
+        object_spans.push_back({ span.start + container_span.start, span.end + container_span.start });
+
+    if(container.type() == JSON_TYPE::ARRAY)
+        store.get_array(container.store_id()) = std::move(store.get_array(sub_root.store_id()));
+    else
+        store.get_object(container.store_id()) = std::move(store.get_object(sub_root.store_id()));
+
+    if constexpr (Policy::enforce_budget){
+        budget_values += sub_physon.budget_values;
+        budget_store_bytes += sub_physon.budget_store_bytes;
     }
+
+    // Containers of the new subtree are new to the cache
+    if(stringify_cache_enabled && stringify_cache.parents_recorded)
+        record_parents(container);
+    mark_dirty(container);
 }
 
 
-void Physon::parse() {
 
-    cursor.index = 0;
-    store.clear();
-    state = JSON_PARSE_STATE::ROOT_BEFORE_VALUE;
-    
-    // Main Parsing loop
-    while(cursor.index < content.size()){
+bool json_equal(json_store& a_store, JsonWrapper a, json_store& b_store, JsonWrapper b){
 
-        switch (state){
+    // Explicit stack of value pairs still to compare, so nesting depth does not grow the call stack
+    std::vector<std::pair<JsonWrapper, JsonWrapper>> pending;
+    pending.emplace_back(a, b);
 
-        case JSON_PARSE_STATE::ROOT_BEFORE_VALUE:
-            before_root_value();
-            break;
+    while(!pending.empty()){
 
-        case JSON_PARSE_STATE::ARRAY_ENTER:
-            array_enter();
-            break;
-        case JSON_PARSE_STATE::ARRAY_ENTERED:
-            array_entered();
-            break;
-        case JSON_PARSE_STATE::ARRAY_CLOSE:
-            array_close();
-            break;
+        JsonWrapper a_value = pending.back().first;
+        JsonWrapper b_value = pending.back().second;
+        pending.pop_back();
+
+        // Shared subtrees, e.g. after physon_deduplicate(), compare equal without a walk
+        if(&a_store == &b_store && a_value == b_value && a_value.type() != JSON_TYPE::FLOAT)
+            continue;
 
+        // Undecoded numbers compare by value with decoded ones
+        JSON_TYPE type = a_store.value_type(a_value);
+        if(type != b_store.value_type(b_value))
+            return false;
 
-        case JSON_PARSE_STATE::OBJECT_ENTER:
-            object_enter();
+        switch (type){
+
+        case JSON_TYPE::INTEGER:
+            if(a_store.get_integer(a_value) != b_store.get_integer(b_value))
+                return false;
             break;
-        case JSON_PARSE_STATE::OBJECT_PARSE_KEY_COMMA:
-            object_parse_key_comma();
+        case JSON_TYPE::FLOAT:
+            if(a_store.get_float(a_value) != b_store.get_float(b_value))
+                return false;
             break;
-        case JSON_PARSE_STATE::OBJECT_CLOSE:
-            object_close();
+        case JSON_TYPE::STRING:
+            if(a_store.get_string_view(a_value) != b_store.get_string_view(b_value))
+                return false;
             break;
-            
 
-        case JSON_PARSE_STATE::VALUE_AT_NEW_VALUE_CHAR:
-            value_at_new_value_char();
-            break;
-        case JSON_PARSE_STATE::VALUE_PARSE_LITERAL:
-            value_parse_literal();
-            break;
-        case JSON_PARSE_STATE::VALUE_END_OF_VALUE:
-            value_end_of_value();
+        case JSON_TYPE::ARRAY:
+            {
+                json_array_wrap& a_array = a_store.get_array(a_value.store_id());
+                json_array_wrap& b_array = b_store.get_array(b_value.store_id());
+
+                if(a_array.size() != b_array.size())
+                    return false;
+
+                for(size_t i = 0; i < a_array.size(); i++)
+                    pending.emplace_back(a_array[i], b_array[i]);
+            }
             break;
-            
 
-        case JSON_PARSE_STATE::ROOT_END_OF_VALUE:
-            end_of_root_value();
+        case JSON_TYPE::OBJECT:
+            {
+                json_object_wrap& a_object = a_store.get_object(a_value.store_id());
+                json_object_wrap& b_object = b_store.get_object(b_value.store_id());
+
+                if(a_object.size() != b_object.size())
+                    return false;
+
+                for(size_t i = 0; i < a_object.size(); i++){
+                    json_kv_wrap& a_kv = a_store.get_kv(a_object[i].store_id());
+
+                    // Same key order is the common case
+                    json_kv_wrap* b_kv = &b_store.get_kv(b_object[i].store_id());
+                    if(b_kv->first != a_kv.first){
+                        b_kv = nullptr;
+                        for(JsonWrapper b_kv_wrapper : b_object){
+                            if(b_store.get_kv(b_kv_wrapper.store_id()).first == a_kv.first){
+                                b_kv = &b_store.get_kv(b_kv_wrapper.store_id());
+                                break;
+                            }
+                        }
+                    }
+
+                    if(b_kv == nullptr)
+                        return false;
+                    pending.emplace_back(a_kv.second, b_kv->second);
+                }
+            }
             break;
-        case JSON_PARSE_STATE::DONE:
-            return;
+
+        case JSON_TYPE::KV:
+            {
+                json_kv_wrap& a_kv = a_store.get_kv(a_value.store_id());
+                json_kv_wrap& b_kv = b_store.get_kv(b_value.store_id());
+                if(a_kv.first != b_kv.first)
+                    return false;
+                pending.emplace_back(a_kv.second, b_kv.second);
+            }
             break;
 
         default:
-            json_error("Error: Unknown parsing state.");
+            // true, false, null
             break;
         }
+    }
+
+    return true;
+}
 
 
+/** json_traverse() visitor writing a copy of each visited value into to_store */
+struct JsonCopyVisitor {
+
+    json_store& from_store;
+    json_store& to_store;
+
+    /** Copies of the containers currently being walked */
+    std::vector<JsonWrapper> open_copies;
+    JsonWrapper root_copy;
+
+    JsonCopyVisitor(json_store& _from_store, json_store& _to_store) : from_store {_from_store}, to_store {_to_store} {};
+
+    /** Adds copy to the enclosing container copy, as a kv when entry has a key */
+    void add_copy(const TraverseEntry& entry, JsonWrapper copy){
+
+        if(entry.key != nullptr){
+            JsonWrapper kv_copy = to_store.new_kv(*entry.key);
+            to_store.get_kv(kv_copy.store_id()).second = copy;
+            copy = kv_copy;
+        }
+
+        if(open_copies.empty())
+            root_copy = copy;
+        else if(open_copies.back().type() == JSON_TYPE::ARRAY)
+            to_store.get_array(open_copies.back().store_id()).push_back(copy);
+        else
+            to_store.get_object(open_copies.back().store_id()).push_back(copy);
     }
 
-}
\ No newline at end of file
+    bool enter(const TraverseEntry& entry){
+        JsonWrapper copy = entry.value.type() == JSON_TYPE::ARRAY ? to_store.new_array() : to_store.new_object();
+        add_copy(entry, copy);
+        open_copies.push_back(copy);
+        return true;
+    }
+
+    void leave(const TraverseEntry& entry){
+        open_copies.pop_back();
+    }
+
+    void scalar(const TraverseEntry& entry){
+
+        JsonWrapper value = entry.value;
+
+        if(value.is_lazy_string()){
+            bool has_escapes = from_store.lazy_strings[value.store_id()].has_escapes;
+            value = to_store.new_lazy_string(from_store.get_string_source(value), has_escapes);
+        }
+        else if(value.type() == JSON_TYPE::STRING){
+            value = JsonWrapper(to_store.add_string(from_store.get_string(value.store_id())), JSON_TYPE::STRING);
+        }
+        else if(value.type() == JSON_TYPE::NUMBER){
+            std::string_view text = from_store.get_number_text(value);
+            value = to_store.new_number(text.data(), text.size(), from_store.value_type(value) == JSON_TYPE::INTEGER);
+        }
+        else if(!value.is_inline())
+            value = to_store.new_integer(from_store.get_integer(value));
+
+        add_copy(entry, value);
+    }
+};
+
+JsonWrapper json_copy(json_store& from_store, JsonWrapper value, json_store& to_store){
+
+    // The traversal reads from_store by pointer, so a copy within one store is built in a scratch store first
+    if(&from_store == &to_store){
+        json_store scratch;
+        JsonWrapper scratch_root = json_copy(from_store, value, scratch);
+        return to_store.append_store(scratch, scratch_root);
+    }
+
+    JsonCopyVisitor visitor (from_store, to_store);
+    json_traverse(from_store, value, visitor);
+
+    return visitor.root_copy;
+}
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/**
+    Micro-benchmark harness reading hardware performance counters.
+
+    Each benchmark runs warm-up iterations, then a number of measured runs. A run reads wall time and, through
+    perf_event_open, cycles, instructions, branch misses, L1 data read misses and last level cache misses of the
+    calling thread. Counters the kernel or the machine does not offer are left out; when perf events are not
+    permitted at all (perf_event_paranoid, containers) only wall time is measured.
+
+    Per metric the median of the runs is reported. Runs further than PHYSON_BENCH_OUTLIER_MADS scaled median absolute
+    deviations (a robust standard deviation) from the median are dropped first, so a preempted run does not move the result.
+
+    A baseline file holds one "benchmark metric value" line per result. compare() flags every gated metric that
+    grew by more than the threshold over its baseline value.
+ */
+
+#define PHYSON_BENCH_OUTLIER_MADS 3.0 /** Runs further from the median than this many scaled MADs are dropped */
+
+
+enum class PHYSON_COUNTER {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    LLC_MISSES,
+    COUNT,
+};
+
+const char* counter_name(PHYSON_COUNTER counter){
+    switch (counter){
+    case PHYSON_COUNTER::CYCLES:         return "cycles";
+    case PHYSON_COUNTER::INSTRUCTIONS:   return "instructions";
+    case PHYSON_COUNTER::BRANCH_MISSES:  return "branch_misses";
+    case PHYSON_COUNTER::L1D_MISSES:     return "l1d_misses";
+    case PHYSON_COUNTER::LLC_MISSES:     return "llc_misses";
+    default:                            return "none";
+    }
+}
+
+
+/** One perf event group of the calling thread. Counters that fail to open have fd -1. */
+struct PhysonCounters {
+
+    int fds[(int)PHYSON_COUNTER::COUNT];
+    /** Kernel id of each open counter, to match the entries of a group read */
+    uint64_t ids[(int)PHYSON_COUNTER::COUNT];
+    /** Why no counter could be opened. Empty if at least one is available. */
+    std::string unavailable_reason;
+
+    PhysonCounters();
+    ~PhysonCounters();
+
+    PhysonCounters(const PhysonCounters&) = delete;
+    PhysonCounters& operator=(const PhysonCounters&) = delete;
+
+    bool available(PHYSON_COUNTER counter) const { return fds[(int)counter] >= 0; }
+    bool any_available() const { return unavailable_reason.empty(); }
+
+    void start();
+    /** Counts since start(), scaled up when the kernel multiplexed the group. Unavailable counters read 0. */
+    void stop(double values[(int)PHYSON_COUNTER::COUNT]);
+
+private:
+    int leader = -1;
+    int open_counter(uint32_t type, uint64_t config);
+};
+
+
+/** Results of one benchmark : median per metric over the kept runs */
+struct PhysonBenchResult {
+    std::string name;
+    /** Work per run, e.g. bytes, for the per-unit columns. 0 if not meaningful. */
+    double units = 0;
+    std::map<std::string, double> metrics;
+    size_t runs = 0;
+    size_t dropped = 0;
+};
+
+struct PhysonBench {
+
+    size_t warmup_runs = 3;
+    size_t runs = 15;
+
+    PhysonCounters counters;
+    std::vector<PhysonBenchResult> results;
+
+    /** Measures body runs times after warmup_runs unmeasured calls. setup runs before every call, unmeasured. */
+    PhysonBenchResult& run(const std::string& name, double units, std::function<void()> body, std::function<void()> setup = nullptr);
+
+    void print(std::ostream& out = std::cout);
+
+    /** Writes every result as "benchmark metric value" lines */
+    void write_baseline(const std::string& path);
+    /**
+        Prints the change of every metric against the baseline file. Returns the number of regressions :
+        gated metrics (time, cycles, instructions) more than threshold above their baseline, e.g. 0.05 for 5%.
+     */
+    int compare(const std::string& baseline_path, double threshold, std::ostream& out = std::cout);
+
+    static bool is_gated(const std::string& metric){
+        return metric == "time_ns" || metric == "cycles" || metric == "instructions";
+    }
+};
+
+
+/** Median of values after dropping outliers. dropped receives the number of dropped values. */
+double robust_median(std::vector<double> values, size_t& dropped);
+
+
+
+PhysonCounters::PhysonCounters(){
+
+    for(int& fd : fds)
+        fd = -1;
+
+    fds[(int)PHYSON_COUNTER::CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    if(leader < 0){
+        unavailable_reason = std::string("perf_event_open failed : ") + std::strerror(errno);
+    }
+    fds[(int)PHYSON_COUNTER::INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[(int)PHYSON_COUNTER::BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fds[(int)PHYSON_COUNTER::L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    fds[(int)PHYSON_COUNTER::LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+    if(leader >= 0)
+        unavailable_reason.clear();
+
+    for(int counter = 0; counter < (int)PHYSON_COUNTER::COUNT; counter++){
+        ids[counter] = 0;
+        if(fds[counter] >= 0 && ioctl(fds[counter], PERF_EVENT_IOC_ID, &ids[counter]) != 0)
+            ids[counter] = 0;
+    }
+}
+
+PhysonCounters::~PhysonCounters(){
+    for(int fd : fds){
+        if(fd >= 0)
+            close(fd);
+    }
+}
+
+int PhysonCounters::open_counter(uint32_t type, uint64_t config){
+
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = leader < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+    if(fd >= 0 && leader < 0)
+        leader = fd;
+    return fd;
+}
+
+void PhysonCounters::start(){
+    if(leader < 0)
+        return;
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void PhysonCounters::stop(double values[(int)PHYSON_COUNTER::COUNT]){
+
+    for(int i = 0; i < (int)PHYSON_COUNTER::COUNT; i++)
+        values[i] = 0;
+    if(leader < 0)
+        return;
+
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // Group read : nr, time_enabled, time_running, then a value and id per counter
+    uint64_t buffer[3 + 2 * (int)PHYSON_COUNTER::COUNT];
+    if(read(leader, buffer, sizeof(buffer)) < 0)
+        return;
+
+    uint64_t count = std::min<uint64_t>(buffer[0], (uint64_t)PHYSON_COUNTER::COUNT);
+    double scale = buffer[2] > 0 ? (double)buffer[1] / buffer[2] : 1.0;
+
+    for(uint64_t i = 0; i < count; i++){
+        uint64_t value = buffer[3 + 2 * i];
+        uint64_t id = buffer[4 + 2 * i];
+        for(int counter = 0; counter < (int)PHYSON_COUNTER::COUNT; counter++){
+            if(fds[counter] >= 0 && ids[counter] == id)
+                values[counter] = value * scale;
+        }
+    }
+}
+
+
+double robust_median(std::vector<double> values, size_t& dropped){
+
+    dropped = 0;
+    if(values.empty())
+        return 0;
+
+    auto median_of = [](std::vector<double>& v){
+        std::sort(v.begin(), v.end());
+        size_t mid = v.size() / 2;
+        return v.size() % 2 ? v[mid] : (v[mid - 1] + v[mid]) / 2;
+    };
+
+    std::vector<double> sorted = values;
+    double median = median_of(sorted);
+
+    auto distance = [&](double value){ return value < median ? median - value : value - median; };
+
+    std::vector<double> deviations;
+    for(double value : values)
+        deviations.push_back(distance(value));
+    // Scaled to estimate the standard deviation of normally distributed runs
+    double mad = 1.4826 * median_of(deviations);
+    if(mad == 0)
+        return median;
+
+    std::vector<double> kept;
+    for(double value : values){
+        if(distance(value) <= PHYSON_BENCH_OUTLIER_MADS * mad)
+            kept.push_back(value);
+    }
+    dropped = values.size() - kept.size();
+    return median_of(kept);
+}
+
+
+PhysonBenchResult& PhysonBench::run(const std::string& name, double units, std::function<void()> body, std::function<void()> setup){
+
+    for(size_t i = 0; i < warmup_runs; i++){
+        if(setup)
+            setup();
+        body();
+    }
+
+    std::vector<double> times;
+    std::vector<std::vector<double>> counts ((int)PHYSON_COUNTER::COUNT);
+
+    for(size_t i = 0; i < runs; i++){
+        if(setup)
+            setup();
+
+        double values[(int)PHYSON_COUNTER::COUNT];
+        counters.start();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto stop = std::chrono::steady_clock::now();
+        counters.stop(values);
+
+        times.push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+        for(int counter = 0; counter < (int)PHYSON_COUNTER::COUNT; counter++)
+            counts[counter].push_back(values[counter]);
+    }
+
+    PhysonBenchResult& result = results.emplace_back();
+    result.name = name;
+    result.units = units;
+    result.runs = runs;
+
+    result.metrics["time_ns"] = robust_median(times, result.dropped);
+    for(int counter = 0; counter < (int)PHYSON_COUNTER::COUNT; counter++){
+        if(!counters.available((PHYSON_COUNTER)counter))
+            continue;
+        size_t dropped;
+        result.metrics[counter_name((PHYSON_COUNTER)counter)] = robust_median(counts[counter], dropped);
+    }
+
+    return result;
+}
+
+void PhysonBench::print(std::ostream& out){
+
+    if(!counters.any_available())
+        out << "Hardware counters unavailable (" << counters.unavailable_reason << "), wall time only." << std::endl;
+
+    for(PhysonBenchResult& result : results){
+        out << std::left << std::setw(24) << result.name
+            << " runs " << result.runs - result.dropped << "/" << result.runs << std::endl;
+        for(auto& [metric, value] : result.metrics){
+            out << "    " << std::left << std::setw(16) << metric << std::right << std::setw(16) << std::fixed << std::setprecision(0) << value;
+            if(result.units > 0)
+                out << std::setw(14) << std::setprecision(3) << value / result.units << " /unit";
+            out << std::endl;
+        }
+    }
+}
+
+void PhysonBench::write_baseline(const std::string& path){
+
+    std::ofstream file (path);
+    if(!file.is_open())
+        throw std::runtime_error("Bench: cannot write baseline " + path);
+
+    for(PhysonBenchResult& result : results){
+        for(auto& [metric, value] : result.metrics)
+            file << result.name << " " << metric << " " << std::fixed << std::setprecision(1) << value << "\n";
+    }
+}
+
+int PhysonBench::compare(const std::string& baseline_path, double threshold, std::ostream& out){
+
+    std::ifstream file (baseline_path);
+    if(!file.is_open())
+        throw std::runtime_error("Bench: cannot read baseline " + baseline_path);
+
+    std::map<std::pair<std::string, std::string>, double> baseline;
+    std::string line;
+    while(std::getline(file, line)){
+        std::istringstream fields (line);
+        std::string name, metric;
+        double value;
+        if(fields >> name >> metric >> value)
+            baseline[{ name, metric }] = value;
+    }
+
+    int regressions = 0;
+    for(PhysonBenchResult& result : results){
+        for(auto& [metric, value] : result.metrics){
+
+            auto entry = baseline.find({ result.name, metric });
+            if(entry == baseline.end() || entry->second <= 0)
+                continue;
+
+            double change = value / entry->second - 1.0;
+            bool regressed = is_gated(metric) && change > threshold;
+            regressions += regressed;
+
+            out << std::left << std::setw(24) << result.name << std::setw(16) << metric
+                << std::right << std::showpos << std::fixed << std::setprecision(1) << std::setw(8) << change * 100 << "%"
+                << std::noshowpos << (regressed ? "  REGRESSION" : "") << std::endl;
+        }
+    }
+
+    return regressions;
+}
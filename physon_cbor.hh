@@ -0,0 +1,546 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+
+#include "physon.hh"
+#include "physon_types.hh"
+#include "physon_traverse.hh"
+
+
+/**
+    CBOR (RFC 8949) encoding and decoding directly between bytes and a json_store.
+
+    Arrays holding only floats or only integers are written as RFC 8746 typed arrays
+    (tag 86 : float64 little endian, tag 79 : sint64 little endian). Float arrays are a single
+    memcpy of the wrapper vector in both directions since float handles are the double bits. Pass typed_arrays = false for peers
+    that do not understand typed array tags.
+ */
+
+#define PHYSON_CBOR_MAX_DEPTH 1024
+
+#define CBOR_TAG_SINT64_LE  79
+#define CBOR_TAG_FLOAT64_LE 86
+
+enum class CBOR_MAJOR {
+    UNSIGNED = 0,
+    NEGATIVE,
+    BYTES,
+    TEXT,
+    ARRAY,
+    MAP,
+    TAG,
+    SIMPLE,
+};
+
+
+/** Encode value and its subtree. */
+std::string cbor_encode(json_store& store, JsonWrapper value, bool typed_arrays = true);
+std::string cbor_encode(Physon& physon, bool typed_arrays = true);
+
+/** Decode a single CBOR item into store. Returns the wrapper of the decoded root value. */
+JsonWrapper cbor_decode(std::string_view bytes, json_store& store);
+/** Replace the physon document, store, content and spans, by bytes decoded as the new root value. */
+void cbor_decode(Physon& physon, std::string_view bytes);
+
+
+
+struct CborEncoder {
+
+    json_store& store;
+    bool typed_arrays;
+    std::string buffer;
+
+    CborEncoder(json_store& _store, bool _typed_arrays) : store {_store}, typed_arrays {_typed_arrays} {};
+
+    void write_head(CBOR_MAJOR major, uint64_t argument);
+    void write_float(json_float float_);
+    void write_string(std::string_view str);
+    /** Returns false if array is not homogeneous floats or integers */
+    bool write_typed_array(const json_array_wrap& array);
+    void write_scalar(JsonWrapper value);
+    /** Writes value and its subtree with json_traverse() */
+    void write_value(JsonWrapper value);
+
+    // json_traverse() visitor
+    bool enter(const TraverseEntry& entry);
+    void leave(const TraverseEntry& entry) {};
+    void scalar(const TraverseEntry& entry);
+};
+
+
+struct CborDecoder {
+
+    json_store& store;
+    const uint8_t* c;
+    const uint8_t* end;
+    int depth = 0;
+
+    CborDecoder(json_store& _store, std::string_view bytes)
+        : store {_store}, c {reinterpret_cast<const uint8_t*>(bytes.data())}, end {c + bytes.size()} {};
+
+    uint8_t read_byte();
+    uint64_t read_be(int byte_count);
+    /** Reads the argument of an initial byte. Returns false for indefinite length. */
+    bool read_argument(uint8_t additional, uint64_t& argument);
+    std::string read_text(uint8_t additional);
+    JsonWrapper read_typed_array(uint64_t tag);
+    JsonWrapper read_value();
+    /** Peeks for the 0xFF break marker of indefinite length items and consumes it. */
+    bool at_break();
+
+    void cbor_error(std::string error_msg);
+};
+
+
+
+void CborEncoder::write_head(CBOR_MAJOR major, uint64_t argument){
+
+    uint8_t major_bits = (uint8_t)major << 5;
+
+    if(argument < 24){
+        buffer.push_back(major_bits | argument);
+        return;
+    }
+
+    int byte_count;
+    if(argument <= 0xFF){
+        buffer.push_back(major_bits | 24);
+        byte_count = 1;
+    }
+    else if(argument <= 0xFFFF){
+        buffer.push_back(major_bits | 25);
+        byte_count = 2;
+    }
+    else if(argument <= 0xFFFFFFFF){
+        buffer.push_back(major_bits | 26);
+        byte_count = 4;
+    }
+    else {
+        buffer.push_back(major_bits | 27);
+        byte_count = 8;
+    }
+
+    for(int i = byte_count - 1; i >= 0; i--)
+        buffer.push_back((char)(argument >> (8 * i)));
+}
+
+void CborEncoder::write_float(json_float float_){
+    uint64_t bits;
+    std::memcpy(&bits, &float_, sizeof(bits));
+
+    buffer.push_back((char)0xFB);
+    for(int i = 7; i >= 0; i--)
+        buffer.push_back((char)(bits >> (8 * i)));
+}
+
+void CborEncoder::write_string(std::string_view str){
+    write_head(CBOR_MAJOR::TEXT, str.size());
+    buffer.append(str);
+}
+
+bool CborEncoder::write_typed_array(const json_array_wrap& array){
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(array.size() < 2)
+        return false;
+
+    JSON_TYPE type = array[0].type();
+    if(type != JSON_TYPE::FLOAT && type != JSON_TYPE::INTEGER)
+        return false;
+
+    for(size_t i = 0; i < array.size(); i++){
+        if(array[i].type() != type)
+            return false;
+    }
+
+    const char* payload;
+    std::vector<json_int> gathered;
+    size_t byte_count = array.size() * 8;
+
+    if(type == JSON_TYPE::FLOAT){
+        // Float handles are the double bits, so the wrapper vector is the payload
+        payload = reinterpret_cast<const char*>(array.data());
+    }
+    else {
+        gathered.resize(array.size());
+        for(size_t i = 0; i < array.size(); i++)
+            gathered[i] = store.get_integer(array[i]);
+        payload = reinterpret_cast<const char*>(gathered.data());
+    }
+
+    write_head(CBOR_MAJOR::TAG, type == JSON_TYPE::FLOAT ? CBOR_TAG_FLOAT64_LE : CBOR_TAG_SINT64_LE);
+    write_head(CBOR_MAJOR::BYTES, byte_count);
+    buffer.append(payload, byte_count);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void CborEncoder::write_scalar(JsonWrapper value){
+
+    // Undecoded numbers are written as the integer or float they spell
+    switch (store.value_type(value)){
+
+    case JSON_TYPE::NULL_:
+        buffer.push_back((char)0xF6);
+        break;
+    case JSON_TYPE::TRUE:
+        buffer.push_back((char)0xF5);
+        break;
+    case JSON_TYPE::FALSE:
+        buffer.push_back((char)0xF4);
+        break;
+
+    case JSON_TYPE::INTEGER:
+        {
+            json_int int_ = store.get_integer(value);
+            if(int_ >= 0)
+                write_head(CBOR_MAJOR::UNSIGNED, (uint64_t)int_);
+            else
+                write_head(CBOR_MAJOR::NEGATIVE, (uint64_t)(-1 - int_));
+        }
+        break;
+    case JSON_TYPE::FLOAT:
+        write_float(store.get_float(value));
+        break;
+
+    case JSON_TYPE::STRING:
+        write_string(store.get_string_view(value));
+        break;
+
+    default:
+        throw std::runtime_error("CBOR encode: wrapper type has no json representation.");
+    }
+}
+
+bool CborEncoder::enter(const TraverseEntry& entry){
+
+    if(entry.key != nullptr)
+        write_string(*entry.key);
+
+    if(entry.value.type() == JSON_TYPE::ARRAY){
+        const json_array_wrap& array = store.get_array(entry.value.store_id());
+        if(typed_arrays && write_typed_array(array))
+            return false;
+        write_head(CBOR_MAJOR::ARRAY, array.size());
+    }
+    else {
+        write_head(CBOR_MAJOR::MAP, store.get_object(entry.value.store_id()).size());
+    }
+
+    return true;
+}
+
+void CborEncoder::scalar(const TraverseEntry& entry){
+    if(entry.key != nullptr)
+        write_string(*entry.key);
+    write_scalar(entry.value);
+}
+
+void CborEncoder::write_value(JsonWrapper value){
+    if(value.type() == JSON_TYPE::KV)
+        throw std::runtime_error("CBOR encode: wrapper type has no json representation.");
+    json_traverse(store, value, *this);
+}
+
+
+
+void CborDecoder::cbor_error(std::string error_msg){
+    throw std::runtime_error("CBOR decode: " + error_msg);
+}
+
+uint8_t CborDecoder::read_byte(){
+    if(c >= end)
+        cbor_error("Unexpected end of input.");
+    return *c++;
+}
+
+uint64_t CborDecoder::read_be(int byte_count){
+    if(end - c < byte_count)
+        cbor_error("Unexpected end of input.");
+
+    uint64_t value = 0;
+    for(int i = 0; i < byte_count; i++)
+        value = (value << 8) | *c++;
+
+    return value;
+}
+
+bool CborDecoder::read_argument(uint8_t additional, uint64_t& argument){
+
+    if(additional < 24)
+        argument = additional;
+    else if(additional == 24)
+        argument = read_be(1);
+    else if(additional == 25)
+        argument = read_be(2);
+    else if(additional == 26)
+        argument = read_be(4);
+    else if(additional == 27)
+        argument = read_be(8);
+    else if(additional == 31)
+        return false;
+    else
+        cbor_error("Reserved additional information value " + std::to_string(additional) + ".");
+
+    return true;
+}
+
+bool CborDecoder::at_break(){
+    if(c < end && *c == 0xFF){
+        c++;
+        return true;
+    }
+    return false;
+}
+
+std::string CborDecoder::read_text(uint8_t additional){
+
+    uint64_t length;
+    std::string text;
+
+    if(read_argument(additional, length)){
+        if((uint64_t)(end - c) < length)
+            cbor_error("Text string runs past end of input.");
+        text.assign(reinterpret_cast<const char*>(c), length);
+        c += length;
+        return text;
+    }
+
+    // Indefinite length : concatenated definite length chunks
+    while(!at_break()){
+        uint8_t initial = read_byte();
+        if((CBOR_MAJOR)(initial >> 5) != CBOR_MAJOR::TEXT || (initial & 0x1F) == 31)
+            cbor_error("Invalid chunk in indefinite length text string.");
+        text += read_text(initial & 0x1F);
+    }
+
+    return text;
+}
+
+JsonWrapper CborDecoder::read_typed_array(uint64_t tag){
+
+    uint8_t initial = read_byte();
+    uint64_t byte_count;
+    if((CBOR_MAJOR)(initial >> 5) != CBOR_MAJOR::BYTES || !read_argument(initial & 0x1F, byte_count))
+        cbor_error("Typed array tag must be followed by a definite length byte string.");
+    if(byte_count % 8 != 0 || (uint64_t)(end - c) < byte_count)
+        cbor_error("Invalid typed array length.");
+
+    size_t count = byte_count / 8;
+    JsonWrapper array_wrapper = store.new_array();
+    json_array_wrap& array = store.get_array(array_wrapper.store_id());
+    array.reserve(count);
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(tag == CBOR_TAG_FLOAT64_LE){
+        array.resize(count);
+        std::memcpy(array.data(), c, byte_count);
+        // Any NaN in the input could alias a boxed handle
+        for(JsonWrapper& entry : array){
+            if(entry.float_value() != entry.float_value())
+                entry = store.new_float(entry.float_value());
+        }
+    }
+    else {
+        for(size_t i = 0; i < count; i++){
+            json_int int_;
+            std::memcpy(&int_, c + i * 8, sizeof(int_));
+            array.push_back(store.new_integer(int_));
+        }
+    }
+#else
+    for(size_t i = 0; i < count; i++){
+        uint64_t bits = 0;
+        for(int b = 7; b >= 0; b--)
+            bits = (bits << 8) | c[i * 8 + b];
+
+        if(tag == CBOR_TAG_FLOAT64_LE){
+            json_float float_;
+            std::memcpy(&float_, &bits, sizeof(float_));
+            array.push_back(store.new_float(float_));
+        }
+        else {
+            array.push_back(store.new_integer((json_int)bits));
+        }
+    }
+#endif
+
+    c += byte_count;
+    return array_wrapper;
+}
+
+JsonWrapper CborDecoder::read_value(){
+
+    uint8_t initial = read_byte();
+
+    // Other tags than typed arrays carry no meaning in json : the tagged item is decoded instead.
+    // Skipped in a loop, so a long chain of tags cannot grow the call stack.
+    while((CBOR_MAJOR)(initial >> 5) == CBOR_MAJOR::TAG){
+        uint64_t tag;
+        if(!read_argument(initial & 0x1F, tag))
+            cbor_error("Tags have no indefinite length form.");
+        if(tag == CBOR_TAG_FLOAT64_LE || tag == CBOR_TAG_SINT64_LE)
+            return read_typed_array(tag);
+        initial = read_byte();
+    }
+
+    CBOR_MAJOR major = (CBOR_MAJOR)(initial >> 5);
+    uint8_t additional = initial & 0x1F;
+    uint64_t argument = 0;
+
+    switch (major){
+
+    case CBOR_MAJOR::UNSIGNED:
+        if(!read_argument(additional, argument))
+            cbor_error("Integers have no indefinite length form.");
+        if(argument > (uint64_t)LLONG_MAX)
+            cbor_error("Integer too large for internal representation.");
+        return store.new_integer((json_int)argument);
+
+    case CBOR_MAJOR::NEGATIVE:
+        if(!read_argument(additional, argument))
+            cbor_error("Integers have no indefinite length form.");
+        if(argument > (uint64_t)LLONG_MAX)
+            cbor_error("Integer too small for internal representation.");
+        return store.new_integer(-1 - (json_int)argument);
+
+    case CBOR_MAJOR::BYTES:
+        cbor_error("Byte strings have no json representation.");
+        break;
+
+    case CBOR_MAJOR::TEXT:
+        {
+            return JsonWrapper(store.add_string(read_text(additional)), JSON_TYPE::STRING);
+        }
+
+    case CBOR_MAJOR::ARRAY:
+    case CBOR_MAJOR::MAP:
+        {
+            if(++depth > PHYSON_CBOR_MAX_DEPTH)
+                cbor_error("Maximum nesting depth exceeded.");
+
+            bool definite = read_argument(additional, argument);
+            JsonWrapper container = major == CBOR_MAJOR::ARRAY ? store.new_array() : store.new_object();
+
+            // Store references are taken after each child since decoding a child may grow the store
+            for(uint64_t i = 0; definite ? i < argument : !at_break(); i++){
+
+                if(major == CBOR_MAJOR::ARRAY){
+                    JsonWrapper entry = read_value();
+                    store.get_array(container.store_id()).push_back(entry);
+                    continue;
+                }
+
+                uint8_t key_initial = read_byte();
+                if((CBOR_MAJOR)(key_initial >> 5) != CBOR_MAJOR::TEXT)
+                    cbor_error("Map keys must be text strings.");
+
+                JsonWrapper kv = store.new_kv(read_text(key_initial & 0x1F));
+                JsonWrapper kv_value = read_value();
+                store.get_kv(kv.store_id()).second = kv_value;
+                store.get_object(container.store_id()).push_back(kv);
+            }
+
+            depth--;
+            return container;
+        }
+
+    case CBOR_MAJOR::TAG:
+        // Skipped above
+        break;
+
+    case CBOR_MAJOR::SIMPLE:
+        switch (additional){
+        case 20:
+            return JsonWrapper(JSON_TYPE::FALSE);
+        case 21:
+            return JsonWrapper(JSON_TYPE::TRUE);
+        case 22:
+            return JsonWrapper(JSON_TYPE::NULL_);
+        case 25:
+            {
+                // Half precision : rebuild as single precision bits
+                uint16_t half = read_be(2);
+                uint32_t sign = (half >> 15) << 31;
+                uint32_t exponent = (half >> 10) & 0x1F;
+                uint32_t mantissa = half & 0x3FF;
+
+                if(exponent == 0){
+                    json_float subnormal = mantissa / 16777216.0;
+                    return store.new_float(sign ? -subnormal : subnormal);
+                }
+
+                uint32_t bits = sign | ((exponent == 31 ? 255 : exponent - 15 + 127) << 23) | (mantissa << 13);
+                float single;
+                std::memcpy(&single, &bits, sizeof(single));
+                return store.new_float(single);
+            }
+        case 26:
+            {
+                uint32_t bits = read_be(4);
+                float single;
+                std::memcpy(&single, &bits, sizeof(single));
+                return store.new_float(single);
+            }
+        case 27:
+            {
+                uint64_t bits = read_be(8);
+                json_float double_;
+                std::memcpy(&double_, &bits, sizeof(double_));
+                return store.new_float(double_);
+            }
+        default:
+            cbor_error("Simple value " + std::to_string(additional) + " has no json representation.");
+        }
+        break;
+    }
+
+    return JsonWrapper();
+}
+
+
+
+std::string cbor_encode(json_store& store, JsonWrapper value, bool typed_arrays){
+    CborEncoder encoder (store, typed_arrays);
+    encoder.write_value(value);
+    return encoder.buffer;
+}
+
+std::string cbor_encode(Physon& physon, bool typed_arrays){
+    return cbor_encode(physon.store, physon.root_wrapper, typed_arrays);
+}
+
+JsonWrapper cbor_decode(std::string_view bytes, json_store& store){
+    CborDecoder decoder (store, bytes);
+
+    JsonWrapper root = decoder.read_value();
+
+    if(decoder.c != decoder.end)
+        decoder.cbor_error("Extra bytes after root item.");
+
+    return root;
+}
+
+void cbor_decode(Physon& physon, std::string_view bytes){
+    physon.store.clear();
+    physon.tokens.clear();
+    physon.stringify_cache.clear();
+    physon.shared_subtrees = false;
+    physon.budget_charged = false;
+    // The store no longer comes from content, so there is no text left for reparse() to edit
+    physon.content.clear();
+    physon.cursor.index = 0;
+    physon.array_spans.clear();
+    physon.object_spans.clear();
+    physon.root_wrapper = JsonWrapper();
+    physon.root_wrapper = cbor_decode(bytes, physon.store);
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstdint>
+
+#include "physon.hh"
+#include "physon_types.hh"
+
+
+/**
+    Columnar extraction from an array of objects.
+
+    physon_extract_columns() walks the records once and writes the requested fields into contiguous typed
+    vectors, one per field, with a validity bitmap marking the rows where the field is present with a usable type.
+    Invalid rows hold 0, an empty view or false, so aggregation loops can run over a whole column without branches
+    and apply the bitmap afterwards.
+
+    Records usually share their key order, so each field first checks the kv position it was found at in the
+    previous record and only scans the object on a miss.
+
+    Usage:
+        PhysonColumns columns = physon_extract_columns(physon, points, { {"x", PHYSON_COLUMN_TYPE::FLOAT},
+                                                                         {"name", PHYSON_COLUMN_TYPE::STRING} });
+        const std::vector<double>& x = columns[0].floats;
+ */
+
+
+enum class PHYSON_COLUMN_TYPE {
+    /** FLOAT, INTEGER and NUMBER values, as double */
+    FLOAT,
+    /** INTEGER values and NUMBER values without fraction or exponent. Floats are invalid, not truncated. */
+    INTEGER,
+    /** String views into the store, valid as long as the store */
+    STRING,
+    BOOL,
+};
+
+struct PhysonColumnSpec {
+    std::string name;
+    PHYSON_COLUMN_TYPE type;
+};
+
+struct PhysonColumn {
+
+    std::string name;
+    PHYSON_COLUMN_TYPE type;
+
+    /** Only the vector of type is filled, with one entry per row */
+    std::vector<double>             floats;
+    std::vector<int64_t>            integers;
+    std::vector<std::string_view>   strings;
+    std::vector<uint8_t>            bools;
+
+    /** Bit row % 64 of word row / 64 is set when the row holds a value */
+    std::vector<uint64_t> validity;
+    size_t null_count = 0;
+
+    bool is_valid(size_t row) const {
+        return (validity[row / 64] >> (row % 64)) & 1;
+    }
+};
+
+struct PhysonColumns {
+
+    size_t rows = 0;
+    std::vector<PhysonColumn> columns;
+
+    PhysonColumn& operator[](size_t index){
+        return columns[index];
+    }
+    /** Throws if no column has the name */
+    PhysonColumn& operator[](std::string_view name);
+};
+
+
+/** One column per spec, one row per entry of array. Non-object entries are invalid rows in every column. */
+PhysonColumns physon_extract_columns(Physon& physon, JsonWrapper array, const std::vector<PhysonColumnSpec>& specs);
+
+void columns_error(std::string error_msg){
+    throw std::runtime_error("Columns: " + error_msg);
+}
+
+
+
+PhysonColumn& PhysonColumns::operator[](std::string_view name){
+    for(PhysonColumn& column : columns){
+        if(column.name == name)
+            return column;
+    }
+    columns_error("no column named '" + std::string(name) + "'.");
+    return columns.front();
+}
+
+
+/** Writes value into row of column. Returns false when value has no usable type for the column. */
+bool column_set(json_store& store, PhysonColumn& column, size_t row, JsonWrapper value){
+
+    JSON_TYPE type = store.value_type(value);
+
+    switch (column.type){
+
+    case PHYSON_COLUMN_TYPE::FLOAT:
+        if(type != JSON_TYPE::FLOAT && type != JSON_TYPE::INTEGER)
+            return false;
+        column.floats[row] = type == JSON_TYPE::INTEGER ? (double)store.get_integer(value) : store.get_float(value);
+        return true;
+
+    case PHYSON_COLUMN_TYPE::INTEGER:
+        if(type != JSON_TYPE::INTEGER)
+            return false;
+        column.integers[row] = store.get_integer(value);
+        return true;
+
+    case PHYSON_COLUMN_TYPE::STRING:
+        if(type != JSON_TYPE::STRING)
+            return false;
+        column.strings[row] = store.get_string_view(value);
+        return true;
+
+    case PHYSON_COLUMN_TYPE::BOOL:
+        if(type != JSON_TYPE::TRUE && type != JSON_TYPE::FALSE)
+            return false;
+        column.bools[row] = type == JSON_TYPE::TRUE;
+        return true;
+    }
+
+    return false;
+}
+
+PhysonColumns physon_extract_columns(Physon& physon, JsonWrapper array, const std::vector<PhysonColumnSpec>& specs){
+
+    if(array.type() != JSON_TYPE::ARRAY)
+        columns_error("extraction source is not an array.");
+
+    json_store& store = physon.store;
+    const json_array_wrap& records = store.get_array(array.store_id());
+
+    PhysonColumns result;
+    result.rows = records.size();
+    result.columns.resize(specs.size());
+
+    for(size_t i = 0; i < specs.size(); i++){
+        PhysonColumn& column = result.columns[i];
+        column.name = specs[i].name;
+        column.type = specs[i].type;
+        switch (column.type){
+        case PHYSON_COLUMN_TYPE::FLOAT:     column.floats.resize(result.rows);     break;
+        case PHYSON_COLUMN_TYPE::INTEGER:   column.integers.resize(result.rows);   break;
+        case PHYSON_COLUMN_TYPE::STRING:    column.strings.resize(result.rows);    break;
+        case PHYSON_COLUMN_TYPE::BOOL:      column.bools.resize(result.rows);      break;
+        }
+        column.validity.resize((result.rows + 63) / 64);
+    }
+
+    // kv position of each field in the previous record
+    std::vector<size_t> predicted (specs.size(), 0);
+
+    for(size_t row = 0; row < records.size(); row++){
+
+        if(records[row].type() != JSON_TYPE::OBJECT)
+            continue;
+        const json_object_wrap& object = store.get_object(records[row].store_id());
+
+        for(size_t i = 0; i < specs.size(); i++){
+
+            const std::string& name = specs[i].name;
+            size_t position = predicted[i];
+
+            if(position >= object.size() || store.get_kv(object[position].store_id()).first != name){
+                position = object.size();
+                for(size_t j = 0; j < object.size(); j++){
+                    if(store.get_kv(object[j].store_id()).first == name){
+                        position = j;
+                        break;
+                    }
+                }
+                if(position == object.size())
+                    continue;
+                predicted[i] = position;
+            }
+
+            PhysonColumn& column = result.columns[i];
+            if(column_set(store, column, row, store.get_kv(object[position].store_id()).second))
+                column.validity[row / 64] |= 1ULL << (row % 64);
+        }
+    }
+
+    for(PhysonColumn& column : result.columns){
+        size_t valid = 0;
+        for(uint64_t word : column.validity)
+            valid += __builtin_popcountll(word);
+        column.null_count = result.rows - valid;
+    }
+
+    return result;
+}
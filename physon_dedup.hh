@@ -0,0 +1,306 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+
+#include "physon.hh"
+#include "physon_types.hh"
+#include "physon_traverse.hh"
+
+
+/**
+    Hash-consing of a parsed document.
+
+    physon_deduplicate() rebuilds the store bottom-up so that equal values share one store entry :
+    repeated strings, wide integers and lazy numbers, and every array, object and kv whose entries are equal.
+    Containers are interned after their entries, so two containers are equal exactly when their entry
+    handles are bit-identical, and each one is hashed and compared in a single pass over its entries.
+
+    Equality is structural and order-preserving : objects with the same kvs in a different order stay
+    distinct, and lazy numbers and strings are interned by their json text, so stringify() output is unchanged.
+    A deduplicated Physon is read-only, since one container may now appear at several places in the tree.
+ */
+
+
+/** Store entries before and after deduplication */
+struct PhysonDedupReport {
+    size_t strings_before = 0,  strings_after = 0;
+    size_t numbers_before = 0,  numbers_after = 0;
+    size_t arrays_before = 0,   arrays_after = 0;
+    size_t objects_before = 0,  objects_after = 0;
+    size_t kvs_before = 0,      kvs_after = 0;
+};
+
+/** Replace the store of a parsed physon by its deduplicated copy. Mutation throws afterwards until the next parse(). */
+PhysonDedupReport physon_deduplicate(Physon& physon);
+
+
+
+/** Open addressing set of store ids, keyed by a caller supplied hash */
+struct DedupTable {
+
+    /** id + 1, 0 for an empty slot */
+    std::vector<uint32_t> slots;
+    std::vector<uint64_t> slot_hashes;
+    size_t count = 0;
+
+    /** Returns the id of the entry equal to the candidate, or the id from make() when there is none */
+    template<typename Equals, typename Make>
+    uint32_t intern(uint64_t hash, Equals equals, Make make);
+
+    void grow();
+};
+
+struct DedupVisitor {
+
+    json_store& from;
+    json_store& to;
+
+    DedupTable strings;
+    DedupTable lazy_strings;
+    DedupTable integers;
+    DedupTable numbers;
+    DedupTable arrays;
+    DedupTable objects;
+    DedupTable kvs;
+
+    /** Interned entries of all open containers, innermost last */
+    std::vector<JsonWrapper> entries;
+    std::vector<size_t> entry_starts;
+
+    JsonWrapper root;
+
+    DedupVisitor(json_store& _from, json_store& _to) : from {_from}, to {_to} {};
+
+    bool enter(const TraverseEntry& entry);
+    void leave(const TraverseEntry& entry);
+    void scalar(const TraverseEntry& entry);
+
+    /** Adds an interned value to its container, as a kv for object entries */
+    void add(const TraverseEntry& entry, JsonWrapper value);
+
+    JsonWrapper intern_scalar(JsonWrapper value);
+    JsonWrapper intern_container(JSON_TYPE type, const JsonWrapper* first, size_t count);
+    JsonWrapper intern_kv(const json_string& key, JsonWrapper value);
+
+    static uint64_t mix(uint64_t x){
+        x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+        x ^= x >> 31;
+        return x;
+    }
+};
+
+
+
+template<typename Equals, typename Make>
+uint32_t DedupTable::intern(uint64_t hash, Equals equals, Make make){
+
+    // Load factor stays at or below one half
+    if(2 * (count + 1) > slots.size())
+        grow();
+
+    size_t mask = slots.size() - 1;
+    for(size_t i = hash & mask; ; i = (i + 1) & mask){
+        if(slots[i] == 0){
+            uint32_t id = make();
+            slots[i] = id + 1;
+            slot_hashes[i] = hash;
+            count++;
+            return id;
+        }
+        if(slot_hashes[i] == hash && equals(slots[i] - 1))
+            return slots[i] - 1;
+    }
+}
+
+void DedupTable::grow(){
+
+    std::vector<uint32_t> old_slots = std::move(slots);
+    std::vector<uint64_t> old_hashes = std::move(slot_hashes);
+
+    size_t size = old_slots.empty() ? 64 : old_slots.size() * 2;
+    slots.assign(size, 0);
+    slot_hashes.assign(size, 0);
+
+    for(size_t i = 0; i < old_slots.size(); i++){
+        if(old_slots[i] == 0)
+            continue;
+        size_t j = old_hashes[i] & (size - 1);
+        while(slots[j] != 0)
+            j = (j + 1) & (size - 1);
+        slots[j] = old_slots[i];
+        slot_hashes[j] = old_hashes[i];
+    }
+}
+
+
+bool DedupVisitor::enter(const TraverseEntry& entry){
+    entry_starts.push_back(entries.size());
+    return true;
+}
+
+void DedupVisitor::leave(const TraverseEntry& entry){
+
+    size_t start = entry_starts.back();
+    entry_starts.pop_back();
+
+    JsonWrapper container = intern_container(entry.value.type(), entries.data() + start, entries.size() - start);
+    entries.resize(start);
+
+    add(entry, container);
+}
+
+void DedupVisitor::scalar(const TraverseEntry& entry){
+    add(entry, intern_scalar(entry.value));
+}
+
+void DedupVisitor::add(const TraverseEntry& entry, JsonWrapper value){
+
+    if(entry.key != nullptr)
+        value = intern_kv(*entry.key, value);
+
+    if(entry.depth == 0)
+        root = value;
+    else
+        entries.push_back(value);
+}
+
+JsonWrapper DedupVisitor::intern_scalar(JsonWrapper value){
+
+    if(value.is_inline())
+        return value;
+
+    switch (value.type()){
+
+    case JSON_TYPE::INTEGER:
+        {
+            json_int integer = from.get_integer(value);
+            uint32_t id = integers.intern(mix((uint64_t)integer),
+                [&](uint32_t id){ return to.integers[id] == integer; },
+                [&](){ return (uint32_t)to.new_integer(integer).store_id(); });
+            return JsonWrapper(id, JSON_TYPE::INTEGER);
+        }
+
+    case JSON_TYPE::NUMBER:
+        {
+            std::string_view text = from.get_number_text(value);
+            bool is_integer = from.numbers[value.store_id()].is_integer;
+            uint32_t id = numbers.intern(std::hash<std::string_view>{}(text),
+                [&](uint32_t id){ return to.get_number_text(JsonWrapper(id, JSON_TYPE::NUMBER)) == text; },
+                [&](){ return (uint32_t)to.new_number(text.data(), text.size(), is_integer).store_id(); });
+            return JsonWrapper(id, JSON_TYPE::NUMBER);
+        }
+
+    case JSON_TYPE::STRING:
+        if(value.is_lazy_string()){
+            // Interned by json text, so the string stays lazy and re-serializes unchanged
+            std::string_view text = from.get_string_source(value);
+            bool has_escapes = from.lazy_strings[value.store_id()].has_escapes;
+            uint32_t id = lazy_strings.intern(std::hash<std::string_view>{}(text),
+                [&](uint32_t id){ return to.get_string_source(JsonWrapper::lazy_string(id)) == text; },
+                [&](){ return (uint32_t)to.new_lazy_string(text, has_escapes).store_id(); });
+            return JsonWrapper::lazy_string(id);
+        }
+        else {
+            const std::string& str = from.strings[value.store_id()];
+            uint32_t id = strings.intern(std::hash<std::string_view>{}(str),
+                [&](uint32_t id){ return to.strings[id] == str; },
+                [&](){ return (uint32_t)to.add_string(str); });
+            return JsonWrapper(id, JSON_TYPE::STRING);
+        }
+
+    default:
+        return value;
+    }
+}
+
+JsonWrapper DedupVisitor::intern_container(JSON_TYPE type, const JsonWrapper* first, size_t count){
+
+    // Entries are interned already, so equal containers have identical entry handles
+    uint64_t hash = mix((uint64_t)type + count);
+    for(size_t i = 0; i < count; i++)
+        hash = mix(hash ^ first[i].bits);
+
+    auto same_entries = [&](const std::vector<JsonWrapper>& candidate){
+        return candidate.size() == count && std::equal(candidate.begin(), candidate.end(), first);
+    };
+
+    if(type == JSON_TYPE::ARRAY){
+        uint32_t id = arrays.intern(hash,
+            [&](uint32_t id){ return same_entries(to.arrays[id]); },
+            [&](){
+                JsonWrapper array = to.new_array();
+                to.arrays.back().assign(first, first + count);
+                return (uint32_t)array.store_id();
+            });
+        return JsonWrapper(id, JSON_TYPE::ARRAY);
+    }
+
+    uint32_t id = objects.intern(hash,
+        [&](uint32_t id){ return same_entries(to.objects[id]); },
+        [&](){
+            JsonWrapper object = to.new_object();
+            to.objects.back().assign(first, first + count);
+            return (uint32_t)object.store_id();
+        });
+    return JsonWrapper(id, JSON_TYPE::OBJECT);
+}
+
+JsonWrapper DedupVisitor::intern_kv(const json_string& key, JsonWrapper value){
+
+    uint64_t hash = mix(std::hash<std::string_view>{}(key) ^ mix(value.bits));
+
+    uint32_t id = kvs.intern(hash,
+        [&](uint32_t id){ return to.kvs[id].second == value && to.kvs[id].first == key; },
+        [&](){
+            JsonWrapper kv = to.new_kv(key);
+            to.kvs.back().second = value;
+            return (uint32_t)kv.store_id();
+        });
+    return JsonWrapper(id, JSON_TYPE::KV);
+}
+
+
+PhysonDedupReport physon_deduplicate(Physon& physon){
+
+    json_store& from = physon.store;
+
+    PhysonDedupReport report;
+    report.strings_before = from.strings.size() + from.lazy_strings.size();
+    report.numbers_before = from.integers.size() + from.numbers.size();
+    report.arrays_before = from.arrays.size();
+    report.objects_before = from.objects.size();
+    report.kvs_before = from.kvs.size();
+
+    json_store to;
+    DedupVisitor visitor (from, to);
+    json_traverse(from, physon.root_wrapper, visitor);
+
+    to.bools = std::move(from.bools);
+    to.source_text.shrink_to_fit();
+    to.arrays.shrink_to_fit();
+    to.objects.shrink_to_fit();
+    to.kvs.shrink_to_fit();
+
+    report.strings_after = to.strings.size() + to.lazy_strings.size();
+    report.numbers_after = to.integers.size() + to.numbers.size();
+    report.arrays_after = to.arrays.size();
+    report.objects_after = to.objects.size();
+    report.kvs_after = to.kvs.size();
+
+    physon.store = std::move(to);
+    physon.root_wrapper = visitor.root;
+
+    // Spans and cached text are indexed by the old store ids
+    physon.array_spans.clear();
+    physon.object_spans.clear();
+    physon.stringify_cache.clear();
+    physon.shared_subtrees = true;
+
+    return report;
+}
@@ -0,0 +1,431 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "physon.hh"
+#include "physon_types.hh"
+
+
+/**
+    Batch loading of json files.
+
+    All reads are submitted through one io_uring and each file is handed to a pool of parse workers as soon
+    as its read completes, so parsing overlaps the remaining reads. Without io_uring (old kernel, seccomp
+    filter) the workers read the files themselves with blocking reads.
+
+    Usage:
+        std::vector<PhysonLoadResult> results = physon_load_files(paths);
+        std::vector<PhysonLoadResult> configs = physon_load_files<PhysonConfigPolicy>(paths);
+ */
+
+#define PHYSON_LOADER_QUEUE_DEPTH 64            /** Max reads in flight */
+#define PHYSON_LOADER_READ_CHUNK  (1u << 30)    /** Max bytes of one read request */
+
+
+struct PhysonLoadResult {
+    std::string path;
+    /** nullptr if the file could not be read or parsed */
+    std::unique_ptr<Physon> physon;
+    std::string error;
+};
+
+/** Read state of one file */
+struct PhysonLoadFile {
+    std::string path;
+    int fd = -1;
+    std::string content;
+    size_t read_bytes = 0;
+    /** Content is complete. Otherwise the parse worker reads the file itself. */
+    bool read_done = false;
+};
+
+
+/** Minimal io_uring over the raw syscalls, for reads only */
+struct PhysonUring {
+
+    int ring_fd = -1;
+
+    unsigned* sq_tail = nullptr;
+    unsigned  sq_mask = 0;
+    unsigned* sq_array = nullptr;
+    io_uring_sqe* sqes = nullptr;
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned  cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    void*  sq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    void*  cq_ring = MAP_FAILED;
+    size_t cq_ring_size = 0;
+    size_t sqes_size = 0;
+
+    /** sqes prepared since the last submit */
+    unsigned unsubmitted = 0;
+
+    PhysonUring() = default;
+    ~PhysonUring();
+
+    PhysonUring(const PhysonUring&) = delete;
+    PhysonUring& operator=(const PhysonUring&) = delete;
+
+    /** Returns false if io_uring is not available */
+    bool open(unsigned entries);
+    void prepare_read(int fd, char* buffer, unsigned length, uint64_t offset, uint64_t user_data);
+    /** Submits the prepared reads and waits for at least one completion */
+    void submit_and_wait();
+    /** Calls on_completion(user_data, result) for every completed read. Returns the number of completions. */
+    template<typename Callback>
+    unsigned reap(Callback on_completion);
+};
+
+
+/** Indices of files ready for a parse worker */
+struct PhysonLoadQueue {
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<size_t> indices;
+    bool closed = false;
+
+    void push(size_t index);
+    /** No more pushes. Workers return once the queue is empty. */
+    void close();
+    /** Blocks until an index is available. Returns false when closed and empty. */
+    bool pop(size_t& index);
+};
+
+
+/**
+    Read and parse every file of paths. Results are in the order of paths.
+    workers is the number of parse threads, 0 for one per hardware thread.
+    A failed file only sets the error of its result.
+ */
+template<typename Policy = PhysonStrictPolicy>
+std::vector<PhysonLoadResult> physon_load_files(const std::vector<std::string>& paths, unsigned workers = 0);
+
+/** Blocking read of a whole file */
+std::string physon_read_file(const std::string& path);
+/** Submits the reads of files through uring, pushing each file to queue when complete */
+void physon_uring_read_files(PhysonUring& uring, std::vector<PhysonLoadFile>& files, PhysonLoadQueue& queue);
+
+
+
+PhysonUring::~PhysonUring(){
+    if(sqes != nullptr)
+        munmap(sqes, sqes_size);
+    if(cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if(sq_ring != MAP_FAILED)
+        munmap(sq_ring, sq_ring_size);
+    if(ring_fd >= 0)
+        close(ring_fd);
+}
+
+bool PhysonUring::open(unsigned entries){
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(ring_fd < 0)
+        return false;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    // Both rings share one mapping on kernels with IORING_FEAT_SINGLE_MMAP
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if(sq_ring == MAP_FAILED)
+        return false;
+
+    cq_ring = single_mmap ? sq_ring
+                          : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if(cq_ring == MAP_FAILED)
+        return false;
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if(sqes_map == MAP_FAILED)
+        return false;
+    sqes = static_cast<io_uring_sqe*>(sqes_map);
+
+    char* sq = static_cast<char*>(sq_ring);
+    sq_tail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask  = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    char* cq = static_cast<char*>(cq_ring);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes    = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+void PhysonUring::prepare_read(int fd, char* buffer, unsigned length, uint64_t offset, uint64_t user_data){
+
+    // Only this thread writes the sq tail
+    unsigned tail = *sq_tail;
+    unsigned index = tail & sq_mask;
+
+    io_uring_sqe& sqe = sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = length;
+    sqe.off = offset;
+    sqe.user_data = user_data;
+
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    unsubmitted++;
+}
+
+void PhysonUring::submit_and_wait(){
+
+    while(true){
+        int result = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(result >= 0){
+            unsubmitted -= std::min((unsigned)result, unsubmitted);
+            if(unsubmitted == 0)
+                return;
+            continue;
+        }
+        if(errno != EINTR)
+            throw std::runtime_error("Loader: io_uring_enter failed : " + std::string(std::strerror(errno)));
+    }
+}
+
+template<typename Callback>
+unsigned PhysonUring::reap(Callback on_completion){
+
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    unsigned count = tail - head;
+
+    for(; head != tail; head++){
+        io_uring_cqe& cqe = cqes[head & cq_mask];
+        on_completion(cqe.user_data, cqe.res);
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+
+void PhysonLoadQueue::push(size_t index){
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        indices.push_back(index);
+    }
+    ready.notify_one();
+}
+
+void PhysonLoadQueue::close(){
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        closed = true;
+    }
+    ready.notify_all();
+}
+
+bool PhysonLoadQueue::pop(size_t& index){
+    std::unique_lock<std::mutex> lock (mutex);
+    ready.wait(lock, [&]{ return closed || !indices.empty(); });
+    if(indices.empty())
+        return false;
+    index = indices.front();
+    indices.pop_front();
+    return true;
+}
+
+
+std::string physon_read_file(const std::string& path){
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        throw std::runtime_error("Loader: failed to open " + path + " : " + std::strerror(errno));
+
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0){
+        close(fd);
+        throw std::runtime_error("Loader: failed to stat " + path);
+    }
+
+    std::string content (file_stat.st_size, '\0');
+    size_t read_bytes = 0;
+    while(read_bytes < content.size()){
+        ssize_t length = read(fd, &content[read_bytes], content.size() - read_bytes);
+        if(length < 0 && errno == EINTR)
+            continue;
+        if(length < 0){
+            close(fd);
+            throw std::runtime_error("Loader: failed to read " + path + " : " + std::strerror(errno));
+        }
+        if(length == 0)
+            break;
+        read_bytes += length;
+    }
+    content.resize(read_bytes);
+
+    close(fd);
+    return content;
+}
+
+void physon_uring_read_files(PhysonUring& uring, std::vector<PhysonLoadFile>& files, PhysonLoadQueue& queue){
+
+    // Closes the file and passes it on. Failed reads are retried by the worker with a blocking read, which reports the error.
+    auto finish = [&](size_t index, bool read_done){
+        PhysonLoadFile& file = files[index];
+        if(file.fd >= 0)
+            close(file.fd);
+        file.fd = -1;
+        file.read_done = read_done;
+        if(read_done)
+            file.content.resize(file.read_bytes);
+        queue.push(index);
+    };
+
+    auto prepare = [&](size_t index){
+        PhysonLoadFile& file = files[index];
+        size_t length = std::min(file.content.size() - file.read_bytes, (size_t)PHYSON_LOADER_READ_CHUNK);
+        uring.prepare_read(file.fd, &file.content[file.read_bytes], length, file.read_bytes, index);
+    };
+
+    size_t next = 0;
+    unsigned in_flight = 0;
+    // Partially read files waiting for their next chunk
+    std::vector<size_t> continued;
+
+    while(next < files.size() || in_flight > 0){
+
+        for(size_t index : continued)
+            prepare(index);
+        in_flight += continued.size();
+        continued.clear();
+
+        while(next < files.size() && in_flight < PHYSON_LOADER_QUEUE_DEPTH){
+            size_t index = next++;
+            PhysonLoadFile& file = files[index];
+
+            file.fd = ::open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat file_stat;
+            if(file.fd < 0 || fstat(file.fd, &file_stat) != 0){
+                finish(index, false);
+                continue;
+            }
+            if(file_stat.st_size == 0){
+                finish(index, true);
+                continue;
+            }
+
+            file.content.resize(file_stat.st_size);
+            prepare(index);
+            in_flight++;
+        }
+
+        if(in_flight == 0)
+            continue;
+
+        uring.submit_and_wait();
+
+        in_flight -= uring.reap([&](uint64_t index, int result){
+            PhysonLoadFile& file = files[index];
+            if(result < 0){
+                finish(index, false);
+                return;
+            }
+            file.read_bytes += result;
+            // A short file ends the read early
+            if(result == 0 || file.read_bytes == file.content.size())
+                finish(index, true);
+            else
+                continued.push_back(index);
+        });
+    }
+}
+
+
+template<typename Policy>
+std::vector<PhysonLoadResult> physon_load_files(const std::vector<std::string>& paths, unsigned workers){
+
+    std::vector<PhysonLoadResult> results (paths.size());
+    std::vector<PhysonLoadFile> files (paths.size());
+    for(size_t i = 0; i < paths.size(); i++){
+        results[i].path = paths[i];
+        files[i].path = paths[i];
+    }
+
+    PhysonLoadQueue queue;
+
+    auto parse_worker = [&](){
+        size_t index;
+        while(queue.pop(index)){
+            PhysonLoadFile& file = files[index];
+            try {
+                if(!file.read_done)
+                    file.content = physon_read_file(file.path);
+                std::unique_ptr<Physon> physon = std::make_unique<Physon>(std::move(file.content));
+                physon->template parse<Policy>();
+                results[index].physon = std::move(physon);
+            }
+            catch(const std::exception& error) {
+                results[index].error = error.what();
+            }
+        }
+    };
+
+    if(workers == 0)
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for(unsigned i = 0; i < workers; i++)
+        threads.emplace_back(parse_worker);
+
+    // Without io_uring every file goes to the workers unread
+    PhysonUring uring;
+    try {
+        if(uring.open(PHYSON_LOADER_QUEUE_DEPTH))
+            physon_uring_read_files(uring, files, queue);
+        else
+            for(size_t i = 0; i < files.size(); i++)
+                queue.push(i);
+    }
+    catch(...) {
+        queue.close();
+        for(std::thread& thread : threads)
+            thread.join();
+        throw;
+    }
+
+    queue.close();
+    for(std::thread& thread : threads)
+        thread.join();
+
+    return results;
+}
@@ -0,0 +1,407 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+
+#include "physon.hh"
+#include "physon_types.hh"
+#include "physon_traverse.hh"
+
+
+/**
+    MessagePack encoding and decoding directly between bytes and a json_store.
+
+    MessagePack has no standard typed array format, so number arrays are written element by element.
+    Container entry vectors are reserved from the encoded length before decoding the entries.
+ */
+
+#define PHYSON_MSGPACK_MAX_DEPTH 1024
+
+
+/** Encode value and its subtree. */
+std::string msgpack_encode(json_store& store, JsonWrapper value);
+std::string msgpack_encode(Physon& physon);
+
+/** Decode a single MessagePack item into store. Returns the wrapper of the decoded root value. */
+JsonWrapper msgpack_decode(std::string_view bytes, json_store& store);
+/** Replace the physon document, store, content and spans, by bytes decoded as the new root value. */
+void msgpack_decode(Physon& physon, std::string_view bytes);
+
+
+
+struct MsgpackEncoder {
+
+    json_store& store;
+    std::string buffer;
+
+    MsgpackEncoder(json_store& _store) : store {_store} {};
+
+    void write_be(uint64_t value, int byte_count);
+    /** Writes the smallest of the fix / 16 / 32 bit header variants */
+    void write_length(size_t length, uint8_t fix_prefix, size_t fix_max, uint8_t prefix_8, uint8_t prefix_16, uint8_t prefix_32);
+    void write_integer(json_int int_);
+    void write_string(std::string_view str);
+    void write_scalar(JsonWrapper value);
+    /** Writes value and its subtree with json_traverse() */
+    void write_value(JsonWrapper value);
+
+    // json_traverse() visitor
+    bool enter(const TraverseEntry& entry);
+    void leave(const TraverseEntry& entry) {};
+    void scalar(const TraverseEntry& entry);
+};
+
+
+struct MsgpackDecoder {
+
+    json_store& store;
+    const uint8_t* c;
+    const uint8_t* end;
+    int depth = 0;
+
+    MsgpackDecoder(json_store& _store, std::string_view bytes)
+        : store {_store}, c {reinterpret_cast<const uint8_t*>(bytes.data())}, end {c + bytes.size()} {};
+
+    uint8_t read_byte();
+    uint64_t read_be(int byte_count);
+    std::string read_string(size_t length);
+    /** Reads a str-family item. Used for map keys. */
+    std::string read_key();
+    JsonWrapper read_unsigned(uint64_t value);
+    JsonWrapper read_array(size_t count);
+    JsonWrapper read_map(size_t count);
+    JsonWrapper read_value();
+
+    void msgpack_error(std::string error_msg);
+};
+
+
+
+void MsgpackEncoder::write_be(uint64_t value, int byte_count){
+    for(int i = byte_count - 1; i >= 0; i--)
+        buffer.push_back((char)(value >> (8 * i)));
+}
+
+void MsgpackEncoder::write_length(size_t length, uint8_t fix_prefix, size_t fix_max, uint8_t prefix_8, uint8_t prefix_16, uint8_t prefix_32){
+
+    if(length <= fix_max){
+        buffer.push_back((char)(fix_prefix | length));
+    }
+    else if(prefix_8 != 0 && length <= 0xFF){
+        buffer.push_back((char)prefix_8);
+        write_be(length, 1);
+    }
+    else if(length <= 0xFFFF){
+        buffer.push_back((char)prefix_16);
+        write_be(length, 2);
+    }
+    else if(length <= 0xFFFFFFFF){
+        buffer.push_back((char)prefix_32);
+        write_be(length, 4);
+    }
+    else {
+        throw std::runtime_error("MessagePack encode: length exceeds 32 bits.");
+    }
+}
+
+void MsgpackEncoder::write_integer(json_int int_){
+
+    if(int_ >= 0){
+        if(int_ <= 0x7F)
+            buffer.push_back((char)int_);
+        else if(int_ <= 0xFF)
+            { buffer.push_back((char)0xCC); write_be(int_, 1); }
+        else if(int_ <= 0xFFFF)
+            { buffer.push_back((char)0xCD); write_be(int_, 2); }
+        else if(int_ <= 0xFFFFFFFF)
+            { buffer.push_back((char)0xCE); write_be(int_, 4); }
+        else
+            { buffer.push_back((char)0xCF); write_be(int_, 8); }
+    }
+    else {
+        if(int_ >= -32)
+            buffer.push_back((char)int_);
+        else if(int_ >= INT8_MIN)
+            { buffer.push_back((char)0xD0); write_be(int_, 1); }
+        else if(int_ >= INT16_MIN)
+            { buffer.push_back((char)0xD1); write_be(int_, 2); }
+        else if(int_ >= INT32_MIN)
+            { buffer.push_back((char)0xD2); write_be(int_, 4); }
+        else
+            { buffer.push_back((char)0xD3); write_be(int_, 8); }
+    }
+}
+
+void MsgpackEncoder::write_string(std::string_view str){
+    write_length(str.size(), 0xA0, 31, 0xD9, 0xDA, 0xDB);
+    buffer.append(str);
+}
+
+void MsgpackEncoder::write_scalar(JsonWrapper value){
+
+    // Undecoded numbers are written as the integer or float they spell
+    switch (store.value_type(value)){
+
+    case JSON_TYPE::NULL_:
+        buffer.push_back((char)0xC0);
+        break;
+    case JSON_TYPE::FALSE:
+        buffer.push_back((char)0xC2);
+        break;
+    case JSON_TYPE::TRUE:
+        buffer.push_back((char)0xC3);
+        break;
+
+    case JSON_TYPE::INTEGER:
+        write_integer(store.get_integer(value));
+        break;
+    case JSON_TYPE::FLOAT:
+        buffer.push_back((char)0xCB);
+        write_be(JsonWrapper::from_float(store.get_float(value)).bits, 8);
+        break;
+
+    case JSON_TYPE::STRING:
+        write_string(store.get_string_view(value));
+        break;
+
+    default:
+        throw std::runtime_error("MessagePack encode: wrapper type has no json representation.");
+    }
+}
+
+bool MsgpackEncoder::enter(const TraverseEntry& entry){
+
+    if(entry.key != nullptr)
+        write_string(*entry.key);
+
+    if(entry.value.type() == JSON_TYPE::ARRAY)
+        write_length(store.get_array(entry.value.store_id()).size(), 0x90, 15, 0, 0xDC, 0xDD);
+    else
+        write_length(store.get_object(entry.value.store_id()).size(), 0x80, 15, 0, 0xDE, 0xDF);
+
+    return true;
+}
+
+void MsgpackEncoder::scalar(const TraverseEntry& entry){
+    if(entry.key != nullptr)
+        write_string(*entry.key);
+    write_scalar(entry.value);
+}
+
+void MsgpackEncoder::write_value(JsonWrapper value){
+    if(value.type() == JSON_TYPE::KV)
+        throw std::runtime_error("MessagePack encode: wrapper type has no json representation.");
+    json_traverse(store, value, *this);
+}
+
+
+
+void MsgpackDecoder::msgpack_error(std::string error_msg){
+    throw std::runtime_error("MessagePack decode: " + error_msg);
+}
+
+uint8_t MsgpackDecoder::read_byte(){
+    if(c >= end)
+        msgpack_error("Unexpected end of input.");
+    return *c++;
+}
+
+uint64_t MsgpackDecoder::read_be(int byte_count){
+    if(end - c < byte_count)
+        msgpack_error("Unexpected end of input.");
+
+    uint64_t value = 0;
+    for(int i = 0; i < byte_count; i++)
+        value = (value << 8) | *c++;
+
+    return value;
+}
+
+std::string MsgpackDecoder::read_string(size_t length){
+    if((size_t)(end - c) < length)
+        msgpack_error("String runs past end of input.");
+
+    std::string str (reinterpret_cast<const char*>(c), length);
+    c += length;
+    return str;
+}
+
+std::string MsgpackDecoder::read_key(){
+
+    uint8_t initial = read_byte();
+
+    if(initial >= 0xA0 && initial <= 0xBF)
+        return read_string(initial & 0x1F);
+    if(initial == 0xD9)
+        return read_string(read_be(1));
+    if(initial == 0xDA)
+        return read_string(read_be(2));
+    if(initial == 0xDB)
+        return read_string(read_be(4));
+
+    msgpack_error("Map keys must be strings.");
+    return "";
+}
+
+JsonWrapper MsgpackDecoder::read_unsigned(uint64_t value){
+    if(value > (uint64_t)LLONG_MAX)
+        msgpack_error("Integer too large for internal representation.");
+    return store.new_integer((json_int)value);
+}
+
+JsonWrapper MsgpackDecoder::read_array(size_t count){
+
+    if(++depth > PHYSON_MSGPACK_MAX_DEPTH)
+        msgpack_error("Maximum nesting depth exceeded.");
+    // Every entry takes at least one byte
+    if((size_t)(end - c) < count)
+        msgpack_error("Array length runs past end of input.");
+
+    JsonWrapper array_wrapper = store.new_array();
+    store.get_array(array_wrapper.store_id()).reserve(count);
+
+    for(size_t i = 0; i < count; i++){
+        JsonWrapper entry = read_value();
+        store.get_array(array_wrapper.store_id()).push_back(entry);
+    }
+
+    depth--;
+    return array_wrapper;
+}
+
+JsonWrapper MsgpackDecoder::read_map(size_t count){
+
+    if(++depth > PHYSON_MSGPACK_MAX_DEPTH)
+        msgpack_error("Maximum nesting depth exceeded.");
+    // Every pair takes at least two bytes
+    if((size_t)(end - c) / 2 < count)
+        msgpack_error("Map length runs past end of input.");
+
+    JsonWrapper object_wrapper = store.new_object();
+    store.get_object(object_wrapper.store_id()).reserve(count);
+
+    for(size_t i = 0; i < count; i++){
+        JsonWrapper kv = store.new_kv(read_key());
+        JsonWrapper kv_value = read_value();
+        store.get_kv(kv.store_id()).second = kv_value;
+        store.get_object(object_wrapper.store_id()).push_back(kv);
+    }
+
+    depth--;
+    return object_wrapper;
+}
+
+JsonWrapper MsgpackDecoder::read_value(){
+
+    uint8_t initial = read_byte();
+
+    // Fix families
+    if(initial <= 0x7F)
+        return store.new_integer(initial);
+    if(initial >= 0xE0)
+        return store.new_integer((int8_t)initial);
+    if(initial >= 0x80 && initial <= 0x8F)
+        return read_map(initial & 0x0F);
+    if(initial >= 0x90 && initial <= 0x9F)
+        return read_array(initial & 0x0F);
+    if(initial >= 0xA0 && initial <= 0xBF){
+        c--;
+        return JsonWrapper(store.add_string(read_key()), JSON_TYPE::STRING);
+    }
+
+    switch (initial){
+
+    case 0xC0:
+        return JsonWrapper(JSON_TYPE::NULL_);
+    case 0xC2:
+        return JsonWrapper(JSON_TYPE::FALSE);
+    case 0xC3:
+        return JsonWrapper(JSON_TYPE::TRUE);
+
+    case 0xCA:
+        {
+            uint32_t bits = read_be(4);
+            float single;
+            std::memcpy(&single, &bits, sizeof(single));
+            return store.new_float(single);
+        }
+    case 0xCB:
+        {
+            uint64_t bits = read_be(8);
+            json_float double_;
+            std::memcpy(&double_, &bits, sizeof(double_));
+            return store.new_float(double_);
+        }
+
+    case 0xCC: return read_unsigned(read_be(1));
+    case 0xCD: return read_unsigned(read_be(2));
+    case 0xCE: return read_unsigned(read_be(4));
+    case 0xCF: return read_unsigned(read_be(8));
+
+    case 0xD0: return store.new_integer((int8_t)read_be(1));
+    case 0xD1: return store.new_integer((int16_t)read_be(2));
+    case 0xD2: return store.new_integer((int32_t)read_be(4));
+    case 0xD3: return store.new_integer((int64_t)read_be(8));
+
+    case 0xD9:
+    case 0xDA:
+    case 0xDB:
+        {
+            c--;
+            return JsonWrapper(store.add_string(read_key()), JSON_TYPE::STRING);
+        }
+
+    case 0xDC: return read_array(read_be(2));
+    case 0xDD: return read_array(read_be(4));
+    case 0xDE: return read_map(read_be(2));
+    case 0xDF: return read_map(read_be(4));
+
+    default:
+        msgpack_error("Type byte " + std::to_string(initial) + " has no json representation.");
+    }
+
+    return JsonWrapper();
+}
+
+
+
+std::string msgpack_encode(json_store& store, JsonWrapper value){
+    MsgpackEncoder encoder (store);
+    encoder.write_value(value);
+    return encoder.buffer;
+}
+
+std::string msgpack_encode(Physon& physon){
+    return msgpack_encode(physon.store, physon.root_wrapper);
+}
+
+JsonWrapper msgpack_decode(std::string_view bytes, json_store& store){
+    MsgpackDecoder decoder (store, bytes);
+
+    JsonWrapper root = decoder.read_value();
+
+    if(decoder.c != decoder.end)
+        decoder.msgpack_error("Extra bytes after root item.");
+
+    return root;
+}
+
+void msgpack_decode(Physon& physon, std::string_view bytes){
+    physon.store.clear();
+    physon.tokens.clear();
+    physon.stringify_cache.clear();
+    physon.shared_subtrees = false;
+    physon.budget_charged = false;
+    // The store no longer comes from content, so there is no text left for reparse() to edit
+    physon.content.clear();
+    physon.cursor.index = 0;
+    physon.array_spans.clear();
+    physon.object_spans.clear();
+    physon.root_wrapper = JsonWrapper();
+    physon.root_wrapper = msgpack_decode(bytes, physon.store);
+}
@@ -0,0 +1,654 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <charconv> // to_chars
+
+#include "physon.hh"
+#include "physon_types.hh"
+#include "physon_traverse.hh"
+
+
+/**
+    Structural diff between two documents as RFC 6902 JSON Patch, and in-place patch application.
+
+    Subtrees are compared by memoized 64-bit hashes, and a matching hash is confirmed by json_equal() before a subtree
+    is skipped, so a collision cannot hide a change. Patch values are written with round-trip float text.
+    Arrays are aligned by trimming the common prefix and suffix, followed by a longest common subsequence
+    of element hashes for the remaining middle. Unmatched element pairs at the same position are diffed recursively.
+ */
+
+/** Max number of LCS table cells for one array. Larger middles are diffed index by index. */
+#define PHYSON_DIFF_MAX_LCS_CELLS (1 << 22)
+/** Max container nesting diffed entry by entry. Deeper changed subtrees are replaced as a whole. */
+#define PHYSON_DIFF_MAX_DEPTH 1024
+
+
+/** Returns a JSON Patch document that turns from into to. */
+std::string json_diff(Physon& from, Physon& to);
+
+/**
+    Apply a parsed JSON Patch document to document in place, using the Physon mutation API.
+    Throws on the first failing operation; operations before it stay applied.
+ */
+void json_patch_apply(Physon& document, Physon& patch);
+
+
+
+/** Memoized subtree hashes of one store. Object hashes ignore key order, matching json_equal(). */
+struct SubtreeHasher {
+
+    json_store& store;
+    std::vector<uint64_t> array_hashes;
+    std::vector<uint64_t> object_hashes;
+    std::vector<bool> array_hashed;
+    std::vector<bool> object_hashed;
+
+    SubtreeHasher(json_store& _store) : store {_store} {
+        array_hashes.resize(store.arrays.size());
+        array_hashed.resize(store.arrays.size(), false);
+        object_hashes.resize(store.objects.size());
+        object_hashed.resize(store.objects.size(), false);
+    };
+
+    uint64_t mix(uint64_t x){
+        x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    /** Hashes the unhashed containers of value's subtree bottom-up with json_traverse() */
+    uint64_t hash(JsonWrapper value);
+    /** Hash of a scalar or an already hashed container */
+    uint64_t entry_hash(JsonWrapper value);
+
+    // json_traverse() visitor
+    bool enter(const TraverseEntry& entry);
+    void leave(const TraverseEntry& entry);
+    void scalar(const TraverseEntry& entry) {};
+};
+
+
+/** json_traverse() visitor appending a patch value. Floats are written as the shortest text that parses back to the same double. */
+struct PatchValueVisitor {
+
+    Physon& physon;
+    std::string& out;
+
+    PatchValueVisitor(Physon& _physon, std::string& _out) : physon {_physon}, out {_out} {};
+
+    void append_separator(const TraverseEntry& entry){
+        if(entry.depth > 0 && entry.index > 0)
+            out.append(", ");
+        if(entry.key != nullptr){
+            out.append(physon.string_to_json_representation(*entry.key));
+            out.append(": ");
+        }
+    }
+    bool enter(const TraverseEntry& entry){
+        append_separator(entry);
+        out.push_back(entry.value.type() == JSON_TYPE::ARRAY ? '[' : '{');
+        return true;
+    }
+    void leave(const TraverseEntry& entry){
+        out.push_back(entry.value.type() == JSON_TYPE::ARRAY ? ']' : '}');
+    }
+    void scalar(const TraverseEntry& entry);
+};
+
+
+struct JsonDiff {
+
+    Physon& from;
+    Physon& to;
+    SubtreeHasher from_hasher;
+    SubtreeHasher to_hasher;
+
+    /** Patch document being built */
+    std::string patch;
+    /** Nesting of the container pair being diffed */
+    int depth = 0;
+
+    JsonDiff(Physon& _from, Physon& _to)
+        : from {_from}, to {_to}, from_hasher {_from.store}, to_hasher {_to.store} {};
+
+    /** Escapes '~' and '/' of a key as JSON Pointer reference token */
+    std::string pointer_token(const std::string& key);
+    void add_op(const char* op, const std::string& path, JsonWrapper to_value);
+    void diff_value(JsonWrapper from_value, JsonWrapper to_value, const std::string& path);
+    void diff_object(JsonWrapper from_object, JsonWrapper to_object, const std::string& path);
+    void diff_array(JsonWrapper from_array, JsonWrapper to_array, const std::string& path);
+};
+
+
+struct JsonPatcher {
+
+    Physon& document;
+    Physon& patch;
+
+    JsonPatcher(Physon& _document, Physon& _patch) : document {_document}, patch {_patch} {};
+
+    /** Splits a JSON Pointer into unescaped reference tokens */
+    std::vector<std::string> split_pointer(const std::string& pointer);
+    /** Array index of token. "-" resolves to size when allow_end is set. */
+    size_t array_index(const std::string& token, size_t size, bool allow_end);
+    JsonWrapper resolve(const std::vector<std::string>& tokens, size_t token_count);
+    JsonWrapper get(const std::string& pointer);
+    void add(const std::string& pointer, JsonWrapper value);
+    JsonWrapper remove(const std::string& pointer);
+    void replace(const std::string& pointer, JsonWrapper value);
+    void apply_operation(JsonWrapper operation);
+
+    void patch_error(std::string error_msg);
+};
+
+
+
+uint64_t SubtreeHasher::hash(JsonWrapper value){
+
+    if(value.type() == JSON_TYPE::ARRAY && !array_hashed[value.store_id()])
+        json_traverse(store, value, *this);
+    else if(value.type() == JSON_TYPE::OBJECT && !object_hashed[value.store_id()])
+        json_traverse(store, value, *this);
+
+    return entry_hash(value);
+}
+
+uint64_t SubtreeHasher::entry_hash(JsonWrapper value){
+
+    // Undecoded numbers hash as their value
+    JSON_TYPE type = store.value_type(value);
+    uint64_t type_seed = mix((uint64_t)type + 1);
+
+    switch (type){
+
+    case JSON_TYPE::INTEGER:
+        return mix(type_seed ^ (uint64_t)store.get_integer(value));
+    case JSON_TYPE::FLOAT:
+        // Float handles are the canonical double bits
+        return mix(type_seed ^ JsonWrapper::from_float(store.get_float(value)).bits);
+    case JSON_TYPE::STRING:
+        return mix(type_seed ^ std::hash<std::string_view>{}(store.get_string_view(value)));
+    case JSON_TYPE::ARRAY:
+        return array_hashes[value.store_id()];
+    case JSON_TYPE::OBJECT:
+        return object_hashes[value.store_id()];
+    default:
+        return type_seed;
+    }
+}
+
+bool SubtreeHasher::enter(const TraverseEntry& entry){
+    if(entry.value.type() == JSON_TYPE::ARRAY)
+        return !array_hashed[entry.value.store_id()];
+    return !object_hashed[entry.value.store_id()];
+}
+
+void SubtreeHasher::leave(const TraverseEntry& entry){
+
+    JsonWrapper value = entry.value;
+    uint64_t type_seed = mix((uint64_t)value.type() + 1);
+
+    // Every entry is a scalar or an already hashed container at this point
+    if(value.type() == JSON_TYPE::ARRAY){
+
+        uint64_t array_hash = type_seed;
+        for(JsonWrapper array_entry : store.get_array(value.store_id()))
+            array_hash = mix(array_hash ^ entry_hash(array_entry));
+
+        array_hashes[value.store_id()] = array_hash;
+        array_hashed[value.store_id()] = true;
+    }
+    else {
+        // Sum of kv hashes : independent of key order
+        uint64_t object_hash = type_seed;
+        for(JsonWrapper kv_wrapper : store.get_object(value.store_id())){
+            json_kv_wrap& kv = store.get_kv(kv_wrapper.store_id());
+            object_hash += mix(std::hash<std::string>{}(kv.first) ^ entry_hash(kv.second));
+        }
+        object_hash = mix(object_hash);
+
+        object_hashes[value.store_id()] = object_hash;
+        object_hashed[value.store_id()] = true;
+    }
+}
+
+
+
+void PatchValueVisitor::scalar(const TraverseEntry& entry){
+
+    append_separator(entry);
+
+    if(entry.value.type() != JSON_TYPE::FLOAT){
+        physon.stringify_string.clear();
+        physon.build_scalar_string(entry.value);
+        out.append(physon.stringify_string);
+        return;
+    }
+
+    char digits[32];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), physon.store.get_float(entry.value));
+    out.append(digits, result.ptr);
+    // Integral floats, e.g. "5", would read back as integers
+    if(std::find_if(digits, result.ptr, [](char ch){ return ch == '.' || ch == 'e'; }) == result.ptr)
+        out.append(".0");
+}
+
+std::string JsonDiff::pointer_token(const std::string& key){
+    std::string token;
+    for(char ch : key){
+        if(ch == '~')
+            token += "~0";
+        else if(ch == '/')
+            token += "~1";
+        else
+            token += ch;
+    }
+    return token;
+}
+
+void JsonDiff::add_op(const char* op, const std::string& path, JsonWrapper to_value){
+
+    if(patch.size() > 1)
+        patch += ", ";
+
+    patch += "{\"op\": \"";
+    patch += op;
+    patch += "\", \"path\": ";
+    patch += to.string_to_json_representation(path);
+
+    // Not stringify() : its 7 digit floats would not rebuild the target
+    if(to_value.type() != JSON_TYPE::NONE){
+        patch += ", \"value\": ";
+        PatchValueVisitor visitor (to, patch);
+        json_traverse(to.store, to_value, visitor, to.stringify_max_depth);
+    }
+
+    patch += "}";
+}
+
+void JsonDiff::diff_value(JsonWrapper from_value, JsonWrapper to_value, const std::string& path){
+
+    // Lazy numbers compare by value with decoded ones. Equal hashes are only a hint until json_equal() agrees.
+    if(from.store.value_type(from_value) == to.store.value_type(to_value)
+       && from_hasher.hash(from_value) == to_hasher.hash(to_value)
+       && json_equal(from.store, from_value, to.store, to_value))
+        return;
+
+    if(depth >= PHYSON_DIFF_MAX_DEPTH){
+        add_op("replace", path, to_value);
+        return;
+    }
+
+    depth++;
+    if(from_value.type() == JSON_TYPE::OBJECT && to_value.type() == JSON_TYPE::OBJECT)
+        diff_object(from_value, to_value, path);
+    else if(from_value.type() == JSON_TYPE::ARRAY && to_value.type() == JSON_TYPE::ARRAY)
+        diff_array(from_value, to_value, path);
+    else
+        add_op("replace", path, to_value);
+    depth--;
+}
+
+void JsonDiff::diff_object(JsonWrapper from_object, JsonWrapper to_object, const std::string& path){
+
+    json_object_wrap& from_kvs = from.store.get_object(from_object.store_id());
+    json_object_wrap& to_kvs = to.store.get_object(to_object.store_id());
+
+    std::unordered_map<std::string_view, JsonWrapper> to_values;
+    to_values.reserve(to_kvs.size());
+    for(JsonWrapper kv_wrapper : to_kvs){
+        json_kv_wrap& kv = to.store.get_kv(kv_wrapper.store_id());
+        to_values[kv.first] = kv.second;
+    }
+
+    std::unordered_map<std::string_view, bool> from_keys;
+    from_keys.reserve(from_kvs.size());
+
+    for(JsonWrapper kv_wrapper : from_kvs){
+        json_kv_wrap& kv = from.store.get_kv(kv_wrapper.store_id());
+        from_keys[kv.first] = true;
+
+        std::string key_path = path + "/" + pointer_token(kv.first);
+
+        auto to_value = to_values.find(kv.first);
+        if(to_value == to_values.end())
+            add_op("remove", key_path, JsonWrapper());
+        else
+            diff_value(kv.second, to_value->second, key_path);
+    }
+
+    for(JsonWrapper kv_wrapper : to_kvs){
+        json_kv_wrap& kv = to.store.get_kv(kv_wrapper.store_id());
+        if(from_keys.count(kv.first) == 0)
+            add_op("add", path + "/" + pointer_token(kv.first), kv.second);
+    }
+}
+
+void JsonDiff::diff_array(JsonWrapper from_array, JsonWrapper to_array, const std::string& path){
+
+    json_array_wrap& a = from.store.get_array(from_array.store_id());
+    json_array_wrap& b = to.store.get_array(to_array.store_id());
+
+    std::vector<uint64_t> a_hashes (a.size());
+    std::vector<uint64_t> b_hashes (b.size());
+    for(size_t i = 0; i < a.size(); i++)
+        a_hashes[i] = from_hasher.hash(a[i]);
+    for(size_t i = 0; i < b.size(); i++)
+        b_hashes[i] = to_hasher.hash(b[i]);
+
+    // Common prefix and suffix, skipped without a diff, so each pair is confirmed by json_equal()
+    auto same = [&](size_t a_index, size_t b_index){
+        return a_hashes[a_index] == b_hashes[b_index] && json_equal(from.store, a[a_index], to.store, b[b_index]);
+    };
+
+    size_t prefix = 0;
+    while(prefix < a.size() && prefix < b.size() && same(prefix, prefix))
+        prefix++;
+
+    size_t suffix = 0;
+    while(suffix < a.size() - prefix && suffix < b.size() - prefix && same(a.size() - 1 - suffix, b.size() - 1 - suffix))
+        suffix++;
+
+    size_t n = a.size() - prefix - suffix;
+    size_t m = b.size() - prefix - suffix;
+
+    // lcs[i][j] : LCS length of middle a[i..] and b[j..]
+    bool use_lcs = n > 0 && m > 0 && (n + 1) * (m + 1) <= PHYSON_DIFF_MAX_LCS_CELLS;
+    std::vector<uint32_t> lcs;
+    auto cell = [&](size_t i, size_t j) -> uint32_t& { return lcs[i * (m + 1) + j]; };
+
+    if(use_lcs){
+        lcs.assign((n + 1) * (m + 1), 0);
+        for(size_t i = n; i-- > 0; ){
+            for(size_t j = m; j-- > 0; ){
+                if(a_hashes[prefix + i] == b_hashes[prefix + j])
+                    cell(i, j) = cell(i + 1, j + 1) + 1;
+                else
+                    cell(i, j) = std::max(cell(i + 1, j), cell(i, j + 1));
+            }
+        }
+    }
+
+    // Index into the array as it looks after the operations emitted so far
+    size_t index = prefix;
+    size_t i = 0;
+    size_t j = 0;
+
+    while(i < n && j < m){
+
+        bool match = a_hashes[prefix + i] == b_hashes[prefix + j];
+        bool pair = !use_lcs || cell(i + 1, j + 1) == cell(i, j);
+
+        if(match || pair){
+            // Matched or modified in place
+            diff_value(a[prefix + i], b[prefix + j], path + "/" + std::to_string(index));
+            index++;
+            i++;
+            j++;
+        }
+        else if(cell(i + 1, j) >= cell(i, j + 1)){
+            add_op("remove", path + "/" + std::to_string(index), JsonWrapper());
+            i++;
+        }
+        else {
+            add_op("add", path + "/" + std::to_string(index), b[prefix + j]);
+            index++;
+            j++;
+        }
+    }
+
+    for( ; i < n; i++)
+        add_op("remove", path + "/" + std::to_string(index), JsonWrapper());
+
+    for( ; j < m; j++){
+        add_op("add", path + "/" + std::to_string(index), b[prefix + j]);
+        index++;
+    }
+}
+
+
+
+void JsonPatcher::patch_error(std::string error_msg){
+    throw std::runtime_error("JSON Patch: " + error_msg);
+}
+
+std::vector<std::string> JsonPatcher::split_pointer(const std::string& pointer){
+
+    std::vector<std::string> tokens;
+    if(pointer.empty())
+        return tokens;
+
+    if(pointer[0] != '/')
+        patch_error("Pointer must start with '/': " + pointer);
+
+    for(size_t i = 0; i < pointer.size(); i++){
+
+        if(pointer[i] == '/'){
+            tokens.emplace_back();
+            continue;
+        }
+
+        if(pointer[i] == '~'){
+            if(i + 1 < pointer.size() && pointer[i + 1] == '0')
+                tokens.back() += '~';
+            else if(i + 1 < pointer.size() && pointer[i + 1] == '1')
+                tokens.back() += '/';
+            else
+                patch_error("Invalid '~' escape in pointer: " + pointer);
+            i++;
+            continue;
+        }
+
+        tokens.back() += pointer[i];
+    }
+
+    return tokens;
+}
+
+size_t JsonPatcher::array_index(const std::string& token, size_t size, bool allow_end){
+
+    if(allow_end && token == "-")
+        return size;
+
+    bool valid = !token.empty() && token.size() <= 18 && (token == "0" || token[0] != '0');
+    for(char ch : token)
+        valid = valid && ch >= '0' && ch <= '9';
+    if(!valid)
+        patch_error("Invalid array index '" + token + "'.");
+
+    size_t index = std::stoull(token);
+    if(index > size || (index == size && !allow_end))
+        patch_error("Array index " + token + " out of range.");
+
+    return index;
+}
+
+JsonWrapper JsonPatcher::resolve(const std::vector<std::string>& tokens, size_t token_count){
+
+    JsonWrapper value = document.root_wrapper;
+
+    for(size_t t = 0; t < token_count; t++){
+
+        const std::string& token = tokens[t];
+
+        if(value.type() == JSON_TYPE::ARRAY){
+            json_array_wrap& array = document.unwrap_array(value);
+            value = array[array_index(token, array.size(), false)];
+        }
+        else if(value.type() == JSON_TYPE::OBJECT){
+            JsonWrapper found;
+            for(JsonWrapper kv_wrapper : document.unwrap_object(value)){
+                json_kv_wrap& kv = document.unwrap_kv(kv_wrapper);
+                if(kv.first == token){
+                    found = kv.second;
+                    break;
+                }
+            }
+            if(found.type() == JSON_TYPE::NONE)
+                patch_error("Key '" + token + "' not found.");
+            value = found;
+        }
+        else {
+            patch_error("Pointer descends into a non-container value at '" + token + "'.");
+        }
+    }
+
+    return value;
+}
+
+JsonWrapper JsonPatcher::get(const std::string& pointer){
+    std::vector<std::string> tokens = split_pointer(pointer);
+    return resolve(tokens, tokens.size());
+}
+
+void JsonPatcher::add(const std::string& pointer, JsonWrapper value){
+
+    std::vector<std::string> tokens = split_pointer(pointer);
+    if(tokens.empty()){
+        document.root_wrapper = value;
+        return;
+    }
+
+    JsonWrapper parent = resolve(tokens, tokens.size() - 1);
+
+    if(parent.type() == JSON_TYPE::OBJECT)
+        document.set(parent, tokens.back(), value);
+    else if(parent.type() == JSON_TYPE::ARRAY)
+        document.insert(parent, array_index(tokens.back(), document.unwrap_array(parent).size(), true), value);
+    else
+        patch_error("Parent of '" + pointer + "' is not a container.");
+}
+
+JsonWrapper JsonPatcher::remove(const std::string& pointer){
+
+    std::vector<std::string> tokens = split_pointer(pointer);
+    if(tokens.empty())
+        patch_error("Cannot remove the root value.");
+
+    JsonWrapper removed = resolve(tokens, tokens.size());
+    JsonWrapper parent = resolve(tokens, tokens.size() - 1);
+
+    if(parent.type() == JSON_TYPE::OBJECT)
+        document.erase(parent, tokens.back());
+    else
+        document.erase(parent, array_index(tokens.back(), document.unwrap_array(parent).size(), false));
+
+    return removed;
+}
+
+void JsonPatcher::replace(const std::string& pointer, JsonWrapper value){
+
+    std::vector<std::string> tokens = split_pointer(pointer);
+    if(tokens.empty()){
+        document.root_wrapper = value;
+        return;
+    }
+
+    // Target must exist
+    resolve(tokens, tokens.size());
+    JsonWrapper parent = resolve(tokens, tokens.size() - 1);
+
+    if(parent.type() == JSON_TYPE::OBJECT)
+        document.set(parent, tokens.back(), value);
+    else
+        document.set(parent, array_index(tokens.back(), document.unwrap_array(parent).size(), false), value);
+}
+
+void JsonPatcher::apply_operation(JsonWrapper operation){
+
+    if(operation.type() != JSON_TYPE::OBJECT)
+        patch_error("Operation is not an object.");
+
+    std::string op;
+    std::string path;
+    std::string from;
+    bool has_path = false;
+    bool has_from = false;
+    JsonWrapper value;
+
+    for(JsonWrapper kv_wrapper : patch.unwrap_object(operation)){
+        json_kv_wrap& kv = patch.unwrap_kv(kv_wrapper);
+
+        bool is_string = kv.second.type() == JSON_TYPE::STRING;
+
+        if(kv.first == "op" && is_string)
+            op = patch.store.get_string_view(kv.second);
+        else if(kv.first == "path" && is_string){
+            path = patch.store.get_string_view(kv.second);
+            has_path = true;
+        }
+        else if(kv.first == "from" && is_string){
+            from = patch.store.get_string_view(kv.second);
+            has_from = true;
+        }
+        else if(kv.first == "value")
+            value = kv.second;
+    }
+
+    if(!has_path)
+        patch_error("Operation without a string 'path'.");
+
+    bool needs_value = op == "add" || op == "replace" || op == "test";
+    if(needs_value && value.type() == JSON_TYPE::NONE)
+        patch_error("'" + op + "' operation without 'value'.");
+    if((op == "move" || op == "copy") && !has_from)
+        patch_error("'" + op + "' operation without 'from'.");
+
+
+    if(op == "add"){
+        add(path, json_copy(patch.store, value, document.store));
+    }
+    else if(op == "remove"){
+        remove(path);
+    }
+    else if(op == "replace"){
+        replace(path, json_copy(patch.store, value, document.store));
+    }
+    else if(op == "move"){
+        if(path.compare(0, from.size(), from) == 0 && path.size() > from.size() && path[from.size()] == '/')
+            patch_error("Cannot move a value into one of its children.");
+        add(path, remove(from));
+    }
+    else if(op == "copy"){
+        add(path, json_copy(document.store, get(from), document.store));
+    }
+    else if(op == "test"){
+        if(!json_equal(document.store, get(path), patch.store, value))
+            patch_error("Test failed at '" + path + "'.");
+    }
+    else {
+        patch_error("Unknown operation '" + op + "'.");
+    }
+}
+
+
+
+std::string json_diff(Physon& from, Physon& to){
+
+    JsonDiff diff (from, to);
+
+    diff.patch = "[";
+    diff.diff_value(from.root_wrapper, to.root_wrapper, "");
+    diff.patch += "]";
+
+    return diff.patch;
+}
+
+void json_patch_apply(Physon& document, Physon& patch){
+
+    if(patch.root_wrapper.type() != JSON_TYPE::ARRAY)
+        throw std::runtime_error("JSON Patch: patch document is not an array.");
+
+    JsonPatcher patcher (document, patch);
+
+    for(JsonWrapper operation : patch.unwrap_array(patch.root_wrapper))
+        patcher.apply_operation(operation);
+}
@@ -0,0 +1,522 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <climits>
+#include <charconv>
+#include <cstring>
+
+#include "physon.hh"
+#include "physon_types.hh"
+#include "physon_unicode.hh"
+
+
+/**
+    Two-stage pipelined parse : a lexer thread feeding a tree-building thread.
+
+    physon_parse_pipelined() splits parse() in two. A lexer thread scans and checks every literal, and hands
+    Tokens over in batches through a lock-free single-producer single-consumer ring. The calling thread takes
+    the batches and builds the store, checking the grammar, decoding numbers and unescaping strings. While the
+    builder works on one batch the lexer already scans the next, so on two free cores a large document takes
+    about the time of the slower stage instead of the sum of both.
+
+        physon_parse_pipelined(physon);                         // strict
+        physon_parse_pipelined<PhysonLazyPolicy>(physon);
+
+    The result, spans included, is the store parse() builds with the same policy. Errors are rare, so once either
+    stage fails the content is parsed again by parse(), which throws the exact error parse() throws on its own.
+    Content shorter than min_bytes, longer than Token offsets reach, or a machine with fewer than min_cores cores
+    gets a plain parse(). UTF-8 validation, when the policy asks for it, runs on the lexer thread before lexing.
+
+        physon_parse_pipelined(physon, 0, 0);                   // always on two threads, e.g. in tests
+ */
+
+#define PHYSON_PIPELINE_BATCH_TOKENS 1024       /** Tokens per batch handed from the lexer to the builder */
+#define PHYSON_PIPELINE_RING_BATCHES 16         /** Batches in flight. Power of two. */
+#define PHYSON_PIPELINE_MIN_BYTES (1 << 20)     /** Default min_bytes : smaller content is parsed on the calling thread */
+#define PHYSON_PIPELINE_MIN_CORES 2             /** Default min_cores : machines with fewer cores parse on the calling thread */
+#define PHYSON_PIPELINE_SPINS 256               /** Busy polls of an empty or full ring before yielding */
+
+
+/** 
+    Parse physon.content on two threads. Replaces the store like parse().
+    Returns true if the two stages built the store, false if parse() did.
+ */
+template<typename Policy = PhysonStrictPolicy>
+bool physon_parse_pipelined(Physon& physon, size_t min_bytes = PHYSON_PIPELINE_MIN_BYTES, unsigned min_cores = PHYSON_PIPELINE_MIN_CORES);
+
+
+/**
+    Lock-free ring between exactly one producer thread and one consumer thread.
+    Slots are written in place : the producer fills the slot from acquire_write() and hands it over with publish(),
+    the consumer reads the slot from acquire_read() and gives it back with release().
+ */
+template<typename T, size_t Capacity>
+struct PhysonSpscRing {
+
+    static_assert((Capacity & (Capacity - 1)) == 0, "PhysonSpscRing : Capacity must be a power of two");
+
+    /** Next slot to publish. Only the producer writes it. */
+    alignas(64) std::atomic<size_t> head {0};
+    /** Producer copy of tail, refreshed only when the ring looks full */
+    size_t cached_tail = 0;
+
+    /** Next slot to read. Only the consumer writes it. */
+    alignas(64) std::atomic<size_t> tail {0};
+    /** Consumer copy of head, refreshed only when the ring looks empty */
+    size_t cached_head = 0;
+
+    /** Set by the consumer to stop a producer waiting for a free slot */
+    alignas(64) std::atomic<bool> cancelled {false};
+
+    alignas(64) T slots[Capacity];
+
+    /** Free slot to fill, nullptr once cancelled */
+    T* acquire_write(){
+        size_t next = head.load(std::memory_order_relaxed);
+        for(int spins = 0; next - cached_tail == Capacity; spins++){
+            if(cancelled.load(std::memory_order_relaxed))
+                return nullptr;
+            if(spins >= PHYSON_PIPELINE_SPINS)
+                std::this_thread::yield();
+            cached_tail = tail.load(std::memory_order_acquire);
+        }
+        return &slots[next & (Capacity - 1)];
+    }
+    void publish(){
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /** Oldest published slot. Waits for the producer. */
+    T* acquire_read(){
+        size_t next = tail.load(std::memory_order_relaxed);
+        for(int spins = 0; next == cached_head; spins++){
+            if(spins >= PHYSON_PIPELINE_SPINS)
+                std::this_thread::yield();
+            cached_head = head.load(std::memory_order_acquire);
+        }
+        return &slots[next & (Capacity - 1)];
+    }
+    void release(){
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void cancel(){
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+};
+
+
+struct PhysonTokenBatch {
+    size_t count = 0;
+    Token tokens[PHYSON_PIPELINE_BATCH_TOKENS];
+};
+
+/** State shared by the two stages of one pipelined parse */
+struct PhysonPipeline {
+    PhysonSpscRing<PhysonTokenBatch, PHYSON_PIPELINE_RING_BATCHES> ring;
+    /** Set by the lexer before it publishes its last batch, which ends with an END token */
+    bool lexer_failed = false;
+};
+
+/** Thrown by the builder at the first token parse() would reject */
+struct PhysonPipelineFault {};
+
+
+/** Lexer stage. Ends the token stream with an END token, also after an error, or with an INVALID token. */
+template<typename Policy>
+void pipeline_lex(Physon& physon, PhysonPipeline& pipeline);
+
+/** Builder stage. Consumes tokens up to the last one. */
+template<typename Policy>
+void pipeline_build(Physon& physon, PhysonPipeline& pipeline);
+
+
+
+template<typename Policy>
+void pipeline_lex(Physon& physon, PhysonPipeline& pipeline){
+
+    auto& ring = pipeline.ring;
+
+    PhysonTokenBatch* batch = ring.acquire_write();
+    if(batch == nullptr)
+        return;
+    batch->count = 0;
+
+    const char* begin = physon.content.data();
+    const char* end = begin + physon.content.size();
+    const char* c = begin;
+
+    try {
+        if constexpr (Policy::validate_utf8){
+            if(!utf8_validate(physon.content.data(), physon.content.size()))
+                physon.json_error("Error: content is not valid UTF-8.");
+        }
+
+        while(true){
+
+            if(batch->count == PHYSON_PIPELINE_BATCH_TOKENS){
+                ring.publish();
+                batch = ring.acquire_write();
+                if(batch == nullptr)
+                    return;
+                batch->count = 0;
+            }
+
+            physon.skip_whitespace<Policy>(c);
+            const char* start = c;
+            // Counted only once complete, so an error leaves the slot for the END token
+            Token& token = batch->tokens[batch->count];
+
+            switch (char_class_table.of(*c)){
+
+            case CHAR_CLASS::STRING:
+                {
+                    // The token holds the text between the quotes
+                    bool has_escapes = physon.template scan_string_literal<false>(c, nullptr);
+                    token = Token(token_type::STRING, start + 1 - begin, c - 2 - start);
+                    token.has_escapes = has_escapes;
+                }
+                break;
+
+            case CHAR_CLASS::NUMBER:
+                {
+                    bool is_fractional = physon.scan_number_literal(c);
+                    if constexpr (!Policy::decode_numbers){
+                        if((size_t)(c - start) > PHYSON_LAZY_NUMBER_MAX_LENGTH)
+                            physon.json_error_at(start, "Number text too long for a lazy number.");
+                    }
+                    token = Token(token_type::NUMBER, start - begin, c - start);
+                    token.is_fractional = is_fractional;
+                    // Decoded here to even out the stages. Integers too large to be inline need the store.
+                    if constexpr (Policy::decode_numbers){
+                        if(is_fractional){
+                            json_float float_;
+                            if(std::from_chars(start, c, float_).ec == std::errc())
+                                token.number = JsonWrapper::from_float(float_);
+                        }
+                        else {
+                            json_int integer;
+                            if(std::from_chars(start, c, integer).ec == std::errc() && JsonWrapper::int_fits_inline(integer))
+                                token.number = JsonWrapper::from_int(integer);
+                        }
+                    }
+                }
+                break;
+
+            case CHAR_CLASS::TRUE_:
+                if(end - c < 4 || std::memcmp(c, "true", 4) != 0)
+                    physon.json_error_at(c, "Invalid true-literal at index " + std::to_string(c - begin));
+                c += 4;
+                token = Token(token_type::TRUE, start - begin, 4);
+                break;
+            case CHAR_CLASS::FALSE_:
+                if(end - c < 5 || std::memcmp(c + 1, "alse", 4) != 0)
+                    physon.json_error_at(c, "Invalid false-literal at index " + std::to_string(c - begin));
+                c += 5;
+                token = Token(token_type::FALSE, start - begin, 5);
+                break;
+            case CHAR_CLASS::NULL_:
+                if(end - c < 4 || std::memcmp(c, "null", 4) != 0)
+                    physon.json_error_at(c, "Invalid null-literal at index " + std::to_string(c - begin));
+                c += 4;
+                token = Token(token_type::NULL_, start - begin, 4);
+                break;
+
+            // Structural chars are checked in order by the builder
+            case CHAR_CLASS::ARRAY_OPEN:    token = Token(token_type::LEFT_SQUARE, c++ - begin, 1); break;
+            case CHAR_CLASS::ARRAY_CLOSE:   token = Token(token_type::RIGHT_SQUARE, c++ - begin, 1); break;
+            case CHAR_CLASS::OBJECT_OPEN:   token = Token(token_type::LEFT_CURLY, c++ - begin, 1); break;
+            case CHAR_CLASS::OBJECT_CLOSE:  token = Token(token_type::RIGHT_CURLY, c++ - begin, 1); break;
+            case CHAR_CLASS::COLON:         token = Token(token_type::COLON, c++ - begin, 1); break;
+            case CHAR_CLASS::COMMA:         token = Token(token_type::COMMA, c++ - begin, 1); break;
+
+            default:
+                // No token starts with an invalid byte, so the builder fails on it wherever it comes
+                token = Token(c == end ? token_type::END : token_type::INVALID, c - begin, 0);
+                batch->count++;
+                ring.publish();
+                return;
+            }
+            batch->count++;
+        }
+    }
+    catch(...){
+        pipeline.lexer_failed = true;
+        batch->tokens[batch->count++] = Token(token_type::END, c - begin, 0);
+        ring.publish();
+    }
+}
+
+
+template<typename Policy>
+void pipeline_build(Physon& physon, PhysonPipeline& pipeline){
+
+    auto& ring = pipeline.ring;
+    json_store& store = physon.store;
+    const char* begin = physon.content.data();
+
+    PhysonTokenBatch* batch = ring.acquire_read();
+    size_t position = 0;
+    auto next = [&](){
+        if(position == batch->count){
+            ring.release();
+            batch = ring.acquire_read();
+            position = 0;
+        }
+        return batch->tokens[position++];
+    };
+    auto fail = [](){
+        throw PhysonPipelineFault();
+    };
+
+    std::vector<JsonWrapper> nesting;
+    std::vector<JsonWrapper> entry_stack;
+    std::vector<size_t> entry_starts;
+    int pending_kv = 0;
+    std::string key;
+    JsonWrapper value;
+    Token token = next();
+
+
+parse_value:
+    switch (token.type){
+
+    case token_type::STRING:
+        {
+            const char* text = begin + token.str_start_i;
+            if constexpr (Policy::decode_strings){
+                std::string& string = store.strings.emplace_back(token.str_length, '\0');
+                if(token.has_escapes)
+                    string.resize(json_unescape(text, token.str_length, string.data()) - string.data());
+                else
+                    std::memcpy(string.data(), text, token.str_length);
+                value = JsonWrapper(store.strings.size() - 1, JSON_TYPE::STRING);
+            }
+            else {
+                value = store.add_lazy_string(token.str_start_i, token.str_length, token.has_escapes);
+            }
+        }
+        goto add_value;
+
+    case token_type::NUMBER:
+        if constexpr (Policy::decode_numbers){
+            if(token.number.type() != JSON_TYPE::NONE){
+                value = token.number;
+                goto add_value;
+            }
+            // Checked by the lexer, so only the range can fail
+            const char* text = begin + token.str_start_i;
+            if(token.is_fractional){
+                json_float float_;
+                if(std::from_chars(text, text + token.str_length, float_).ec != std::errc())
+                    fail();
+                value = store.new_float(float_);
+            }
+            else {
+                json_int integer;
+                if(std::from_chars(text, text + token.str_length, integer).ec != std::errc())
+                    fail();
+                value = store.new_integer(integer);
+            }
+        }
+        else {
+            value = store.add_number(token.str_start_i, token.str_length, !token.is_fractional);
+        }
+        goto add_value;
+
+    case token_type::TRUE:      value = JsonWrapper(JSON_TYPE::TRUE);     goto add_value;
+    case token_type::FALSE:     value = JsonWrapper(JSON_TYPE::FALSE);    goto add_value;
+    case token_type::NULL_:     value = JsonWrapper(JSON_TYPE::NULL_);    goto add_value;
+
+    case token_type::LEFT_SQUARE:
+        value = store.new_array();
+        physon.array_spans.push_back({ (size_t)token.str_start_i, 0 });
+        goto add_container;
+    case token_type::LEFT_CURLY:
+        value = store.new_object();
+        physon.object_spans.push_back({ (size_t)token.str_start_i, 0 });
+        goto add_container;
+
+    default:
+        fail();
+    }
+
+
+add_container:
+    if(nesting.empty())
+        physon.root_wrapper = value;
+    else if(nesting.back().type() == JSON_TYPE::ARRAY)
+        entry_stack.push_back(value);
+    else
+        store.get_kv(pending_kv).second = value;
+
+    nesting.push_back(value);
+    entry_starts.push_back(entry_stack.size());
+
+    token = next();
+    if(value.type() == JSON_TYPE::ARRAY){
+        if(token.type != token_type::RIGHT_SQUARE)
+            goto parse_value;
+    }
+    else {
+        if(token.type != token_type::RIGHT_CURLY)
+            goto parse_key;
+    }
+    // Empty container : close it right away
+    goto after_value;
+
+
+add_value:
+    if(nesting.empty())
+        physon.root_wrapper = value;
+    else if(nesting.back().type() == JSON_TYPE::ARRAY)
+        entry_stack.push_back(value);
+    else
+        store.get_kv(pending_kv).second = value;
+
+
+end_of_value:
+    token = next();
+
+after_value:
+    if(nesting.empty())
+        goto end_of_root;
+
+    switch (token.type){
+
+    case token_type::COMMA:
+        token = next();
+        if constexpr (Policy::allow_trailing_commas){
+            if(token.type == token_type::RIGHT_SQUARE || token.type == token_type::RIGHT_CURLY)
+                goto after_value;
+        }
+        if(nesting.back().type() == JSON_TYPE::OBJECT)
+            goto parse_key;
+        goto parse_value;
+
+    case token_type::RIGHT_SQUARE:
+        if(nesting.back().type() != JSON_TYPE::ARRAY)
+            fail();
+        physon.array_spans[nesting.back().store_id()].end = token.str_start_i;
+        goto close_container;
+
+    case token_type::RIGHT_CURLY:
+        if(nesting.back().type() != JSON_TYPE::OBJECT)
+            fail();
+        physon.object_spans[nesting.back().store_id()].end = token.str_start_i;
+        goto close_container;
+
+    default:
+        fail();
+    }
+
+
+close_container:
+    {
+        json_array_wrap& entries = nesting.back().type() == JSON_TYPE::ARRAY
+                                    ? store.get_array(nesting.back().store_id())
+                                    : store.get_object(nesting.back().store_id());
+        entries.assign(entry_stack.begin() + entry_starts.back(), entry_stack.end());
+        entry_stack.resize(entry_starts.back());
+
+        entry_starts.pop_back();
+        nesting.pop_back();
+    }
+    goto end_of_value;
+
+
+parse_key:
+    if(token.type != token_type::STRING)
+        fail();
+
+    // Keys go straight into the kv, never through the string store
+    key.resize(token.str_length);
+    if(token.has_escapes)
+        key.resize(json_unescape(begin + token.str_start_i, token.str_length, key.data()) - key.data());
+    else
+        std::memcpy(key.data(), begin + token.str_start_i, token.str_length);
+
+    token = next();
+    if(token.type != token_type::COLON)
+        fail();
+
+    {
+        JsonWrapper kv = store.new_kv(key);
+        entry_stack.push_back(kv);
+        pending_kv = kv.store_id();
+    }
+
+    token = next();
+    goto parse_value;
+
+
+end_of_root:
+    if(token.type != token_type::END)
+        fail();
+}
+
+
+template<typename Policy>
+bool physon_parse_pipelined(Physon& physon, size_t min_bytes, unsigned min_cores){
+
+    static_assert(!Policy::reject_duplicate_keys && !Policy::enforce_budget,
+                  "physon_parse_pipelined() : duplicate key and budget checks are only done by Physon::parse()");
+
+    if(physon.content.size() < min_bytes || physon.content.size() >= INT_MAX
+       || std::thread::hardware_concurrency() < min_cores){
+        physon.parse<Policy>();
+        return false;
+    }
+
+    json_store& store = physon.store;
+
+    physon.cursor.index = 0;
+    physon.cursor.container_trace.clear();
+    physon.cursor.entry_stack.clear();
+    physon.cursor.entry_starts.clear();
+    store.clear();
+    physon.tokens.clear();
+    physon.stringify_cache.clear();
+    physon.shared_subtrees = false;
+    physon.budget_charged = false;
+    physon.array_spans.clear();
+    physon.object_spans.clear();
+    physon.root_wrapper = JsonWrapper();
+    physon.state = JSON_PARSE_STATE::ROOT_BEFORE_VALUE;
+
+    if constexpr (!Policy::decode_numbers || !Policy::decode_strings)
+        store.source_text.assign(physon.content);
+
+    // Until the lexer is joined only it may touch cursor and state, which its json errors write
+    std::unique_ptr<PhysonPipeline> pipeline = std::make_unique<PhysonPipeline>();
+    std::thread lexer ([&](){ pipeline_lex<Policy>(physon, *pipeline); });
+
+    bool failed = false;
+    try {
+        pipeline_build<Policy>(physon, *pipeline);
+    }
+    catch(const PhysonPipelineFault&){
+        failed = true;
+    }
+    catch(...){
+        pipeline->ring.cancel();
+        lexer.join();
+        throw;
+    }
+    pipeline->ring.cancel();
+    lexer.join();
+
+    // The lexer can also fail after a complete root value, e.g. on a broken literal
+    if(failed || pipeline->lexer_failed){
+        physon.parse<Policy>();
+        return false;
+    }
+
+    physon.cursor.index = physon.content.size();
+    physon.state = JSON_PARSE_STATE::DONE;
+    return true;
+}
@@ -0,0 +1,555 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <initializer_list>
+#include <stdexcept>
+#include <cstring>
+
+#include "physon.hh"
+#include "physon_types.hh"
+#include "physon_unicode.hh"
+
+
+/**
+    Projection pushdown : parse only the values under a set of JSON Pointer paths.
+
+    physon_parse_projected() walks content like parse(), but builds store entries only on the way to and
+    inside the selected values. Everything else is passed over by a skip scanner that only tracks string
+    and bracket boundaries and decodes nothing, so the parse cost follows the selected part of the document.
+
+    Paths are JSON Pointers (RFC 6901). A '*' token selects every element of an array or every value of an object.
+    The projected document keeps the shape of the original : objects hold only their selected keys, arrays only
+    their selected elements, in document order. A path that runs into a scalar or a missing key selects nothing.
+
+        PhysonProjection projection { "/user/id", "/items/0/price" };
+        physon_parse_projected(physon, projection);
+
+    The selected values are fully checked. Skipped text is only checked for balanced strings and brackets,
+    so a document that parses projected may still fail parse(). A later reparse() parses the whole content.
+ */
+
+
+struct PhysonProjection {
+
+    /** Node of a wholly selected subtree */
+    static constexpr int ALL = -2;
+    /** No node : the value is skipped */
+    static constexpr int NONE = -1;
+
+    struct Child {
+        std::string key;
+        /** key as an array index, or SIZE_MAX if it is not one */
+        size_t index;
+        int node;
+    };
+    struct Node {
+        std::vector<Child> children;
+        int wildcard = NONE;
+        bool selected = false;
+    };
+    /** nodes[0] is the root */
+    std::vector<Node> nodes;
+
+    PhysonProjection() : nodes (1) {};
+    PhysonProjection(std::initializer_list<std::string> pointers) : nodes (1) {
+        for(const std::string& pointer : pointers)
+            add(pointer);
+    };
+
+    /** Select the value at pointer and its subtree. "" selects the whole document. */
+    void add(const std::string& pointer);
+
+    /** ALL if node is selected as a whole */
+    int resolve(int node) const {
+        return node >= 0 && nodes[node].selected ? ALL : node;
+    }
+    /** Node of the value of key in an object of node */
+    int child(int node, std::string_view key) const;
+    /** Node of the element at index in an array of node */
+    int child(int node, size_t index) const;
+
+private:
+    void insert(int node, const std::vector<std::string>& tokens, size_t next);
+    /** Adds every path below from to the node into */
+    void merge(int from, int into);
+    int new_node();
+};
+
+void projection_error(std::string error_msg){
+    throw std::runtime_error("Projection: " + error_msg);
+}
+
+
+/** Parse physon.content keeping only the values selected by projection. Replaces the store like parse(). */
+template<typename Policy = PhysonStrictPolicy>
+void physon_parse_projected(Physon& physon, const PhysonProjection& projection);
+
+/** c at the first char of a value. Moves c past the value, checking only string and bracket boundaries. */
+template<typename Policy>
+void projection_skip_value(Physon& physon, const char*& c);
+
+
+
+void PhysonProjection::add(const std::string& pointer){
+
+    std::vector<std::string> tokens;
+    if(!pointer.empty() && pointer[0] != '/')
+        projection_error("pointer must start with '/': " + pointer);
+
+    for(size_t i = 0; i < pointer.size(); i++){
+
+        if(pointer[i] == '/'){
+            tokens.emplace_back();
+            continue;
+        }
+        if(pointer[i] == '~'){
+            if(i + 1 < pointer.size() && pointer[i + 1] == '0')
+                tokens.back() += '~';
+            else if(i + 1 < pointer.size() && pointer[i + 1] == '1')
+                tokens.back() += '/';
+            else
+                projection_error("invalid '~' escape in pointer: " + pointer);
+            i++;
+            continue;
+        }
+        tokens.back() += pointer[i];
+    }
+
+    insert(0, tokens, 0);
+}
+
+int PhysonProjection::new_node(){
+    nodes.emplace_back();
+    return nodes.size() - 1;
+}
+
+void PhysonProjection::insert(int node, const std::vector<std::string>& tokens, size_t next){
+
+    if(next == tokens.size()){
+        nodes[node].selected = true;
+        return;
+    }
+
+    const std::string& token = tokens[next];
+
+    // A wildcard path also applies below every named sibling
+    if(token == "*"){
+        if(nodes[node].wildcard == NONE){
+            int wildcard = new_node();
+            nodes[node].wildcard = wildcard;
+        }
+        insert(nodes[node].wildcard, tokens, next + 1);
+        for(size_t i = 0; i < nodes[node].children.size(); i++)
+            insert(nodes[node].children[i].node, tokens, next + 1);
+        return;
+    }
+
+    for(Child& existing : nodes[node].children){
+        if(existing.key == token){
+            insert(existing.node, tokens, next + 1);
+            return;
+        }
+    }
+
+    size_t index = SIZE_MAX;
+    bool is_index = !token.empty() && token.size() < 19 && (token == "0" || token[0] != '0');
+    for(char ch : token)
+        is_index = is_index && ch >= '0' && ch <= '9';
+    if(is_index)
+        index = std::stoull(token);
+
+    int created = new_node();
+    nodes[node].children.push_back({ token, index, created });
+    // A new named child inherits the paths already selected through the wildcard
+    if(nodes[node].wildcard != NONE)
+        merge(nodes[node].wildcard, created);
+    insert(created, tokens, next + 1);
+}
+
+void PhysonProjection::merge(int from, int into){
+
+    if(nodes[from].selected)
+        nodes[into].selected = true;
+
+    if(nodes[from].wildcard != NONE){
+        if(nodes[into].wildcard == NONE){
+            int wildcard = new_node();
+            nodes[into].wildcard = wildcard;
+        }
+        merge(nodes[from].wildcard, nodes[into].wildcard);
+    }
+
+    for(size_t i = 0; i < nodes[from].children.size(); i++){
+        Child from_child = nodes[from].children[i];
+
+        int target = NONE;
+        for(Child& existing : nodes[into].children){
+            if(existing.key == from_child.key)
+                target = existing.node;
+        }
+        if(target == NONE){
+            target = new_node();
+            nodes[into].children.push_back({ from_child.key, from_child.index, target });
+        }
+        merge(from_child.node, target);
+    }
+}
+
+int PhysonProjection::child(int node, std::string_view key) const {
+    if(node == ALL)
+        return ALL;
+    for(const Child& named : nodes[node].children){
+        if(named.key == key)
+            return resolve(named.node);
+    }
+    return resolve(nodes[node].wildcard);
+}
+
+int PhysonProjection::child(int node, size_t index) const {
+    if(node == ALL)
+        return ALL;
+    for(const Child& named : nodes[node].children){
+        if(named.index == index)
+            return resolve(named.node);
+    }
+    return resolve(nodes[node].wildcard);
+}
+
+
+template<typename Policy>
+void projection_skip_value(Physon& physon, const char*& c){
+
+    const char* begin = physon.content.data();
+    const char* end = begin + physon.content.size();
+
+    // Moves c past the closing quotation mark : the first one not preceded by an odd run of backslashes
+    auto skip_string = [&](){
+        const char* quote_start = c;
+        c++;
+        while(true){
+            const char* quote = (const char*)std::memchr(c, '"', end - c);
+            if(quote == nullptr)
+                physon.json_error_at(quote_start, "Error: Unclosed string literal in skipped value.");
+            const char* escape = quote;
+            while(escape > c && escape[-1] == '\\')
+                escape--;
+            c = quote + 1;
+            if((quote - escape) % 2 == 0)
+                return;
+        }
+    };
+
+    switch (char_class_table.of(*c)){
+
+    case CHAR_CLASS::STRING:
+        skip_string();
+        return;
+
+    case CHAR_CLASS::ARRAY_OPEN:
+    case CHAR_CLASS::OBJECT_OPEN:
+        {
+            const char* container_start = c;
+            // Open brackets, innermost last. Short enough to stay in the small string buffer for most values.
+            std::string open_brackets;
+            while(true){
+                while(!char_class_table.skip_stop[(unsigned char)*c])
+                    c++;
+
+                switch (*c){
+                case '"':
+                    skip_string();
+                    break;
+                case '[':
+                case '{':
+                    open_brackets.push_back(*c);
+                    c++;
+                    break;
+                case ']':
+                case '}':
+                    if(open_brackets.back() != (*c == ']' ? '[' : '{'))
+                        physon.json_error_at(c, "Error: Mismatched closing bracket in skipped value.");
+                    open_brackets.pop_back();
+                    c++;
+                    if(open_brackets.empty())
+                        return;
+                    break;
+                case '/':
+                    if constexpr (Policy::allow_comments)
+                        physon.skip_comment(c);
+                    else
+                        c++;
+                    break;
+                default:
+                    if(c == end)
+                        physon.json_error_at(container_start, "Error: Unclosed container in skipped value.");
+                    c++;
+                    break;
+                }
+            }
+        }
+
+    default:
+        {
+            // Number or literal name : runs to the next delimiter
+            const char* scalar_start = c;
+            while(c < end){
+                CHAR_CLASS char_class = char_class_table.of(*c);
+                if(char_class == CHAR_CLASS::WHITESPACE || char_class == CHAR_CLASS::COMMA
+                   || char_class == CHAR_CLASS::ARRAY_CLOSE || char_class == CHAR_CLASS::OBJECT_CLOSE || *c == '/')
+                    break;
+                c++;
+            }
+            if(c == scalar_start)
+                physon.json_error_at(c, c == end ? "Error: Unexpected end of content, expected a value."
+                                                 : "Error: not a valid first character of a value.");
+        }
+    }
+}
+
+
+template<typename Policy>
+void physon_parse_projected(Physon& physon, const PhysonProjection& projection){
+
+    static_assert(!Policy::reject_duplicate_keys && !Policy::enforce_budget,
+                  "physon_parse_projected() : duplicate key and budget checks are only done by Physon::parse()");
+
+    json_store& store = physon.store;
+
+    physon.cursor.index = 0;
+    store.clear();
+    physon.tokens.clear();
+    physon.stringify_cache.clear();
+    physon.shared_subtrees = false;
+    physon.budget_charged = false;
+    // Without spans reparse() falls back to a full parse, which the projected store could not be spliced into anyway
+    physon.array_spans.clear();
+    physon.object_spans.clear();
+    physon.root_wrapper = JsonWrapper();
+    physon.state = JSON_PARSE_STATE::ROOT_BEFORE_VALUE;
+
+    if constexpr (Policy::validate_utf8){
+        if(!utf8_validate(physon.content.data(), physon.content.size()))
+            physon.json_error("Error: content is not valid UTF-8.");
+    }
+
+    const char* begin = physon.content.data();
+    const char* end = begin + physon.content.size();
+    const char* c = begin;
+
+    if constexpr (!Policy::decode_numbers || !Policy::decode_strings)
+        store.source_text.assign(physon.content);
+
+    struct Frame {
+        JsonWrapper container;
+        int node;
+        size_t entry_start;
+        /** Elements seen so far, selected or not */
+        size_t index;
+    };
+    std::vector<Frame> frames;
+    std::vector<JsonWrapper> entry_stack;
+    std::string key;
+    int node = projection.resolve(0);
+    JsonWrapper value;
+
+    // Below a path that is not selected as a whole, scalars select nothing
+    auto selects_nothing = [&](){
+        CHAR_CLASS char_class = char_class_table.of(*c);
+        return node != PhysonProjection::ALL && char_class != CHAR_CLASS::ARRAY_OPEN && char_class != CHAR_CLASS::OBJECT_OPEN;
+    };
+
+    physon.skip_whitespace<Policy>(c);
+    if(selects_nothing()){
+        projection_skip_value<Policy>(physon, c);
+        goto end_of_root;
+    }
+
+    // Values are read only once their node selects something : frames hold selected containers only
+parse_value:
+    switch (char_class_table.of(*c)){
+
+    case CHAR_CLASS::STRING:
+        if constexpr (Policy::decode_strings){
+            physon.parse_string_literal(c, store.strings.emplace_back());
+            value = JsonWrapper(store.strings.size() - 1, JSON_TYPE::STRING);
+        }
+        else {
+            const char* text_start = c + 1;
+            bool has_escapes = physon.template scan_string_literal<false>(c, nullptr);
+            value = store.add_lazy_string(text_start - begin, c - 1 - text_start, has_escapes);
+        }
+        goto add_value;
+
+    case CHAR_CLASS::NUMBER:
+        if constexpr (Policy::decode_numbers){
+            value = physon.parse_number_literal(c);
+        }
+        else {
+            const char* number_start = c;
+            bool is_fractional = physon.scan_number_literal(c);
+            if((size_t)(c - number_start) > PHYSON_LAZY_NUMBER_MAX_LENGTH)
+                physon.json_error_at(number_start, "Number text too long for a lazy number.");
+            value = store.add_number(number_start - begin, c - number_start, !is_fractional);
+        }
+        goto add_value;
+
+    case CHAR_CLASS::TRUE_:
+        if(end - c < 4 || std::memcmp(c, "true", 4) != 0)
+            physon.json_error_at(c, "Invalid true-literal at index " + std::to_string(c - begin));
+        c += 4;
+        value = JsonWrapper(JSON_TYPE::TRUE);
+        goto add_value;
+    case CHAR_CLASS::FALSE_:
+        if(end - c < 5 || std::memcmp(c, "false", 5) != 0)
+            physon.json_error_at(c, "Invalid false-literal at index " + std::to_string(c - begin));
+        c += 5;
+        value = JsonWrapper(JSON_TYPE::FALSE);
+        goto add_value;
+    case CHAR_CLASS::NULL_:
+        if(end - c < 4 || std::memcmp(c, "null", 4) != 0)
+            physon.json_error_at(c, "Invalid null-literal at index " + std::to_string(c - begin));
+        c += 4;
+        value = JsonWrapper(JSON_TYPE::NULL_);
+        goto add_value;
+
+    case CHAR_CLASS::ARRAY_OPEN:
+        value = store.new_array();
+        goto add_container;
+    case CHAR_CLASS::OBJECT_OPEN:
+        value = store.new_object();
+        goto add_container;
+
+    default:
+        if(c == end)
+            physon.json_error_at(c, frames.empty() ? "Error: No valid JSON values." : "Error: Unexpected end of content, expected a value.");
+        physon.json_error_at(c, "Error: not a valid first character of a value.");
+    }
+
+
+add_container:
+    if(frames.empty())
+        physon.root_wrapper = value;
+    else if(frames.back().container.type() == JSON_TYPE::ARRAY)
+        entry_stack.push_back(value);
+    else
+        store.get_kv(entry_stack.back().store_id()).second = value;
+
+    frames.push_back({ value, node, entry_stack.size(), 0 });
+    c++;
+
+    physon.skip_whitespace<Policy>(c);
+    if(*c == ']' || *c == '}')
+        goto close_container;
+    goto next_entry;
+
+
+add_value:
+    if(frames.empty())
+        physon.root_wrapper = value;
+    else if(frames.back().container.type() == JSON_TYPE::ARRAY)
+        entry_stack.push_back(value);
+    else
+        store.get_kv(entry_stack.back().store_id()).second = value;
+    if(frames.empty())
+        goto end_of_root;
+
+
+end_of_entry:
+    physon.skip_whitespace<Policy>(c);
+
+    switch (char_class_table.of(*c)){
+
+    case CHAR_CLASS::COMMA:
+        c++;
+        physon.skip_whitespace<Policy>(c);
+        if constexpr (Policy::allow_trailing_commas){
+            if(*c == ']' || *c == '}')
+                goto close_container;
+        }
+        goto next_entry;
+
+    case CHAR_CLASS::ARRAY_CLOSE:
+    case CHAR_CLASS::OBJECT_CLOSE:
+        goto close_container;
+
+    default:
+        physon.json_error_at(c, "Invalid character encountered after end of value.");
+    }
+
+
+close_container:
+    {
+        Frame& frame = frames.back();
+        bool is_array = frame.container.type() == JSON_TYPE::ARRAY;
+        if(*c != (is_array ? ']' : '}'))
+            physon.json_error_at(c, is_array ? "Error: Tried to close an array when currently not in an array container."
+                                             : "Invalid JSON: Unexpected char when trying to close object. Occured at index " + std::to_string(c - begin));
+
+        json_array_wrap& entries = is_array ? store.get_array(frame.container.store_id())
+                                            : store.get_object(frame.container.store_id());
+        entries.assign(entry_stack.begin() + frame.entry_start, entry_stack.end());
+        entry_stack.resize(frame.entry_start);
+
+        frames.pop_back();
+        c++;
+    }
+    if(frames.empty())
+        goto end_of_root;
+    goto end_of_entry;
+
+
+next_entry:
+    {
+        Frame& frame = frames.back();
+        size_t index = frame.index++;
+
+        if(frame.container.type() == JSON_TYPE::ARRAY){
+            node = projection.child(frame.node, index);
+            if(node == PhysonProjection::NONE || selects_nothing()){
+                projection_skip_value<Policy>(physon, c);
+                goto end_of_entry;
+            }
+            goto parse_value;
+        }
+
+        if(*c != '"')
+            physon.json_error_at(c, "Invalid JSON: Unexpected char '" + std::string(1, *c) + "' when expecting an object key. Occured at index " + std::to_string(c - begin));
+
+        // Keys are unescaped only when they hold escapes
+        const char* key_start = c + 1;
+        bool key_has_escapes = physon.template scan_string_literal<false>(c, nullptr);
+        size_t key_length = c - 1 - key_start;
+        key.resize(key_length);
+        if(key_has_escapes)
+            key.resize(json_unescape(key_start, key_length, key.data()) - key.data());
+        else
+            std::memcpy(key.data(), key_start, key_length);
+
+        physon.skip_whitespace<Policy>(c);
+        if(*c != ':')
+            physon.json_error_at(c, "Unexpected char during colon skip. Index = " + std::to_string(c - begin));
+        c++;
+
+        node = projection.child(frame.node, std::string_view(key));
+        physon.skip_whitespace<Policy>(c);
+        if(node == PhysonProjection::NONE || selects_nothing()){
+            projection_skip_value<Policy>(physon, c);
+            goto end_of_entry;
+        }
+
+        entry_stack.push_back(store.new_kv(key));
+        goto parse_value;
+    }
+
+
+end_of_root:
+    physon.skip_whitespace<Policy>(c);
+    if(c != end)
+        physon.json_error_at(c, "Invalid JSON: Extra characters after root value. Found at index " + std::to_string(c - begin) + ".");
+
+    // A root scalar below an unselected path leaves root_wrapper NONE
+    physon.cursor.index = c - begin;
+    physon.state = JSON_PARSE_STATE::DONE;
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#include "physon.hh"
+#include "physon_types.hh"
+
+
+/**
+    Read-copy-update publishing of parsed documents to concurrent readers.
+
+    A writer parses a new Physon, freezes it into a PhysonFrozen and publishes it with PhysonRcu::publish().
+    Readers never lock : each reader thread owns a PhysonRcuReader with its own cache line, and a read guard
+    only announces the current epoch in that line and loads the document pointer.
+    A replaced document is deleted once every reader that could still hold it has left its guard.
+
+    Usage:
+        PhysonRcu config;                           // shared
+        config.publish(std::move(parsed_physon));   // writer thread
+
+        PhysonRcuReader reader (config);            // once per reader thread
+        PhysonRcuGuard guard = reader.read();
+        JsonWrapper threads = guard->find(guard->root_wrapper, "threads");
+ */
+
+#define PHYSON_RCU_MAX_READERS 256 /** Reader slots of one PhysonRcu */
+
+
+/** Immutable parsed document. Safe to read from any number of threads. */
+struct PhysonFrozen {
+
+    const json_store store;
+    const JsonWrapper root_wrapper;
+
+    /** Takes over the store of a parsed physon. Pending lazy strings are unescaped first, since the store is read-only after. */
+    PhysonFrozen(Physon&& physon) : store {frozen_store(std::move(physon.store))}, root_wrapper {physon.root_wrapper} {};
+
+    static json_store frozen_store(json_store&& store){
+        store.decode_strings();
+        return std::move(store);
+    }
+
+    json_int unwrap_int(JsonWrapper int_wrapper) const {
+        return store.get_integer(int_wrapper);
+    }
+    json_float unwrap_float(JsonWrapper float_wrapper) const {
+        return store.get_float(float_wrapper);
+    }
+    std::string_view unwrap_string(JsonWrapper string_wrapper) const {
+        return store.get_string_view(string_wrapper);
+    }
+    const json_array_wrap& unwrap_array(JsonWrapper array_wrapper) const {
+        return store.arrays[array_wrapper.store_id()];
+    }
+    const json_object_wrap& unwrap_object(JsonWrapper object_wrapper) const {
+        return store.objects[object_wrapper.store_id()];
+    }
+    const json_kv_wrap& unwrap_kv(JsonWrapper kv_wrapper) const {
+        return store.kvs[kv_wrapper.store_id()];
+    }
+    /** Value of key in object. Returns a NONE wrapper if key is missing. Not recursive. */
+    JsonWrapper find(JsonWrapper object_wrapper, std::string_view key) const;
+};
+
+
+/** Epoch announced by one reader. Padded so readers never share a cache line. */
+struct alignas(64) PhysonRcuSlot {
+    static constexpr uint64_t IDLE = UINT64_MAX;
+
+    std::atomic<uint64_t> epoch {IDLE};
+    std::atomic<bool> claimed {false};
+};
+
+struct PhysonRcu {
+
+    /** Current document. nullptr until the first publish. */
+    std::atomic<const PhysonFrozen*> current {nullptr};
+    /** Bumped by every publish */
+    std::atomic<uint64_t> global_epoch {1};
+
+    PhysonRcuSlot slots[PHYSON_RCU_MAX_READERS];
+
+    struct Retired {
+        const PhysonFrozen* document;
+        /** Readers announcing this epoch or later cannot hold document */
+        uint64_t epoch;
+    };
+    /** Replaced documents still visible to some reader. Guarded by write_mutex. */
+    std::vector<Retired> retired;
+    /** Serializes writers only */
+    std::mutex write_mutex;
+
+    PhysonRcu() = default;
+    /** No reader may be inside a guard */
+    ~PhysonRcu();
+
+    PhysonRcu(const PhysonRcu&) = delete;
+    PhysonRcu& operator=(const PhysonRcu&) = delete;
+
+    /** Replace the current document and free the retired documents no reader can reach anymore */
+    void publish(std::unique_ptr<PhysonFrozen> document);
+    void publish(Physon&& physon);
+
+    /** Frees the retired documents that no reader can reach. Returns the number still retired. */
+    size_t reclaim();
+    /** Blocks until every retired document is freed, i.e. until all readers left the guards they held */
+    void synchronize();
+
+    int claim_slot();
+    void release_slot(int slot);
+
+private:
+    size_t reclaim_locked();
+};
+
+
+struct PhysonRcuGuard;
+
+/**
+    Read side handle of one thread. Claims a reader slot for its lifetime.
+    Not thread-safe itself : each reader thread constructs its own.
+ */
+struct PhysonRcuReader {
+
+    PhysonRcu& rcu;
+    int slot;
+    /** Guards currently alive. Only the outermost one announces and clears the epoch. */
+    int depth = 0;
+
+    PhysonRcuReader(PhysonRcu& _rcu) : rcu {_rcu}, slot {_rcu.claim_slot()} {};
+    ~PhysonRcuReader(){
+        rcu.release_slot(slot);
+    }
+
+    PhysonRcuReader(const PhysonRcuReader&) = delete;
+    PhysonRcuReader& operator=(const PhysonRcuReader&) = delete;
+
+    /** Current document, kept alive until the guard is destroyed */
+    PhysonRcuGuard read();
+
+    void enter();
+    void leave();
+};
+
+/** Keeps one published document alive. The document may be nullptr if nothing was published yet. */
+struct PhysonRcuGuard {
+
+    PhysonRcuReader& reader;
+    const PhysonFrozen* document;
+
+    PhysonRcuGuard(PhysonRcuReader& _reader) : reader {_reader} {
+        reader.enter();
+        document = reader.rcu.current.load();
+    };
+    ~PhysonRcuGuard(){
+        reader.leave();
+    }
+
+    PhysonRcuGuard(const PhysonRcuGuard&) = delete;
+    PhysonRcuGuard& operator=(const PhysonRcuGuard&) = delete;
+
+    const PhysonFrozen& operator*() const { return *document; }
+    const PhysonFrozen* operator->() const { return document; }
+    explicit operator bool() const { return document != nullptr; }
+};
+
+
+
+JsonWrapper PhysonFrozen::find(JsonWrapper object_wrapper, std::string_view key) const {
+
+    for(JsonWrapper kv_wrapper : unwrap_object(object_wrapper)){
+        const json_kv_wrap& kv = unwrap_kv(kv_wrapper);
+        if(kv.first == key)
+            return kv.second;
+    }
+
+    return JsonWrapper();
+}
+
+
+PhysonRcu::~PhysonRcu(){
+    for(Retired& entry : retired)
+        delete entry.document;
+    delete current.load();
+}
+
+void PhysonRcu::publish(std::unique_ptr<PhysonFrozen> document){
+
+    std::lock_guard<std::mutex> lock (write_mutex);
+
+    // The swap comes before the epoch bump : a reader announcing the new epoch is ordered after the swap
+    const PhysonFrozen* old_document = current.exchange(document.release());
+    uint64_t retire_epoch = global_epoch.fetch_add(1) + 1;
+
+    if(old_document != nullptr)
+        retired.push_back({ old_document, retire_epoch });
+
+    reclaim_locked();
+}
+
+void PhysonRcu::publish(Physon&& physon){
+    publish(std::make_unique<PhysonFrozen>(std::move(physon)));
+}
+
+size_t PhysonRcu::reclaim(){
+    std::lock_guard<std::mutex> lock (write_mutex);
+    return reclaim_locked();
+}
+
+size_t PhysonRcu::reclaim_locked(){
+
+    if(retired.empty())
+        return 0;
+
+    uint64_t oldest_epoch = PhysonRcuSlot::IDLE;
+    for(PhysonRcuSlot& slot : slots)
+        oldest_epoch = std::min(oldest_epoch, slot.epoch.load());
+
+    size_t kept = 0;
+    for(Retired& entry : retired){
+        if(entry.epoch <= oldest_epoch)
+            delete entry.document;
+        else
+            retired[kept++] = entry;
+    }
+    retired.resize(kept);
+
+    return kept;
+}
+
+void PhysonRcu::synchronize(){
+    while(reclaim() > 0)
+        std::this_thread::yield();
+}
+
+int PhysonRcu::claim_slot(){
+
+    for(int i = 0; i < PHYSON_RCU_MAX_READERS; i++){
+        bool expected = false;
+        if(slots[i].claimed.compare_exchange_strong(expected, true))
+            return i;
+    }
+
+    throw std::runtime_error("PhysonRcu: all " + std::to_string(PHYSON_RCU_MAX_READERS) + " reader slots are in use.");
+}
+
+void PhysonRcu::release_slot(int slot){
+    slots[slot].epoch.store(PhysonRcuSlot::IDLE);
+    slots[slot].claimed.store(false);
+}
+
+
+PhysonRcuGuard PhysonRcuReader::read(){
+    return PhysonRcuGuard(*this);
+}
+
+void PhysonRcuReader::enter(){
+    // Sequentially consistent, so the document pointer is loaded only after the epoch is visible to writers
+    if(depth++ == 0)
+        rcu.slots[slot].epoch.store(rcu.global_epoch.load());
+}
+
+void PhysonRcuReader::leave(){
+    if(--depth == 0)
+        rcu.slots[slot].epoch.store(PhysonRcuSlot::IDLE, std::memory_order_release);
+}
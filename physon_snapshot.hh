@@ -0,0 +1,393 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "physon.hh"
+#include "physon_types.hh"
+
+
+/**
+    Binary snapshot of a json_store.
+    Every offset is relative to the first byte of the snapshot, so a file can be mmap'ed at any
+    address and read in place. Sections are 8-byte aligned and stored in host byte order.
+
+    Layout:
+        snapshot_header
+        integers    : json_int[]         (integers too wide for an inline handle)
+        strings     : snapshot_span[]   (offset into string blob, length)
+        numbers     : snapshot_number[] (lazy number text in string blob)
+        arrays      : snapshot_span[]   (offset into value table, count)
+        objects     : snapshot_span[]   (offset into value table, count)
+        kvs         : snapshot_kv[]
+        values      : snapshot_value[]  (array and object entries)
+        string blob : char[]            (string values, kv keys and number text)
+ */
+
+#define PHYSON_SNAPSHOT_MAGIC   "PHYSNAP"
+#define PHYSON_SNAPSHOT_VERSION 3
+
+
+/** On-disk JsonWrapper : the handle bits, so inline values need no section */
+struct snapshot_value {
+    uint64_t bits;
+};
+
+struct snapshot_span {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct snapshot_number {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t is_integer;
+};
+
+struct snapshot_kv {
+    snapshot_span   key;
+    snapshot_value  value;
+};
+
+enum class SNAPSHOT_SECTION {
+    INTEGERS = 0,
+    STRINGS,
+    NUMBERS,
+    ARRAYS,
+    OBJECTS,
+    KVS,
+    VALUES,
+    STRING_BLOB,
+
+    COUNT,
+};
+
+struct snapshot_header {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        byte_order;     /** 0x01020304 as written by the host */
+    uint64_t        total_size;
+    snapshot_value  root;
+    snapshot_span   sections[(int)SNAPSHOT_SECTION::COUNT]; /** byte offset and entry count */
+};
+
+
+/** Serialize store into a snapshot byte string. */
+std::string snapshot_serialize(json_store& store, JsonWrapper root);
+/** Serialize store and write the snapshot to path. */
+void snapshot_write(json_store& store, JsonWrapper root, std::string path);
+void snapshot_write(Physon& physon, std::string path);
+
+
+
+JsonWrapper snapshot_wrapper(snapshot_value value){
+    JsonWrapper wrapper;
+    wrapper.bits = value.bits;
+    return wrapper;
+}
+
+
+/** Read-only view of a json array/object entry table inside a snapshot. */
+struct snapshot_array_view {
+    const snapshot_value* values = nullptr;
+    size_t count = 0;
+
+    struct iterator {
+        const snapshot_value* value;
+
+        JsonWrapper operator*() const { return snapshot_wrapper(*value); }
+        iterator& operator++() { value++; return *this; }
+        bool operator!=(const iterator& other) const { return value != other.value; }
+    };
+
+    size_t size() const { return count; }
+    JsonWrapper operator[](size_t i) const { return *iterator {values + i}; }
+    iterator begin() const { return iterator {values}; }
+    iterator end() const { return iterator {values + count}; }
+};
+
+
+/**
+    A memory-mapped snapshot.
+    Opening only checks the header and section bounds; all unwrap_* calls read directly from the mapped pages.
+ */
+struct PhysonSnapshot {
+
+    const char* data = nullptr;
+    size_t size = 0;
+
+    JsonWrapper root_wrapper;
+
+    PhysonSnapshot(std::string path);
+    ~PhysonSnapshot();
+
+    PhysonSnapshot(const PhysonSnapshot&) = delete;
+    PhysonSnapshot& operator=(const PhysonSnapshot&) = delete;
+
+
+    // UNWRAPPING
+    /** Also decodes lazy NUMBER wrappers, on every call */
+    json_int unwrap_int(JsonWrapper int_wrapper){
+        if(int_wrapper.type() == JSON_TYPE::NUMBER)
+            return number_value<json_int>(int_wrapper);
+        if(int_wrapper.is_inline())
+            return int_wrapper.int_value();
+        return section<json_int>(SNAPSHOT_SECTION::INTEGERS)[int_wrapper.store_id()];
+    }
+    json_float unwrap_float(JsonWrapper float_wrapper){
+        if(float_wrapper.type() == JSON_TYPE::NUMBER)
+            return number_value<json_float>(float_wrapper);
+        return float_wrapper.float_value();
+    }
+    template<typename T>
+    T number_value(JsonWrapper number_wrapper){
+        const snapshot_number& number = section<snapshot_number>(SNAPSHOT_SECTION::NUMBERS)[number_wrapper.store_id()];
+        std::string_view text = blob_string({ number.offset, number.length });
+        T value {};
+        if(std::from_chars(text.data(), text.data() + text.size(), value).ec != std::errc())
+            throw std::runtime_error("Snapshot: number text out of range for internal representation.");
+        return value;
+    }
+    std::string_view unwrap_string(JsonWrapper string_wrapper){
+        return blob_string(section<snapshot_span>(SNAPSHOT_SECTION::STRINGS)[string_wrapper.store_id()]);
+    }
+    snapshot_array_view unwrap_array(JsonWrapper array_wrapper){
+        return entries(section<snapshot_span>(SNAPSHOT_SECTION::ARRAYS)[array_wrapper.store_id()]);
+    }
+    /** Entries are KV wrappers */
+    snapshot_array_view unwrap_object(JsonWrapper object_wrapper){
+        return entries(section<snapshot_span>(SNAPSHOT_SECTION::OBJECTS)[object_wrapper.store_id()]);
+    }
+    std::pair<std::string_view, JsonWrapper> unwrap_kv(JsonWrapper kv_wrapper){
+        const snapshot_kv& kv = section<snapshot_kv>(SNAPSHOT_SECTION::KVS)[kv_wrapper.store_id()];
+        return { blob_string(kv.key), snapshot_wrapper(kv.value) };
+    }
+    /** Value of key in object. Returns a NONE wrapper if key is missing. Not recursive. */
+    JsonWrapper find(JsonWrapper object_wrapper, std::string_view key);
+
+
+    const snapshot_header& header(){
+        return *reinterpret_cast<const snapshot_header*>(data);
+    }
+    template<typename T>
+    const T* section(SNAPSHOT_SECTION section){
+        return reinterpret_cast<const T*>(data + header().sections[(int)section].offset);
+    }
+    std::string_view blob_string(snapshot_span span){
+        return std::string_view(section<char>(SNAPSHOT_SECTION::STRING_BLOB) + span.offset, span.count);
+    }
+    snapshot_array_view entries(snapshot_span span){
+        return snapshot_array_view { section<snapshot_value>(SNAPSHOT_SECTION::VALUES) + span.offset, span.count };
+    }
+
+    void snapshot_error(std::string error_msg);
+};
+
+
+
+/** Pads buffer with zero bytes to the next 8-byte boundary */
+void snapshot_align(std::string& buffer){
+    while(buffer.size() % 8 != 0)
+        buffer.push_back('\0');
+}
+
+template<typename T>
+void snapshot_append(std::string& buffer, const T* entries, size_t count){
+    buffer.append(reinterpret_cast<const char*>(entries), count * sizeof(T));
+}
+
+snapshot_value snapshot_value_of(JsonWrapper wrapper){
+    return snapshot_value { wrapper.bits };
+}
+
+
+std::string snapshot_serialize(json_store& store, JsonWrapper root){
+
+    std::string blob;
+    std::vector<snapshot_span> strings;
+    std::vector<snapshot_number> numbers;
+    std::vector<snapshot_span> arrays;
+    std::vector<snapshot_span> objects;
+    std::vector<snapshot_kv> kvs;
+    std::vector<snapshot_value> values;
+
+    // Lazy strings are written unescaped after the eager strings, and their wrappers renumbered to match
+    strings.reserve(store.strings.size() + store.lazy_strings.size());
+    for(std::string& str : store.strings){
+        strings.push_back({ blob.size(), str.size() });
+        blob.append(str);
+    }
+    for(size_t i = 0; i < store.lazy_strings.size(); i++){
+        std::string_view str = store.get_string_view(JsonWrapper::lazy_string(i));
+        strings.push_back({ blob.size(), str.size() });
+        blob.append(str);
+    }
+    auto value_of = [&](JsonWrapper wrapper){
+        if(wrapper.is_lazy_string())
+            wrapper = JsonWrapper(store.strings.size() + wrapper.store_id(), JSON_TYPE::STRING);
+        return snapshot_value_of(wrapper);
+    };
+
+    numbers.reserve(store.numbers.size());
+    for(json_lazy_number& number : store.numbers){
+        numbers.push_back({ blob.size(), (uint32_t)number.text_length, (uint32_t)number.is_integer });
+        blob.append(store.source_text, number.text_offset, number.text_length);
+    }
+
+    arrays.reserve(store.arrays.size());
+    for(json_array_wrap& array : store.arrays){
+        arrays.push_back({ values.size(), array.size() });
+        for(JsonWrapper& entry : array)
+            values.push_back(value_of(entry));
+    }
+
+    objects.reserve(store.objects.size());
+    for(json_object_wrap& object : store.objects){
+        objects.push_back({ values.size(), object.size() });
+        for(JsonWrapper& entry : object)
+            values.push_back(value_of(entry));
+    }
+
+    kvs.reserve(store.kvs.size());
+    for(json_kv_wrap& kv : store.kvs){
+        kvs.push_back({ { blob.size(), kv.first.size() }, value_of(kv.second) });
+        blob.append(kv.first);
+    }
+
+
+    snapshot_header header {};
+    std::memcpy(header.magic, PHYSON_SNAPSHOT_MAGIC, sizeof(PHYSON_SNAPSHOT_MAGIC));
+    header.version = PHYSON_SNAPSHOT_VERSION;
+    header.byte_order = 0x01020304;
+    header.root = value_of(root);
+
+    std::string buffer;
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    auto add_section = [&](SNAPSHOT_SECTION section, const auto* entries, size_t count){
+        snapshot_align(buffer);
+        header.sections[(int)section] = { buffer.size(), count };
+        snapshot_append(buffer, entries, count);
+    };
+
+    add_section(SNAPSHOT_SECTION::INTEGERS,    store.integers.data(),  store.integers.size());
+    add_section(SNAPSHOT_SECTION::STRINGS,     strings.data(),         strings.size());
+    add_section(SNAPSHOT_SECTION::NUMBERS,     numbers.data(),         numbers.size());
+    add_section(SNAPSHOT_SECTION::ARRAYS,      arrays.data(),          arrays.size());
+    add_section(SNAPSHOT_SECTION::OBJECTS,     objects.data(),         objects.size());
+    add_section(SNAPSHOT_SECTION::KVS,         kvs.data(),             kvs.size());
+    add_section(SNAPSHOT_SECTION::VALUES,      values.data(),          values.size());
+    add_section(SNAPSHOT_SECTION::STRING_BLOB, blob.data(),            blob.size());
+    snapshot_align(buffer);
+
+    header.total_size = buffer.size();
+    std::memcpy(buffer.data(), &header, sizeof(header));
+
+    return buffer;
+}
+
+void snapshot_write(json_store& store, JsonWrapper root, std::string path){
+
+    std::string buffer = snapshot_serialize(store, root);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+        throw std::runtime_error("Failed to open snapshot file for writing: " + path);
+
+    file.write(buffer.data(), buffer.size());
+    if(!file)
+        throw std::runtime_error("Failed to write snapshot file: " + path);
+}
+
+void snapshot_write(Physon& physon, std::string path){
+    snapshot_write(physon.store, physon.root_wrapper, path);
+}
+
+
+
+PhysonSnapshot::PhysonSnapshot(std::string path){
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        snapshot_error("Failed to open snapshot file: " + path);
+
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(snapshot_header)){
+        close(fd);
+        snapshot_error("Snapshot file too small for header: " + path);
+    }
+    size = file_stat.st_size;
+
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED)
+        snapshot_error("Failed to mmap snapshot file: " + path);
+    data = static_cast<const char*>(mapped);
+
+
+    const snapshot_header& head = header();
+
+    if(std::memcmp(head.magic, PHYSON_SNAPSHOT_MAGIC, sizeof(PHYSON_SNAPSHOT_MAGIC)) != 0)
+        snapshot_error("Not a physon snapshot: " + path);
+    if(head.version != PHYSON_SNAPSHOT_VERSION)
+        snapshot_error("Unsupported snapshot version " + std::to_string(head.version));
+    if(head.byte_order != 0x01020304)
+        snapshot_error("Snapshot written with a different byte order.");
+    if(head.total_size != size)
+        snapshot_error("Snapshot size does not match header. Truncated file?");
+
+    const size_t entry_sizes[(int)SNAPSHOT_SECTION::COUNT] = {
+        sizeof(json_int),
+        sizeof(snapshot_span),
+        sizeof(snapshot_number),
+        sizeof(snapshot_span),
+        sizeof(snapshot_span),
+        sizeof(snapshot_kv),
+        sizeof(snapshot_value),
+        sizeof(char),
+    };
+    for(int i = 0; i < (int)SNAPSHOT_SECTION::COUNT; i++){
+        snapshot_span span = head.sections[i];
+        bool in_bounds = span.offset % 8 == 0 && span.offset <= size && span.count <= (size - span.offset) / entry_sizes[i];
+        if(!in_bounds)
+            snapshot_error("Snapshot section " + std::to_string(i) + " out of bounds.");
+    }
+
+    root_wrapper = snapshot_wrapper(head.root);
+}
+
+PhysonSnapshot::~PhysonSnapshot(){
+    if(data != nullptr)
+        munmap((void*)data, size);
+}
+
+JsonWrapper PhysonSnapshot::find(JsonWrapper object_wrapper, std::string_view key){
+
+    for(JsonWrapper kv_wrapper : unwrap_object(object_wrapper)){
+        std::pair<std::string_view, JsonWrapper> kv = unwrap_kv(kv_wrapper);
+        if(kv.first == key)
+            return kv.second;
+    }
+
+    return JsonWrapper();
+}
+
+void PhysonSnapshot::snapshot_error(std::string error_msg){
+
+    if(data != nullptr){
+        munmap((void*)data, size);
+        data = nullptr;
+    }
+
+    throw std::runtime_error(error_msg);
+}
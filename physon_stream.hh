@@ -0,0 +1,469 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <functional>
+#include <type_traits>
+#include <stdexcept>
+#include <charconv> // to_chars
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "physon.hh"
+#include "physon_types.hh"
+#include "physon_traverse.hh"
+
+
+/**
+    Streaming json output through a fixed-size buffer.
+
+    physon_write() serializes a value tree into a PhysonSink, producing the same text as stringify() without
+    materializing it : memory is the buffer plus the traversal stack, and the first bytes reach the sink as soon
+    as the buffer fills. Writes of at least the buffer size go out together with the buffered bytes in one
+    gathered write instead of being copied.
+
+    PhysonStreamBuilder emits json through the same buffer without any store, e.g. to produce a large document
+    from application data in constant memory.
+
+    Usage:
+        PhysonFdSink sink (STDOUT_FILENO);
+        physon_write(physon, sink);
+
+        PhysonStreamBuilder builder (sink);
+        builder.begin_object();
+        builder.key("points");  builder.begin_array();  builder.value(1.0);  builder.end_array();
+        builder.end_object();
+        builder.flush();
+ */
+
+#define PHYSON_STREAM_BUFFER_SIZE 65536 /** Bytes buffered before the sink is written */
+#define PHYSON_STREAM_MAX_DEPTH 1024 /** Max container nesting of a PhysonStreamBuilder */
+
+
+void stream_error(std::string error_msg){
+    throw std::runtime_error("Stream: " + error_msg);
+}
+
+
+/** Destination of streamed json text */
+struct PhysonSink {
+    virtual ~PhysonSink() = default;
+
+    virtual void write(const char* data, size_t size) = 0;
+    /** Both ranges in order. Sinks that can gather override this to save a system call. */
+    virtual void write2(const char* first, size_t first_size, const char* second, size_t second_size){
+        write(first, first_size);
+        write(second, second_size);
+    }
+};
+
+/** Writes to a file descriptor with write/writev, retrying partial writes and EINTR */
+struct PhysonFdSink : PhysonSink {
+
+    int fd;
+
+    PhysonFdSink(int _fd) : fd {_fd} {};
+
+    void write(const char* data, size_t size) override {
+        write2(data, size, nullptr, 0);
+    }
+    void write2(const char* first, size_t first_size, const char* second, size_t second_size) override;
+};
+
+struct PhysonOstreamSink : PhysonSink {
+
+    std::ostream& stream;
+
+    PhysonOstreamSink(std::ostream& _stream) : stream {_stream} {};
+
+    void write(const char* data, size_t size) override {
+        stream.write(data, size);
+        if(!stream)
+            stream_error("ostream write failed.");
+    }
+};
+
+struct PhysonCallbackSink : PhysonSink {
+
+    std::function<void(const char* data, size_t size)> callback;
+
+    PhysonCallbackSink(std::function<void(const char*, size_t)> _callback) : callback {std::move(_callback)} {};
+
+    void write(const char* data, size_t size) override {
+        callback(data, size);
+    }
+};
+
+
+/** Fixed buffer in front of a sink. Call flush() when done; the destructor does not write. */
+struct PhysonStreamWriter {
+
+    PhysonSink& sink;
+    std::vector<char> buffer;
+    size_t used = 0;
+    /** Bytes handed to the sink so far */
+    size_t written = 0;
+
+    PhysonStreamWriter(PhysonSink& _sink, size_t buffer_size = PHYSON_STREAM_BUFFER_SIZE)
+        : sink {_sink}, buffer (buffer_size < 64 ? 64 : buffer_size) {};
+
+    void append(const char* data, size_t size){
+        if(size <= buffer.size() - used){
+            std::memcpy(buffer.data() + used, data, size);
+            used += size;
+            return;
+        }
+        append_slow(data, size);
+    }
+    void append(std::string_view text){
+        append(text.data(), text.size());
+    }
+    void append(char ch){
+        if(used == buffer.size())
+            flush();
+        buffer[used++] = ch;
+    }
+
+    /** text as the body of a json string, escaped like Physon::string_to_json_representation() */
+    void append_escaped(std::string_view text);
+    void append_integer(json_int value);
+    /** Same text as Physon::float_to_json_representation() */
+    void append_float(json_float value);
+
+    void flush(){
+        if(used == 0)
+            return;
+        sink.write(buffer.data(), used);
+        written += used;
+        used = 0;
+    }
+
+private:
+    void append_slow(const char* data, size_t size);
+};
+
+
+/** Writes the json text of value, identical to stringify(value), and flushes */
+void physon_write(Physon& physon, JsonWrapper value, PhysonSink& sink, size_t buffer_size = PHYSON_STREAM_BUFFER_SIZE);
+void physon_write(Physon& physon, PhysonSink& sink);
+
+
+/**
+    Emits json without a store. Calls must form one valid json value : keys only directly inside objects,
+    every object value preceded by key(). Violations throw. Formatting matches stringify().
+ */
+struct PhysonStreamBuilder {
+
+    PhysonStreamWriter writer;
+
+    struct Level {
+        bool is_object;
+        size_t count;
+    };
+    std::vector<Level> levels;
+    /** Inside an object, key() was called and its value is pending */
+    bool after_key = false;
+    bool root_written = false;
+
+    PhysonStreamBuilder(PhysonSink& sink, size_t buffer_size = PHYSON_STREAM_BUFFER_SIZE) : writer {sink, buffer_size} {};
+
+    void begin_array();
+    void end_array();
+    void begin_object();
+    void end_object();
+    void key(std::string_view name);
+
+    void value(json_float number);
+    /** Any integral type but bool */
+    template<typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+    void value(T number){
+        before_value();
+        writer.append_integer((json_int)number);
+    }
+    void value(bool boolean);
+    void value(std::string_view text);
+    void value(const char* text){ value(std::string_view(text)); }
+    void null();
+
+    /** Writes the buffered text. Throws if a container is still open. */
+    void flush();
+
+private:
+    /** Separator before a value and the state checks shared by all values */
+    void before_value();
+    void end_container(bool is_object);
+};
+
+
+
+void PhysonFdSink::write2(const char* first, size_t first_size, const char* second, size_t second_size){
+
+    iovec parts[2] = { { (void*)first, first_size }, { (void*)second, second_size } };
+    iovec* part = parts;
+    int part_count = second_size > 0 ? 2 : 1;
+
+    while(part_count > 0){
+        ssize_t count = ::writev(fd, part, part_count);
+        if(count < 0){
+            if(errno == EINTR)
+                continue;
+            stream_error("write to fd " + std::to_string(fd) + " failed : " + std::strerror(errno));
+        }
+
+        // Drop fully written parts and advance into a partially written one
+        size_t remaining = count;
+        while(part_count > 0 && remaining >= part->iov_len){
+            remaining -= part->iov_len;
+            part++;
+            part_count--;
+        }
+        if(part_count > 0){
+            part->iov_base = (char*)part->iov_base + remaining;
+            part->iov_len -= remaining;
+        }
+    }
+}
+
+
+void PhysonStreamWriter::append_slow(const char* data, size_t size){
+
+    // Large writes skip the buffer : buffered bytes and data leave in one gathered write
+    if(size >= buffer.size()){
+        sink.write2(buffer.data(), used, data, size);
+        written += used + size;
+        used = 0;
+        return;
+    }
+
+    flush();
+    std::memcpy(buffer.data(), data, size);
+    used = size;
+}
+
+void PhysonStreamWriter::append_escaped(std::string_view text){
+
+    const char* hex_digits = "0123456789abcdef";
+    const char* run_start = text.data();
+    const char* end = text.data() + text.size();
+
+    for(const char* c = text.data(); c < end; c++){
+
+        unsigned char ch = *c;
+        if(ch >= 0x20 && ch != QUOTATION_MARK && ch != SOLLIDUS_BACKWARDS)
+            continue;
+
+        // Characters that need no escape are written in runs
+        append(run_start, c - run_start);
+        run_start = c + 1;
+
+        switch (ch){
+        case QUOTATION_MARK:        append("\\\"", 2); break;
+        case SOLLIDUS_BACKWARDS:    append("\\\\", 2); break;
+        case '\b':                  append("\\b", 2);  break;
+        case '\t':                  append("\\t", 2);  break;
+        case '\n':                  append("\\n", 2);  break;
+        case '\f':                  append("\\f", 2);  break;
+        case '\r':                  append("\\r", 2);  break;
+        default:
+            {
+                char escape[6] = { '\\', 'u', '0', '0', hex_digits[ch >> 4], hex_digits[ch & 0x0F] };
+                append(escape, 6);
+            }
+            break;
+        }
+    }
+
+    append(run_start, end - run_start);
+}
+
+void PhysonStreamWriter::append_integer(json_int value){
+    char digits[24];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+    append(digits, result.ptr - digits);
+}
+
+void PhysonStreamWriter::append_float(json_float value){
+    // std::scientific with precision 7, as in float_to_json_representation()
+    char digits[64];
+    int length = std::snprintf(digits, sizeof(digits), "%.7e", value);
+    append(digits, length);
+}
+
+
+/** json_traverse() visitor writing json text to a PhysonStreamWriter */
+struct StreamVisitor {
+
+    json_store& store;
+    PhysonStreamWriter& writer;
+
+    StreamVisitor(json_store& _store, PhysonStreamWriter& _writer) : store {_store}, writer {_writer} {};
+
+    void append_separator(const TraverseEntry& entry){
+        if(entry.depth > 0 && entry.index > 0)
+            writer.append(", ", 2);
+        if(entry.key != nullptr){
+            writer.append(QUOTATION_MARK);
+            writer.append_escaped(*entry.key);
+            writer.append("\": ", 3);
+        }
+    }
+
+    bool enter(const TraverseEntry& entry){
+        append_separator(entry);
+        writer.append(entry.value.type() == JSON_TYPE::ARRAY ? '[' : '{');
+        return true;
+    }
+
+    void leave(const TraverseEntry& entry){
+        writer.append(entry.value.type() == JSON_TYPE::ARRAY ? ']' : '}');
+    }
+
+    void scalar(const TraverseEntry& entry);
+};
+
+void StreamVisitor::scalar(const TraverseEntry& entry){
+
+    append_separator(entry);
+
+    JsonWrapper value = entry.value;
+
+    switch (value.type()){
+    case JSON_TYPE::NULL_:      writer.append("null", 4);   break;
+    case JSON_TYPE::TRUE:       writer.append("true", 4);   break;
+    case JSON_TYPE::FALSE:      writer.append("false", 5);  break;
+    case JSON_TYPE::FLOAT:      writer.append_float(store.get_float(value));       break;
+    case JSON_TYPE::INTEGER:    writer.append_integer(store.get_integer(value));   break;
+    case JSON_TYPE::NUMBER:     writer.append(store.get_number_text(value));       break;
+    case JSON_TYPE::STRING:
+        writer.append(QUOTATION_MARK);
+        if(value.is_lazy_string())
+            writer.append(store.get_string_source(value));
+        else
+            writer.append_escaped(store.strings[value.store_id()]);
+        writer.append(QUOTATION_MARK);
+        break;
+    default:
+        break;
+    }
+}
+
+void physon_write(Physon& physon, JsonWrapper value, PhysonSink& sink, size_t buffer_size){
+
+    PhysonStreamWriter writer (sink, buffer_size);
+    StreamVisitor visitor (physon.store, writer);
+
+    json_traverse(physon.store, value, visitor, physon.stringify_max_depth);
+
+    writer.flush();
+}
+
+void physon_write(Physon& physon, PhysonSink& sink){
+    physon_write(physon, physon.root_wrapper, sink);
+}
+
+
+void PhysonStreamBuilder::before_value(){
+
+    if(levels.empty()){
+        if(root_written)
+            stream_error("builder already wrote a complete value.");
+        root_written = true;
+        return;
+    }
+
+    Level& level = levels.back();
+    if(level.is_object){
+        if(!after_key)
+            stream_error("object value without a key.");
+        after_key = false;
+        return;
+    }
+
+    if(level.count++ > 0)
+        writer.append(", ", 2);
+}
+
+void PhysonStreamBuilder::begin_array(){
+    before_value();
+    if(levels.size() >= PHYSON_STREAM_MAX_DEPTH)
+        stream_error("maximum nesting depth of " + std::to_string(PHYSON_STREAM_MAX_DEPTH) + " exceeded.");
+    levels.push_back({ false, 0 });
+    writer.append('[');
+}
+
+void PhysonStreamBuilder::begin_object(){
+    before_value();
+    if(levels.size() >= PHYSON_STREAM_MAX_DEPTH)
+        stream_error("maximum nesting depth of " + std::to_string(PHYSON_STREAM_MAX_DEPTH) + " exceeded.");
+    levels.push_back({ true, 0 });
+    writer.append('{');
+}
+
+void PhysonStreamBuilder::end_array(){
+    end_container(false);
+}
+
+void PhysonStreamBuilder::end_object(){
+    end_container(true);
+}
+
+void PhysonStreamBuilder::end_container(bool is_object){
+    if(levels.empty() || levels.back().is_object != is_object)
+        stream_error(is_object ? "end_object() without an open object." : "end_array() without an open array.");
+    if(after_key)
+        stream_error("object closed after a key without value.");
+    levels.pop_back();
+    writer.append(is_object ? '}' : ']');
+}
+
+void PhysonStreamBuilder::key(std::string_view name){
+
+    if(levels.empty() || !levels.back().is_object)
+        stream_error("key() outside of an object.");
+    if(after_key)
+        stream_error("key() after a key without value.");
+
+    if(levels.back().count++ > 0)
+        writer.append(", ", 2);
+    writer.append(QUOTATION_MARK);
+    writer.append_escaped(name);
+    writer.append("\": ", 3);
+    after_key = true;
+}
+
+void PhysonStreamBuilder::value(json_float number){
+    before_value();
+    writer.append_float(number);
+}
+
+void PhysonStreamBuilder::value(bool boolean){
+    before_value();
+    if(boolean)
+        writer.append("true", 4);
+    else
+        writer.append("false", 5);
+}
+
+void PhysonStreamBuilder::value(std::string_view text){
+    before_value();
+    writer.append(QUOTATION_MARK);
+    writer.append_escaped(text);
+    writer.append(QUOTATION_MARK);
+}
+
+void PhysonStreamBuilder::null(){
+    before_value();
+    writer.append("null", 4);
+}
+
+void PhysonStreamBuilder::flush(){
+    if(!levels.empty())
+        stream_error("flush() with " + std::to_string(levels.size()) + " open containers.");
+    writer.flush();
+}
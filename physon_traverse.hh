@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include "physon_types.hh"
+
+
+/**
+    Iterative depth-first traversal of a value tree in a json_store.
+
+    Containers are walked with an explicit frame stack instead of recursion, so nesting is bounded
+    by max_depth rather than by the call stack. Entries are read by pointer straight out of the store
+    vectors : while a traversal runs, the visitor must not add arrays, objects or kvs to the traversed
+    store, nor resize a container that is being walked.
+
+    Visitor interface:
+        bool enter(const TraverseEntry& entry)  Array or object, before its entries.
+                                                Return false to skip the entries; leave() is then not called.
+        void leave(const TraverseEntry& entry)  Array or object, after its entries.
+        void scalar(const TraverseEntry& entry) Any other value.
+
+    Object entries are visited as their kv value, with key pointing at the kv key.
+    A KV root is visited the same way.
+ */
+
+#define PHYSON_TRAVERSE_MAX_DEPTH 65536 /** Default max container nesting of a traversal */
+
+
+struct TraverseEntry {
+    JsonWrapper value;
+    /** Containing array or object. NONE for the root. */
+    JsonWrapper parent;
+    /** Object key, nullptr for array entries and a non-KV root */
+    const json_string* key = nullptr;
+    /** Position in parent */
+    size_t index = 0;
+    /** Number of enclosing containers. 0 for the root. */
+    int depth = 0;
+};
+
+struct TraverseFrame {
+    TraverseEntry entry;
+    const JsonWrapper* next;
+    const JsonWrapper* end;
+    size_t next_index;
+};
+
+
+void traverse_error(std::string error_msg){
+    throw std::runtime_error("Traverse: " + error_msg);
+}
+
+template<typename Visitor>
+void json_traverse(json_store& store, JsonWrapper root, Visitor& visitor, int max_depth = PHYSON_TRAVERSE_MAX_DEPTH){
+
+    std::vector<TraverseFrame> stack;
+    stack.reserve(64);
+
+    auto visit = [&](const TraverseEntry& entry){
+
+        JSON_TYPE type = entry.value.type();
+        if(type != JSON_TYPE::ARRAY && type != JSON_TYPE::OBJECT){
+            visitor.scalar(entry);
+            return;
+        }
+
+        if(entry.depth >= max_depth)
+            traverse_error("Maximum nesting depth of " + std::to_string(max_depth) + " exceeded.");
+
+        if(!visitor.enter(entry))
+            return;
+
+        // Object entries are kv wrappers in the same vector type as array entries
+        const json_array_wrap& entries = type == JSON_TYPE::ARRAY
+                                            ? store.get_array(entry.value.store_id())
+                                            : store.get_object(entry.value.store_id());
+        stack.push_back({ entry, entries.data(), entries.data() + entries.size(), 0 });
+    };
+
+
+    TraverseEntry root_entry { root, JsonWrapper(), nullptr, 0, 0 };
+    if(root.type() == JSON_TYPE::KV){
+        json_kv_wrap& kv = store.get_kv(root.store_id());
+        root_entry.value = kv.second;
+        root_entry.key = &kv.first;
+    }
+    visit(root_entry);
+
+    while(!stack.empty()){
+
+        TraverseFrame& frame = stack.back();
+
+        if(frame.next == frame.end){
+            TraverseEntry entry = frame.entry;
+            stack.pop_back();
+            visitor.leave(entry);
+            continue;
+        }
+
+        TraverseEntry child { *frame.next, frame.entry.value, nullptr, frame.next_index, frame.entry.depth + 1 };
+        frame.next++;
+        frame.next_index++;
+
+        if(child.value.type() == JSON_TYPE::KV){
+            json_kv_wrap& kv = store.get_kv(child.value.store_id());
+            child.value = kv.second;
+            child.key = &kv.first;
+        }
+
+        // May push and invalidate frame
+        visit(child);
+    }
+}
@@ -5,6 +5,13 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <charconv> // from_chars
+#include <stdexcept>
+
+#include "physon_unicode.hh"
 
 void print_type_sizes();
 
@@ -28,29 +35,122 @@ enum class JSON_TYPE {
     NONE, /** When no type is valid */
 };
 
-/** JSON value wrapper object.  */
+typedef std::string     json_string;
+typedef bool            json_bool;
+typedef std::nullptr_t  json_null;
+typedef double          json_float;
+typedef long long int   json_int;
+
+/** 
+    JSON value handle, NaN-boxed into 8 bytes.
+
+    A float is stored as its own double bits; NaNs are canonicalized to the positive quiet NaN.
+    Every other value uses the negative NaN space, which no canonical double occupies:
+        bits 63-52  0xFFF
+        bits 51-48  tag : JSON_TYPE + 1, or BIG_INTEGER_TAG. Tag 0 is left to -inf.
+        bits 47-0   payload : inline integer, store id, or 0
+    null, true, false, floats and integers within 48 bits carry their value inline.
+    Strings, arrays, objects, kvs and wider integers reference their store vector by id.
+    A STRING with LAZY_STRING_BIT set references json_store::lazy_strings instead of strings.
+ */
 struct JsonWrapper {
 
-    int store_id = 0; // unique identifier for specific type
-    JSON_TYPE type = JSON_TYPE::NONE;
+    uint64_t bits = box(tag_of(JSON_TYPE::NONE), 0);
+
+    JsonWrapper () {};
+    JsonWrapper (JSON_TYPE _type) : bits {_type == JSON_TYPE::FLOAT ? 0 : box(tag_of(_type), 0)} {};
+    JsonWrapper (int _store_id, JSON_TYPE _type)
+        : bits {box(_type == JSON_TYPE::INTEGER ? BIG_INTEGER_TAG : tag_of(_type), (uint32_t)_store_id)} {};
+
+    static constexpr uint64_t BOX_PREFIX = 0xFFF0000000000000ULL;
+    static constexpr uint64_t PAYLOAD_MASK = 0x0000FFFFFFFFFFFFULL;
+    static constexpr uint64_t CANONICAL_NAN = 0x7FF8000000000000ULL;
+    static constexpr uint64_t BIG_INTEGER_TAG = 12;
+    static constexpr json_int INLINE_INT_MAX = (1LL << 47) - 1;
+    static constexpr json_int INLINE_INT_MIN = -(1LL << 47);
+    static constexpr uint64_t LAZY_STRING_BIT = 1ULL << 47;
+
+    static constexpr uint64_t tag_of(JSON_TYPE _type) { return (uint64_t)_type + 1; }
+    static constexpr uint64_t box(uint64_t tag, uint64_t payload) { return BOX_PREFIX | (tag << 48) | (payload & PAYLOAD_MASK); }
+
+    static JsonWrapper from_float(json_float value){
+        JsonWrapper wrapper;
+        if(value != value)
+            wrapper.bits = CANONICAL_NAN;
+        else
+            std::memcpy(&wrapper.bits, &value, sizeof(value));
+        return wrapper;
+    }
+    static bool int_fits_inline(json_int value){
+        return value >= INLINE_INT_MIN && value <= INLINE_INT_MAX;
+    }
+    /** value must satisfy int_fits_inline */
+    static JsonWrapper from_int(json_int value){
+        JsonWrapper wrapper;
+        wrapper.bits = box(tag_of(JSON_TYPE::INTEGER), (uint64_t)value);
+        return wrapper;
+    }
+    static JsonWrapper lazy_string(int lazy_string_id){
+        JsonWrapper wrapper;
+        wrapper.bits = box(tag_of(JSON_TYPE::STRING), LAZY_STRING_BIT | (uint32_t)lazy_string_id);
+        return wrapper;
+    }
 
-    JsonWrapper () : store_id {0},type {JSON_TYPE::NONE} {};
-    JsonWrapper (JSON_TYPE _type) : type {_type} {};
-    JsonWrapper (int _store_id, JSON_TYPE _type) : store_id {_store_id}, type {_type} {};
+    bool is_boxed() const {
+        return (bits & BOX_PREFIX) == BOX_PREFIX && tag() != 0;
+    }
+    uint64_t tag() const {
+        return (bits >> 48) & 0xF;
+    }
 
-    // equal if identical type and store id
+    JSON_TYPE type() const {
+        if(!is_boxed())
+            return JSON_TYPE::FLOAT;
+        if(tag() == BIG_INTEGER_TAG)
+            return JSON_TYPE::INTEGER;
+        return (JSON_TYPE)(tag() - 1);
+    }
+    /** Index into the store vector of type(). Only meaningful when !is_inline(). */
+    int store_id() const {
+        return (int)(uint32_t)bits;
+    }
+    /** True when the value lives in the handle itself and has no store entry */
+    bool is_inline() const {
+        switch (type()){
+        case JSON_TYPE::STRING:
+        case JSON_TYPE::NUMBER:
+        case JSON_TYPE::ARRAY:
+        case JSON_TYPE::OBJECT:
+        case JSON_TYPE::KV:
+            return false;
+        case JSON_TYPE::INTEGER:
+            return tag() != BIG_INTEGER_TAG;
+        default:
+            return true;
+        }
+    }
+
+    json_float float_value() const {
+        json_float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    bool is_lazy_string() const {
+        return (bits & ~PAYLOAD_MASK) == box(tag_of(JSON_TYPE::STRING), 0) && (bits & LAZY_STRING_BIT);
+    }
+    /** Sign extended 48 bit payload of an inline integer */
+    json_int int_value() const {
+        return (json_int)(bits << 16) >> 16;
+    }
+
+    // equal if identical handle bits
     bool operator==(const JsonWrapper& other) const {
-        return type == other.type && store_id == other.store_id;
+        return bits == other.bits;
     }
 
     bool is_bool();
 };
-
-typedef std::string     json_string;
-typedef bool            json_bool;
-typedef std::nullptr_t  json_null;
-typedef double          json_float;
-typedef long long int   json_int;
+static_assert(sizeof(JsonWrapper) == 8, "JsonWrapper must stay 8 bytes");
 
 // Wrapper containers
 typedef std::pair<json_string, JsonWrapper> json_kv_wrap;
@@ -58,40 +158,37 @@ typedef std::vector<JsonWrapper>            json_array_wrap;
 /** Wraps only kv_wraps */
 typedef std::vector<JsonWrapper>            json_object_wrap;
 
-// Value containers
-struct JsonValue;
-typedef std::vector<JsonValue> json_array_;
-typedef std::vector<JsonValue> json_object_;
-typedef std::pair<json_string, JsonValue> json_kv_;
-
-union JsonUnion {
-    json_string     string_;
-    json_bool       bool_;
-    json_null       null_;
-    json_float      float_;
-    json_int        int_;
-
-    json_array_      array_;
-    json_object_     object_;
-    // json_kv_         kv_;
+/** 
+    Number kept as the span of its checked json text until first decoded.
+    The text lives in json_store::source_text, so it survives edits of the parsed content and moves with the store.
+ */
+struct json_lazy_number {
+    uint64_t text_offset : 40;
+    uint64_t text_length : 22;
+    /** Parse hint : the text has no fraction or exponent */
+    uint64_t is_integer  : 1;
+    /** Value cached in json_store::number_values */
+    uint64_t decoded     : 1;
 };
+static_assert(sizeof(json_lazy_number) == 8, "json_lazy_number must stay 8 bytes");
+#define PHYSON_LAZY_NUMBER_MAX_LENGTH ((1u << 22) - 1) /** Longest number text of a lazy number */
 
-
-struct JsonValue
-{
-    int id;             // Global object index in JsonValue storage
-    JSON_TYPE type_;
-
-    JsonUnion   union_; 
-    
-    // Idea: store kv by simply storing key-string and keeping track of which value
-    // E.g. is type_ = KV -> return pair<> (but pair is not stored in the union itself)
-    // kv_type is the normally store JsonValue-data
-    json_string kv_key_;
-    JSON_TYPE kv_type;
-
+/** 
+    String kept as the span of its checked json text, between the quotes, in json_store::source_text.
+    Without escapes the text is the value itself. Otherwise it is unescaped into json_store::string_blocks on first access.
+ */
+struct json_lazy_string {
+    uint64_t text_offset : 62;
+    uint64_t has_escapes : 1;
+    uint64_t decoded     : 1;
+    uint32_t text_length = 0;
+    uint32_t decoded_length = 0;
+    uint32_t decoded_block = 0;
+    uint32_t decoded_offset = 0;
 };
 
+#define PHYSON_STRING_BLOCK_SIZE 65536 /** Bytes of one block of unescaped lazy strings */
+
 
 void print_type_sizes(){
     std::cout << " sizeof(json_string)  = "  << sizeof(json_string) << std::endl;
@@ -99,12 +196,97 @@ void print_type_sizes(){
     std::cout << " sizeof(json_null)    = "  << sizeof(json_null) << std::endl;
     std::cout << " sizeof(json_float)   = "  << sizeof(json_float) << std::endl;
     std::cout << " sizeof(json_int)     = "  << sizeof(json_int) << std::endl;
+    std::cout << " sizeof(JsonWrapper)  = "  << sizeof(JsonWrapper) << std::endl;
     std::cout << " sizeof(json_kv_wrap)      = "  << sizeof(json_kv_wrap) << std::endl;
     std::cout << " sizeof(json_array_wrap)   = "  << sizeof(json_array_wrap) << std::endl;
     std::cout << " sizeof(json_object_wrap)  = "  << sizeof(json_object_wrap) << std::endl;
 }
 
 
+/** Heap bytes of one component. used counts size(), reserved counts capacity(). */
+struct MemoryUsage {
+    size_t used = 0;
+    size_t reserved = 0;
+
+    MemoryUsage& operator+=(const MemoryUsage& other){
+        used += other.used;
+        reserved += other.reserved;
+        return *this;
+    }
+};
+
+/** Heap buffer of a string. Zero while the string fits the small string buffer. */
+MemoryUsage memory_of(const std::string& str){
+    const char* object_start = reinterpret_cast<const char*>(&str);
+    bool is_inline = str.data() >= object_start && str.data() < object_start + sizeof(str);
+    if(is_inline)
+        return MemoryUsage();
+    return MemoryUsage { str.size() + 1, str.capacity() + 1 };
+}
+
+template<typename T>
+MemoryUsage memory_of(const std::vector<T>& vector){
+    return MemoryUsage { vector.size() * sizeof(T), vector.capacity() * sizeof(T) };
+}
+
+/** Vector buffer plus the heap buffers of each of its strings/vectors */
+template<typename T>
+MemoryUsage memory_of_nested(const std::vector<T>& vector){
+    MemoryUsage usage = memory_of(vector);
+    for(const T& entry : vector)
+        usage += memory_of(entry);
+    return usage;
+}
+
+struct PhysonMemoryReport {
+
+    MemoryUsage bools;
+    MemoryUsage integers;
+    MemoryUsage strings;
+    MemoryUsage numbers;
+    MemoryUsage source;
+    MemoryUsage arrays;
+    MemoryUsage objects;
+    MemoryUsage kvs;
+
+    MemoryUsage tokens;
+    MemoryUsage content;
+    MemoryUsage stringify_string;
+    MemoryUsage stringify_cache;
+    MemoryUsage spans;
+    /** Cursor stacks of the parser. They keep their capacity between parses. */
+    MemoryUsage parser;
+
+    MemoryUsage total;
+
+    size_t input_bytes = 0;
+    /** Reserved bytes per content byte */
+    double amplification = 0.0;
+
+    void print(){
+        auto print_usage = [](const char* name, MemoryUsage usage){
+            std::cout << " " << name << " used = " << usage.used << ", reserved = " << usage.reserved << std::endl;
+        };
+        print_usage("bools           ", bools);
+        print_usage("integers        ", integers);
+        print_usage("strings         ", strings);
+        print_usage("numbers         ", numbers);
+        print_usage("source          ", source);
+        print_usage("arrays          ", arrays);
+        print_usage("objects         ", objects);
+        print_usage("kvs             ", kvs);
+        print_usage("tokens          ", tokens);
+        print_usage("content         ", content);
+        print_usage("stringify_string", stringify_string);
+        print_usage("stringify_cache ", stringify_cache);
+        print_usage("spans           ", spans);
+        print_usage("parser          ", parser);
+        print_usage("total           ", total);
+        std::cout << " input bytes = " << input_bytes << ", amplification = " << amplification << std::endl;
+    }
+};
+
+
 /** 
     JSON data storage. 
     The json object/array vectors store the array/object tree.
@@ -113,8 +295,16 @@ struct json_store {
 
     std::vector<json_bool>      bools;
     std::vector<json_int>       integers;
-    std::vector<json_float>     floats;
     std::vector<std::string>    strings;
+    /** Json text referenced by lazy numbers and strings. A lazy parse copies the whole content here once. */
+    std::string                     source_text;
+    /** Lazily decoded numbers and their decoded int or double bits */
+    std::vector<json_lazy_number>   numbers;
+    std::vector<uint64_t>           number_values;
+    /** Lazily unescaped strings and the blocks holding their unescaped text */
+    std::vector<json_lazy_string>   lazy_strings;
+    /** Never grown past their capacity, so views into them stay valid */
+    std::vector<std::string>        string_blocks;
     
 
     std::vector<json_array_wrap>     arrays;
@@ -130,38 +320,180 @@ struct json_store {
     //     return bools[id];
     // }
 
+    /** Inline unless the value needs more than 48 bits */
     JsonWrapper new_integer(long long int value){
+        if(JsonWrapper::int_fits_inline(value))
+            return JsonWrapper::from_int(value);
         integers.emplace_back(value);
         return JsonWrapper(integers.size()-1, JSON_TYPE::INTEGER);
     }
-    json_int& get_integer(int id){
-        return integers[id];
+    /** integer may also be a NUMBER wrapper whose value_type() is INTEGER */
+    json_int get_integer(JsonWrapper integer) const {
+        if(integer.type() == JSON_TYPE::NUMBER){
+            const json_lazy_number& number = numbers[integer.store_id()];
+            return number.decoded ? (json_int)number_values[integer.store_id()] : number_text_value<json_int>(number);
+        }
+        if(integer.is_inline())
+            return integer.int_value();
+        return integers[integer.store_id()];
     }
 
+    /** Floats are always inline */
     JsonWrapper new_float(double value){
-        floats.emplace_back(value);
-        return JsonWrapper(floats.size()-1, JSON_TYPE::FLOAT);
+        return JsonWrapper::from_float(value);
+    }
+    /** float_ may also be any NUMBER wrapper */
+    json_float get_float(JsonWrapper float_) const {
+        if(float_.type() == JSON_TYPE::NUMBER){
+            const json_lazy_number& number = numbers[float_.store_id()];
+            if(!number.decoded)
+                return number_text_value<json_float>(number);
+            uint64_t bits = number_values[float_.store_id()];
+            if(number.is_integer)
+                return (json_float)(json_int)bits;
+            json_float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        return float_.float_value();
+    }
+
+    /** 
+        Lazy number of checked json text, see PhysonStrictPolicy::decode_numbers.
+        The const getters decode the text on every call until decode_number() caches the value.
+     */
+    JsonWrapper new_number(const char* text, size_t length, bool is_integer){
+        size_t text_offset = source_text.size();
+        source_text.append(text, length);
+        return add_number(text_offset, length, is_integer);
+    }
+    /** Lazy number of text already in source_text. length is at most PHYSON_LAZY_NUMBER_MAX_LENGTH. */
+    JsonWrapper add_number(size_t text_offset, size_t length, bool is_integer){
+        numbers.push_back({ text_offset, length, is_integer, false });
+        return JsonWrapper(numbers.size() - 1, JSON_TYPE::NUMBER);
     }
-    json_float& get_float(int id){
-        return floats[id];
+    /** Decodes a NUMBER wrapper once and caches the value for later getter calls */
+    void decode_number(JsonWrapper number_wrapper){
+        json_lazy_number& number = numbers[number_wrapper.store_id()];
+        if(number.decoded)
+            return;
+        if(number_values.size() < numbers.size())
+            number_values.resize(numbers.size());
+        if(number.is_integer){
+            number_values[number_wrapper.store_id()] = (uint64_t)number_text_value<json_int>(number);
+        }
+        else {
+            json_float value = number_text_value<json_float>(number);
+            std::memcpy(&number_values[number_wrapper.store_id()], &value, sizeof(value));
+        }
+        number.decoded = true;
+    }
+    /** Source text of a NUMBER wrapper, for exact re-serialization */
+    std::string_view get_number_text(JsonWrapper number_wrapper) const {
+        const json_lazy_number& number = numbers[number_wrapper.store_id()];
+        return std::string_view(source_text.data() + number.text_offset, number.text_length);
+    }
+    /** INTEGER or FLOAT for a NUMBER wrapper, by its parse hint. type() for every other wrapper. */
+    JSON_TYPE value_type(JsonWrapper wrapper) const {
+        if(wrapper.type() != JSON_TYPE::NUMBER)
+            return wrapper.type();
+        return numbers[wrapper.store_id()].is_integer ? JSON_TYPE::INTEGER : JSON_TYPE::FLOAT;
+    }
+    template<typename T>
+    T number_text_value(const json_lazy_number& number) const {
+        const char* text = source_text.data() + number.text_offset;
+        T value {};
+        std::from_chars_result result = std::from_chars(text, text + number.text_length, value);
+        if(result.ec != std::errc())
+            throw std::runtime_error("Number " + std::string(text, number.text_length) + " out of range for internal representation.");
+        return value;
     }
 
     int add_string(std::string new_str){
-        strings.push_back(new_str);
+        strings.push_back(std::move(new_str));
         return strings.size() - 1;
     }
+    /** Only for eager strings, see get_string_view() */
     std::string& get_string(int id){
         return strings[id];
     }
 
+    /** Value of any STRING wrapper. An escaped lazy string is unescaped once, on first access. */
+    std::string_view get_string_view(JsonWrapper string){
+        if(string.is_lazy_string())
+            decode_string(string);
+        return static_cast<const json_store&>(*this).get_string_view(string);
+    }
+    /** Lazy strings with escapes must have been decoded, e.g. by decode_strings() */
+    std::string_view get_string_view(JsonWrapper string) const {
+        if(!string.is_lazy_string())
+            return strings[string.store_id()];
+
+        const json_lazy_string& lazy = lazy_strings[string.store_id()];
+        if(!lazy.has_escapes)
+            return std::string_view(source_text.data() + lazy.text_offset, lazy.text_length);
+        if(!lazy.decoded)
+            throw std::runtime_error("Lazy string read through a const store before it was decoded.");
+        return std::string_view(string_blocks[lazy.decoded_block].data() + lazy.decoded_offset, lazy.decoded_length);
+    }
+    /** Compares without unescaping when the string has no escapes */
+    bool string_equals(JsonWrapper string, std::string_view other){
+        return get_string_view(string) == other;
+    }
+    /** Json text between the quotes of a lazy string, escapes included */
+    std::string_view get_string_source(JsonWrapper lazy_string) const {
+        const json_lazy_string& lazy = lazy_strings[lazy_string.store_id()];
+        return std::string_view(source_text.data() + lazy.text_offset, lazy.text_length);
+    }
+
+    /** Lazy string of checked json text already in source_text */
+    JsonWrapper add_lazy_string(size_t text_offset, size_t length, bool has_escapes){
+        json_lazy_string& lazy = lazy_strings.emplace_back();
+        lazy.text_offset = text_offset;
+        lazy.has_escapes = has_escapes;
+        lazy.decoded = false;
+        lazy.text_length = length;
+        return JsonWrapper::lazy_string(lazy_strings.size() - 1);
+    }
+    JsonWrapper new_lazy_string(std::string_view text, bool has_escapes){
+        size_t text_offset = source_text.size();
+        source_text.append(text);
+        return add_lazy_string(text_offset, text.size(), has_escapes);
+    }
+    void decode_string(JsonWrapper lazy_string){
+
+        json_lazy_string& lazy = lazy_strings[lazy_string.store_id()];
+        if(!lazy.has_escapes || lazy.decoded)
+            return;
+
+        // Unescaped text is never longer than the json text
+        size_t capacity = lazy.text_length;
+        if(string_blocks.empty() || string_blocks.back().capacity() - string_blocks.back().size() < capacity){
+            // Reserving more than the small string buffer keeps every block on the heap
+            string_blocks.emplace_back().reserve(std::max((size_t)PHYSON_STRING_BLOCK_SIZE, capacity));
+        }
+
+        std::string& block = string_blocks.back();
+        size_t offset = block.size();
+        block.resize(offset + capacity);
+        char* out_end = json_unescape(source_text.data() + lazy.text_offset, lazy.text_length, block.data() + offset);
+        block.resize(out_end - block.data());
+
+        lazy.decoded_block = string_blocks.size() - 1;
+        lazy.decoded_offset = offset;
+        lazy.decoded_length = block.size() - offset;
+        lazy.decoded = true;
+    }
+    /** Unescape every pending lazy string, so the const getters can read all of them */
+    void decode_strings(){
+        for(size_t i = 0; i < lazy_strings.size(); i++)
+            decode_string(JsonWrapper::lazy_string(i));
+    }
+
     JsonWrapper new_array(){
         arrays.emplace_back();
 
-        JsonWrapper array;
-        array.store_id = arrays.size() - 1;
-        array.type = JSON_TYPE::ARRAY;
-
-        return array;
+        return JsonWrapper(arrays.size() - 1, JSON_TYPE::ARRAY);
     }
     json_array_wrap& get_array(int id){
         return arrays[id];
@@ -170,11 +502,7 @@ struct json_store {
     JsonWrapper new_object(){
         objects.emplace_back();
 
-        JsonWrapper object;
-        object.store_id = objects.size() - 1;
-        object.type = JSON_TYPE::OBJECT;
-
-        return object;
+        return JsonWrapper(objects.size() - 1, JSON_TYPE::OBJECT);
     }
     json_object_wrap& get_object(int id){
         return objects[id];
@@ -183,7 +511,7 @@ struct json_store {
         
         // Store key-string
         json_kv_wrap& kv = kvs.emplace_back();
-        kv.first = key;
+        kv.first = std::move(key);
 
         JsonWrapper value (kvs.size()-1, JSON_TYPE::KV);
 
@@ -193,17 +521,197 @@ struct json_store {
         return kvs[id];
     }
 
+    /** Store id of wrapper shifted by the given per-type offsets. Inline values are unchanged. */
+    JsonWrapper offset_wrapper(JsonWrapper wrapper, int integer_offset, int string_offset, int lazy_string_offset, int number_offset, int array_offset, int object_offset, int kv_offset){
+        if(wrapper.is_inline())
+            return wrapper;
+        switch (wrapper.type()){
+        case JSON_TYPE::INTEGER:    return JsonWrapper(wrapper.store_id() + integer_offset, JSON_TYPE::INTEGER);
+        case JSON_TYPE::STRING:
+            if(wrapper.is_lazy_string())
+                return JsonWrapper::lazy_string(wrapper.store_id() + lazy_string_offset);
+            return JsonWrapper(wrapper.store_id() + string_offset,  JSON_TYPE::STRING);
+        case JSON_TYPE::NUMBER:     return JsonWrapper(wrapper.store_id() + number_offset,  JSON_TYPE::NUMBER);
+        case JSON_TYPE::ARRAY:      return JsonWrapper(wrapper.store_id() + array_offset,   JSON_TYPE::ARRAY);
+        case JSON_TYPE::OBJECT:     return JsonWrapper(wrapper.store_id() + object_offset,  JSON_TYPE::OBJECT);
+        case JSON_TYPE::KV:         return JsonWrapper(wrapper.store_id() + kv_offset,      JSON_TYPE::KV);
+        default:                    return wrapper;
+        }
+    }
+
+    /** Append every value of other to this store. Returns other_root pointing at the appended copy. */
+    JsonWrapper append_store(json_store& other, JsonWrapper other_root){
+
+        int integer_offset = integers.size();
+        int string_offset = strings.size();
+        int lazy_string_offset = lazy_strings.size();
+        int number_offset = numbers.size();
+        uint64_t source_offset = source_text.size();
+        int block_offset = string_blocks.size();
+        int array_offset = arrays.size();
+        int object_offset = objects.size();
+        int kv_offset = kvs.size();
+
+        auto offset = [&](JsonWrapper wrapper){
+            return offset_wrapper(wrapper, integer_offset, string_offset, lazy_string_offset, number_offset, array_offset, object_offset, kv_offset);
+        };
+
+        integers.insert(integers.end(), other.integers.begin(), other.integers.end());
+        for(std::string& str : other.strings)
+            strings.push_back(std::move(str));
+
+        source_text.append(other.source_text);
+        for(json_lazy_number number : other.numbers){
+            number.text_offset += source_offset;
+            numbers.push_back(number);
+        }
+        if(!other.number_values.empty()){
+            number_values.resize(number_offset);
+            number_values.insert(number_values.end(), other.number_values.begin(), other.number_values.end());
+        }
+        for(json_lazy_string lazy : other.lazy_strings){
+            lazy.text_offset += source_offset;
+            lazy.decoded_block += block_offset;
+            lazy_strings.push_back(lazy);
+        }
+        // Moving a heap string keeps its buffer, so views into the blocks stay valid
+        for(std::string& block : other.string_blocks)
+            string_blocks.push_back(std::move(block));
+
+        for(json_array_wrap& array : other.arrays){
+            for(JsonWrapper& entry : array)
+                entry = offset(entry);
+            arrays.push_back(std::move(array));
+        }
+        for(json_object_wrap& object : other.objects){
+            for(JsonWrapper& entry : object)
+                entry = offset(entry);
+            objects.push_back(std::move(object));
+        }
+        for(json_kv_wrap& kv : other.kvs){
+            kv.second = offset(kv.second);
+            kvs.push_back(std::move(kv));
+        }
+
+        other.clear();
+
+        return offset(other_root);
+    }
+
+    /** Fills the store components of report */
+    void memory_report(PhysonMemoryReport& report){
+        report.bools = memory_of(bools);
+        report.integers = memory_of(integers);
+        report.strings = memory_of_nested(strings);
+        report.strings += memory_of(lazy_strings);
+        report.strings += memory_of_nested(string_blocks);
+        report.numbers = memory_of(numbers);
+        report.numbers += memory_of(number_values);
+        report.source = memory_of(source_text);
+        report.arrays = memory_of_nested(arrays);
+        report.objects = memory_of_nested(objects);
+
+        report.kvs = memory_of(kvs);
+        for(json_kv_wrap& kv : kvs)
+            report.kvs += memory_of(kv.first);
+    }
+
     void clear() {
+        bools.clear();
         integers.clear();
-        floats.clear();
         strings.clear();
+        numbers.clear();
+        source_text.clear();
+        number_values.clear();
+        lazy_strings.clear();
+        string_blocks.clear();
         objects.clear();
         arrays.clear();
+        kvs.clear();
+    }
+
+};
+
+
+/** 
+    Serialized text of containers, kept between stringify() calls.
+    A mutation clears the entries of the changed container and all of its ancestors.
+ */
+struct StringifyCache {
+
+    std::vector<std::string>    array_strings;
+    std::vector<std::string>    object_strings;
+    std::vector<bool>           array_valid;
+    std::vector<bool>           object_valid;
+
+    /** Containing array or object. NONE for the root and for detached containers. */
+    std::vector<JsonWrapper>    array_parents;
+    std::vector<JsonWrapper>    object_parents;
+    /** Set once the parents of the whole document are recorded, on the first mutation after a clear() */
+    bool parents_recorded = false;
+
+    /** Containers placed in more than one container. Only their first parent is recorded, so nothing holding them is cached. */
+    std::vector<bool>           array_shared;
+    std::vector<bool>           object_shared;
+
+    /** Grows the per-container vectors to match store sizes */
+    void fit(json_store& store){
+        array_strings.resize(store.arrays.size());
+        array_valid.resize(store.arrays.size(), false);
+        array_parents.resize(store.arrays.size());
+        array_shared.resize(store.arrays.size(), false);
+        object_strings.resize(store.objects.size());
+        object_valid.resize(store.objects.size(), false);
+        object_parents.resize(store.objects.size());
+        object_shared.resize(store.objects.size(), false);
     }
 
+    JsonWrapper& parent(JsonWrapper container){
+        return container.type() == JSON_TYPE::ARRAY ? array_parents[container.store_id()] : object_parents[container.store_id()];
+    }
+    bool is_shared(JsonWrapper container){
+        return container.type() == JSON_TYPE::ARRAY ? array_shared[container.store_id()] : object_shared[container.store_id()];
+    }
+    void set_shared(JsonWrapper container){
+        if(container.type() == JSON_TYPE::ARRAY)
+            array_shared[container.store_id()] = true;
+        else
+            object_shared[container.store_id()] = true;
+    }
+
+    MemoryUsage memory_usage(){
+        MemoryUsage usage;
+        usage += memory_of_nested(array_strings);
+        usage += memory_of_nested(object_strings);
+        usage += MemoryUsage { array_valid.size() / 8, array_valid.capacity() / 8 };
+        usage += MemoryUsage { object_valid.size() / 8, object_valid.capacity() / 8 };
+        usage += memory_of(array_parents);
+        usage += memory_of(object_parents);
+        usage += MemoryUsage { array_shared.size() / 8, array_shared.capacity() / 8 };
+        usage += MemoryUsage { object_shared.size() / 8, object_shared.capacity() / 8 };
+        return usage;
+    }
+
+    void clear() {
+        array_strings.clear();
+        object_strings.clear();
+        array_valid.clear();
+        object_valid.clear();
+        array_parents.clear();
+        object_parents.clear();
+        array_shared.clear();
+        object_shared.clear();
+        parents_recorded = false;
+    }
 };
 
 
+/** Source index of the opening and closing char of a container in the content string */
+struct SourceSpan {
+    size_t start = 0;
+    size_t end = 0;
+};
+
 
 enum class token_type {
 
@@ -219,6 +727,9 @@ enum class token_type {
     RIGHT_CURLY,
     COLON,
     COMMA,
+
+    END,        /** end of content */
+    INVALID,    /** byte that starts no token */
 };
 
 struct Token {
@@ -226,7 +737,14 @@ struct Token {
     token_type type;
     int str_start_i;
     int str_length;
-
+    /** STRING : the text holds escapes */
+    bool has_escapes = false;
+    /** NUMBER : fraction or exponent */
+    bool is_fractional = false;
+    /** NUMBER : the decoded inline value, if the lexer decoded it. NONE otherwise. */
+    JsonWrapper number;
+
+    Token() : type(token_type::END), str_start_i(0), str_length(0) {}
     Token(token_type type, int str_start_i, int str_length) 
         : type(type), str_start_i(str_start_i), str_length(str_length) {}
 };
@@ -261,7 +779,160 @@ struct ParserCursor {
     // json_element current_element;             // element cursor
     // json_element current_container;           // container cursor
     // JSON_TYPE current_container_type; // current container type (array or object)
-    std::stack<JsonWrapper> container_trace; // stack of current container level
+    std::vector<JsonWrapper> container_trace; // open arrays and objects, innermost last
+    /** Entries of all open containers, innermost last. Moved into the container in one exact-size copy when it closes. */
+    std::vector<JsonWrapper> entry_stack;
+    /** entry_stack index of the first entry of each open container */
+    std::vector<size_t> entry_starts;
+
+};
+
+
+/** 
+    Compile-time options of Physon::parse<Policy>().
+    Every policy instantiates its own parse core, and disabled options are discarded with if constexpr.
+    New policies derive from PhysonStrictPolicy and override the flags they change.
+ */
+struct PhysonStrictPolicy {
+    /** Line (//) and block comments wherever whitespace is allowed */
+    static constexpr bool allow_comments = false;
+    /** A ',' directly before the closing ']' or '}' */
+    static constexpr bool allow_trailing_commas = false;
+    /** 
+        Convert numbers to INTEGER/FLOAT while parsing.
+        Otherwise only the checked text and an integer/float hint are kept, as a NUMBER wrapper decoded on first unwrap.
+     */
+    static constexpr bool decode_numbers = true;
+    /** 
+        Unescape strings into STRING wrappers while parsing.
+        Otherwise strings are kept as checked source spans : read in place when free of escapes, unescaped on first access otherwise.
+        Object keys are always unescaped.
+     */
+    static constexpr bool decode_strings = true;
+    /** Reject objects with a repeated key */
+    static constexpr bool reject_duplicate_keys = false;
+    /** Check that content is UTF-8 before parsing. Only trusted input should skip it. */
+    static constexpr bool validate_utf8 = true;
+    /** Stop with a PhysonBudgetError once the parse exceeds Physon::budget */
+    static constexpr bool enforce_budget = false;
+};
+
+/** Hand-written config files */
+struct PhysonConfigPolicy : PhysonStrictPolicy {
+    static constexpr bool allow_comments = true;
+    static constexpr bool allow_trailing_commas = true;
+    static constexpr bool reject_duplicate_keys = true;
+};
+
+/** Input produced by a known-good writer */
+struct PhysonTrustedPolicy : PhysonStrictPolicy {
+    static constexpr bool validate_utf8 = false;
+};
+
+/** Documents of which few numbers are read. Numbers also re-serialize byte-identical. */
+struct PhysonLazyNumberPolicy : PhysonStrictPolicy {
+    static constexpr bool decode_numbers = false;
+};
+
+/** Documents mostly passed through untouched : numbers and strings are only decoded when read */
+struct PhysonLazyPolicy : PhysonStrictPolicy {
+    static constexpr bool decode_numbers = false;
+    static constexpr bool decode_strings = false;
+};
+
+/** Input from untrusted clients : strict syntax within the limits of Physon::budget */
+struct PhysonUntrustedPolicy : PhysonStrictPolicy {
+    static constexpr bool enforce_budget = true;
+};
+
+
+/** 
+    Cost limits of one parse, enforced with Policy::enforce_budget. 0 disables a limit.
+    store_bytes is the estimated heap use of the store entries as they are added, excluding vector slack.
+ */
+struct PhysonBudget {
+    size_t max_depth = 0;
+    /** json text bytes of one string or key, escapes included */
+    size_t max_string_bytes = 0;
+    /** Values of any type, containers included. Keys are not counted. */
+    size_t max_values = 0;
+    size_t max_store_bytes = 0;
+};
 
+/** Limit of PhysonBudget that stopped a parse */
+enum class PHYSON_BUDGET {
+    DEPTH,
+    STRING_BYTES,
+    VALUES,
+    STORE_BYTES,
+};
+
+struct PhysonBudgetError : std::runtime_error {
+    PHYSON_BUDGET code;
+    /** Content index at which the parse stopped */
+    size_t index;
+
+    PhysonBudgetError(PHYSON_BUDGET _code, size_t _index, const std::string& message)
+        : std::runtime_error {message}, code {_code}, index {_index} {};
+};
+
+
+/** Parser dispatch class of a content byte */
+enum class CHAR_CLASS : uint8_t {
+    INVALID = 0,
+    WHITESPACE,
+    STRING,         /** opening quotation mark */
+    NUMBER,         /** '-' or digit */
+    TRUE_,          /** 't' */
+    FALSE_,         /** 'f' */
+    NULL_,          /** 'n' */
+    ARRAY_OPEN,
+    ARRAY_CLOSE,
+    OBJECT_OPEN,
+    OBJECT_CLOSE,
+    COMMA,
+    COLON,
+};
+
+/** 
+    Byte lookup tables of the parser.
+    string_stop marks the bytes that end a plain run inside a string : '"', '\\' and control characters (incl. the terminating '\0').
+    skip_stop marks the bytes the skip scanner of a projected parse stops at inside a skipped container :
+    quotation mark, brackets, braces, '/' for comments and the terminating '\0'.
+ */
+struct CharClassTable {
+    CHAR_CLASS classes[256];
+    bool string_stop[256];
+    bool skip_stop[256];
+
+    constexpr CharClassTable() : classes {}, string_stop {}, skip_stop {} {
+        for(int i = 0; i < 256; i++){
+            classes[i] = CHAR_CLASS::INVALID;
+            string_stop[i] = i < 0x20 || i == '"' || i == '\\';
+            skip_stop[i] = i == 0 || i == '"' || i == '[' || i == ']' || i == '{' || i == '}' || i == '/';
+        }
+        classes[(int)' ']  = CHAR_CLASS::WHITESPACE;
+        classes[(int)'\t'] = CHAR_CLASS::WHITESPACE;
+        classes[(int)'\n'] = CHAR_CLASS::WHITESPACE;
+        classes[(int)'\r'] = CHAR_CLASS::WHITESPACE;
+        classes[(int)'"']  = CHAR_CLASS::STRING;
+        classes[(int)'-']  = CHAR_CLASS::NUMBER;
+        for(int i = '0'; i <= '9'; i++)
+            classes[i] = CHAR_CLASS::NUMBER;
+        classes[(int)'t']  = CHAR_CLASS::TRUE_;
+        classes[(int)'f']  = CHAR_CLASS::FALSE_;
+        classes[(int)'n']  = CHAR_CLASS::NULL_;
+        classes[(int)'[']  = CHAR_CLASS::ARRAY_OPEN;
+        classes[(int)']']  = CHAR_CLASS::ARRAY_CLOSE;
+        classes[(int)'{']  = CHAR_CLASS::OBJECT_OPEN;
+        classes[(int)'}']  = CHAR_CLASS::OBJECT_CLOSE;
+        classes[(int)',']  = CHAR_CLASS::COMMA;
+        classes[(int)':']  = CHAR_CLASS::COLON;
+    }
+
+    CHAR_CLASS of(char c) const {
+        return classes[(unsigned char)c];
+    }
 };
+constexpr CharClassTable char_class_table;
 
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PHYSON_UTF8_SSSE3
+#endif
+
+
+/**
+    Unicode helpers for the parser : hex escape decoding, UTF-8 encoding of code points and UTF-8 validation.
+
+    utf8_validate() checks 16 bytes per step with SSSE3 when the cpu supports it (checked once at runtime),
+    using the nibble lookup tables of Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+    All-ASCII blocks only cost a movemask. Other targets use the scalar validator.
+ */
+
+
+/** Value of a hex digit char, -1 for any other char */
+struct HexTable {
+    int8_t values[256];
+
+    constexpr HexTable() : values {} {
+        for(int i = 0; i < 256; i++)
+            values[i] = -1;
+        for(int i = 0; i < 10; i++)
+            values['0' + i] = i;
+        for(int i = 0; i < 6; i++){
+            values['a' + i] = 10 + i;
+            values['A' + i] = 10 + i;
+        }
+    }
+};
+constexpr HexTable hex_table;
+
+/** Value of the four hex digits at c. Negative if any of them is not a hex digit. */
+inline int hex4_value(const char* c){
+    int d0 = hex_table.values[(unsigned char)c[0]];
+    int d1 = hex_table.values[(unsigned char)c[1]];
+    int d2 = hex_table.values[(unsigned char)c[2]];
+    int d3 = hex_table.values[(unsigned char)c[3]];
+
+    // Any -1 digit makes the or negative
+    if((d0 | d1 | d2 | d3) < 0)
+        return -1;
+
+    return (d0 << 12) | (d1 << 8) | (d2 << 4) | d3;
+}
+
+inline bool is_high_surrogate(uint32_t code_unit){
+    return code_unit >= 0xD800 && code_unit <= 0xDBFF;
+}
+inline bool is_low_surrogate(uint32_t code_unit){
+    return code_unit >= 0xDC00 && code_unit <= 0xDFFF;
+}
+
+/** Append code point as 1-4 UTF-8 bytes */
+inline void append_utf8(std::string& str, uint32_t code_point){
+
+    if(code_point < 0x80){
+        str += (char)code_point;
+    }
+    else if(code_point < 0x800){
+        str += (char)(0xC0 | (code_point >> 6));
+        str += (char)(0x80 | (code_point & 0x3F));
+    }
+    else if(code_point < 0x10000){
+        str += (char)(0xE0 | (code_point >> 12));
+        str += (char)(0x80 | ((code_point >> 6) & 0x3F));
+        str += (char)(0x80 | (code_point & 0x3F));
+    }
+    else {
+        str += (char)(0xF0 | (code_point >> 18));
+        str += (char)(0x80 | ((code_point >> 12) & 0x3F));
+        str += (char)(0x80 | ((code_point >> 6) & 0x3F));
+        str += (char)(0x80 | (code_point & 0x3F));
+    }
+}
+
+/** Write code point as 1-4 UTF-8 bytes at out. Returns the end of the written bytes. */
+inline char* write_utf8(char* out, uint32_t code_point){
+
+    if(code_point < 0x80){
+        *out++ = (char)code_point;
+    }
+    else if(code_point < 0x800){
+        *out++ = (char)(0xC0 | (code_point >> 6));
+        *out++ = (char)(0x80 | (code_point & 0x3F));
+    }
+    else if(code_point < 0x10000){
+        *out++ = (char)(0xE0 | (code_point >> 12));
+        *out++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code_point & 0x3F));
+    }
+    else {
+        *out++ = (char)(0xF0 | (code_point >> 18));
+        *out++ = (char)(0x80 | ((code_point >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code_point & 0x3F));
+    }
+    return out;
+}
+
+/** 
+    Unescape the text between the quotes of a json string already checked by the parser.
+    The result is never longer than the text, so out needs at most length bytes. Returns the end of the written bytes.
+ */
+inline char* json_unescape(const char* text, size_t length, char* out){
+
+    const char* end = text + length;
+
+    while(text < end){
+
+        const char* escape = static_cast<const char*>(std::memchr(text, '\\', end - text));
+        if(escape == nullptr)
+            escape = end;
+        std::memcpy(out, text, escape - text);
+        out += escape - text;
+        text = escape;
+        if(text == end)
+            break;
+
+        // Char after backslash
+        text++;
+        switch (*text){
+        case 'b': *out++ = '\b'; break;
+        case 'f': *out++ = '\f'; break;
+        case 'n': *out++ = '\n'; break;
+        case 'r': *out++ = '\r'; break;
+        case 't': *out++ = '\t'; break;
+        case 'u':
+            {
+                uint32_t code_point = hex4_value(text + 1);
+                if(is_high_surrogate(code_point)){
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (hex4_value(text + 7) - 0xDC00);
+                    text += 6;
+                }
+                out = write_utf8(out, code_point);
+                text += 4;
+            }
+            break;
+        default:
+            // '"', '\\' and '/' stand for themselves
+            *out++ = *text;
+            break;
+        }
+        text++;
+    }
+
+    return out;
+}
+
+
+/** Rejects overlong forms, surrogates, values above U+10FFFF and truncated sequences */
+inline bool utf8_validate_scalar(const unsigned char* c, size_t size){
+
+    const unsigned char* end = c + size;
+
+    while(c < end){
+
+        unsigned char ch = *c;
+
+        if(ch < 0x80){
+            c++;
+            continue;
+        }
+
+        int length;
+        unsigned char min_second = 0x80;
+        unsigned char max_second = 0xBF;
+
+        if     (ch >= 0xC2 && ch <= 0xDF)
+            length = 2;
+        else if(ch >= 0xE0 && ch <= 0xEF){
+            length = 3;
+            if(ch == 0xE0) min_second = 0xA0;
+            if(ch == 0xED) max_second = 0x9F;
+        }
+        else if(ch >= 0xF0 && ch <= 0xF4){
+            length = 4;
+            if(ch == 0xF0) min_second = 0x90;
+            if(ch == 0xF4) max_second = 0x8F;
+        }
+        else
+            return false;
+
+        if(end - c < length)
+            return false;
+
+        if(c[1] < min_second || c[1] > max_second)
+            return false;
+
+        for(int i = 2; i < length; i++){
+            if(c[i] < 0x80 || c[i] > 0xBF)
+                return false;
+        }
+
+        c += length;
+    }
+
+    return true;
+}
+
+
+#ifdef PHYSON_UTF8_SSSE3
+
+/** Error bits for the byte pair (previous byte, current byte) */
+#define UTF8_TOO_SHORT      (1 << 0)   /** lead byte or ASCII followed by lead byte */
+#define UTF8_TOO_LONG       (1 << 1)   /** ASCII followed by continuation */
+#define UTF8_OVERLONG_3     (1 << 2)
+#define UTF8_TOO_LARGE      (1 << 3)
+#define UTF8_SURROGATE      (1 << 4)
+#define UTF8_OVERLONG_2     (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4     (1 << 6)
+#define UTF8_TWO_CONTS      (1 << 7)   /** continuation followed by continuation */
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+__attribute__((target("ssse3")))
+inline __m128i utf8_block_errors(__m128i input, __m128i prev_input){
+
+    const __m128i low_nibble_mask = _mm_set1_epi8(0x0F);
+
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        (char)(UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4)
+    );
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        (char)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),
+        (char)(UTF8_CARRY | UTF8_OVERLONG_2),
+        (char)UTF8_CARRY,
+        (char)UTF8_CARRY,
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000)
+    );
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+    );
+
+    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+
+    __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble_mask));
+    __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, low_nibble_mask));
+    __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble_mask));
+
+    __m128i special_cases = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+    // Third and fourth bytes of 3/4 byte sequences must be continuations : cancels their TWO_CONTS bit
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+    __m128i is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must_be_continuation = _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte), _mm_set1_epi8((char)0x80));
+
+    return _mm_xor_si128(must_be_continuation, special_cases);
+}
+
+/** Non-zero if the last bytes of a block start a sequence that needs bytes from the next block */
+__attribute__((target("ssse3")))
+inline __m128i utf8_block_incomplete(__m128i input){
+    const __m128i max_value = _mm_setr_epi8(
+        (char)255, (char)255, (char)255, (char)255, (char)255, (char)255, (char)255, (char)255,
+        (char)255, (char)255, (char)255, (char)255, (char)255,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1)
+    );
+    return _mm_subs_epu8(input, max_value);
+}
+
+__attribute__((target("ssse3")))
+inline bool utf8_validate_ssse3(const unsigned char* c, size_t size){
+
+    __m128i error = _mm_setzero_si128();
+    __m128i prev_input = _mm_setzero_si128();
+    __m128i prev_incomplete = _mm_setzero_si128();
+
+    size_t i = 0;
+    unsigned char tail[16];
+
+    while(i < size){
+
+        __m128i input;
+        if(size - i >= 16){
+            input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i));
+        }
+        else {
+            // Zero padding is ASCII
+            std::memset(tail, 0, sizeof(tail));
+            std::memcpy(tail, c + i, size - i);
+            input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tail));
+        }
+        i += 16;
+
+        if(_mm_movemask_epi8(input) == 0){
+            error = _mm_or_si128(error, prev_incomplete);
+        }
+        else {
+            error = _mm_or_si128(error, utf8_block_errors(input, prev_input));
+            prev_incomplete = utf8_block_incomplete(input);
+        }
+        prev_input = input;
+    }
+
+    error = _mm_or_si128(error, prev_incomplete);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+#endif
+
+
+/** True if data is valid UTF-8 */
+inline bool utf8_validate(const char* data, size_t size){
+
+    const unsigned char* c = reinterpret_cast<const unsigned char*>(data);
+
+#ifdef PHYSON_UTF8_SSSE3
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if(has_ssse3)
+        return utf8_validate_ssse3(c, size);
+#endif
+
+    return utf8_validate_scalar(c, size);
+}
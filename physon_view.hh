@@ -0,0 +1,272 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <iterator>
+#include <type_traits>
+#include <limits>
+#include <stdexcept>
+#include <cstddef>
+
+#include "physon_types.hh"
+
+
+/**
+    Non-owning views over the values of a json_store.
+
+    A JsonRef is a store pointer and a handle, 16 bytes, passed by value. Arrays and objects are walked through
+    JsonArrayView and JsonObjectView, which point straight into the store vectors, so range-for traversal copies
+    no wrapper vector and allocates nothing. Typed access checks the type once and throws on a mismatch:
+
+        for(JsonMember shape : physon.root().as<JsonObjectView>())
+            for(JsonRef point : shape.value.as<JsonArrayView>())
+                double x = point[0].as<double>();
+
+    Views follow the rules of json_traverse() : adding arrays, objects or kvs to the store, or resizing a viewed
+    container, invalidates them.
+ */
+
+
+struct JsonArrayView;
+struct JsonObjectView;
+
+void view_error(std::string error_msg){
+    throw std::runtime_error("View: " + error_msg);
+}
+
+/** One value of a store. A missing value, e.g. from an unknown key, has type NONE. */
+struct JsonRef {
+
+    json_store* store = nullptr;
+    JsonWrapper wrapper;
+
+    JsonRef() {};
+    JsonRef(json_store& _store, JsonWrapper _wrapper) : store {&_store}, wrapper {_wrapper} {};
+
+    /** INTEGER or FLOAT for lazy numbers, see json_store::value_type() */
+    JSON_TYPE type() const {
+        return store == nullptr ? JSON_TYPE::NONE : store->value_type(wrapper);
+    }
+    bool is_null() const { return type() == JSON_TYPE::NULL_; }
+    bool exists() const { return type() != JSON_TYPE::NONE; }
+
+    /** True when as<T>() would succeed */
+    template<typename T>
+    bool is() const;
+    template<typename T>
+    static bool type_matches(JSON_TYPE value_type);
+    /** True if integral T holds value */
+    template<typename T>
+    static bool integer_fits(json_int value);
+    /**
+        T is bool, any arithmetic type, std::string_view, JsonArrayView or JsonObjectView.
+        Floating point T accepts integers. Integral T rejects floats instead of truncating them,
+        and integers outside its range instead of wrapping them.
+        A lazy number is decoded and cached, a lazy string with escapes unescaped, on the first as<>().
+     */
+    template<typename T>
+    T as() const;
+
+    /** Entry of an array. Throws if out of range. */
+    JsonRef operator[](size_t index) const;
+    /** Value of key in an object, NONE if the key is missing */
+    JsonRef operator[](std::string_view key) const;
+};
+
+struct JsonMember {
+    std::string_view key;
+    JsonRef value;
+};
+
+
+/** Entries of one array */
+struct JsonArrayView {
+
+    json_store* store = nullptr;
+    const JsonWrapper* first = nullptr;
+    const JsonWrapper* last = nullptr;
+
+    struct iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = JsonRef;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = JsonRef;
+
+        json_store* store = nullptr;
+        const JsonWrapper* entry = nullptr;
+
+        JsonRef operator*() const { return JsonRef(*store, *entry); }
+        iterator& operator++(){ entry++; return *this; }
+        iterator operator++(int){ iterator previous = *this; entry++; return previous; }
+        bool operator==(const iterator& other) const { return entry == other.entry; }
+        bool operator!=(const iterator& other) const { return entry != other.entry; }
+    };
+
+    iterator begin() const { return { store, first }; }
+    iterator end() const { return { store, last }; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+
+    JsonRef operator[](size_t index) const {
+        if(index >= size())
+            view_error("array index " + std::to_string(index) + " out of range, size is " + std::to_string(size()) + ".");
+        return JsonRef(*store, first[index]);
+    }
+};
+
+/** Key/value pairs of one object, in document order */
+struct JsonObjectView {
+
+    json_store* store = nullptr;
+    const JsonWrapper* first = nullptr;
+    const JsonWrapper* last = nullptr;
+
+    struct iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = JsonMember;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = JsonMember;
+
+        json_store* store = nullptr;
+        const JsonWrapper* entry = nullptr;
+
+        JsonMember operator*() const {
+            const json_kv_wrap& kv = store->kvs[entry->store_id()];
+            return { kv.first, JsonRef(*store, kv.second) };
+        }
+        iterator& operator++(){ entry++; return *this; }
+        iterator operator++(int){ iterator previous = *this; entry++; return previous; }
+        bool operator==(const iterator& other) const { return entry == other.entry; }
+        bool operator!=(const iterator& other) const { return entry != other.entry; }
+    };
+
+    iterator begin() const { return { store, first }; }
+    iterator end() const { return { store, last }; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+
+    /** Value of the first kv with key, NONE if there is none. Not recursive. */
+    JsonRef find(std::string_view key) const {
+        for(const JsonWrapper* entry = first; entry != last; entry++){
+            const json_kv_wrap& kv = store->kvs[entry->store_id()];
+            if(kv.first == key)
+                return JsonRef(*store, kv.second);
+        }
+        return JsonRef();
+    }
+};
+
+#if __cplusplus >= 202002L
+#include <ranges>
+template<> inline constexpr bool std::ranges::enable_borrowed_range<JsonArrayView> = true;
+template<> inline constexpr bool std::ranges::enable_borrowed_range<JsonObjectView> = true;
+#endif
+
+
+
+std::string view_type_name(JSON_TYPE type){
+    switch (type){
+    case JSON_TYPE::NULL_:      return "null";
+    case JSON_TYPE::TRUE:
+    case JSON_TYPE::FALSE:      return "bool";
+    case JSON_TYPE::STRING:     return "string";
+    case JSON_TYPE::FLOAT:      return "float";
+    case JSON_TYPE::INTEGER:    return "integer";
+    case JSON_TYPE::ARRAY:      return "array";
+    case JSON_TYPE::OBJECT:     return "object";
+    case JSON_TYPE::KV:         return "kv";
+    default:                    return "none";
+    }
+}
+
+template<typename T>
+bool JsonRef::type_matches(JSON_TYPE value_type){
+
+    if constexpr (std::is_same_v<T, bool>)
+        return value_type == JSON_TYPE::TRUE || value_type == JSON_TYPE::FALSE;
+    else if constexpr (std::is_floating_point_v<T>)
+        return value_type == JSON_TYPE::FLOAT || value_type == JSON_TYPE::INTEGER;
+    else if constexpr (std::is_integral_v<T>)
+        return value_type == JSON_TYPE::INTEGER;
+    else if constexpr (std::is_same_v<T, std::string_view>)
+        return value_type == JSON_TYPE::STRING;
+    else if constexpr (std::is_same_v<T, JsonArrayView>)
+        return value_type == JSON_TYPE::ARRAY;
+    else if constexpr (std::is_same_v<T, JsonObjectView>)
+        return value_type == JSON_TYPE::OBJECT;
+    else
+        static_assert(!std::is_same_v<T, T>, "JsonRef::is<T>() : unsupported T");
+}
+
+template<typename T>
+bool JsonRef::integer_fits(json_int value){
+    if constexpr (std::is_signed_v<T>)
+        return value >= (json_int)std::numeric_limits<T>::min() && value <= (json_int)std::numeric_limits<T>::max();
+    else
+        return value >= 0 && (uint64_t)value <= (uint64_t)std::numeric_limits<T>::max();
+}
+
+template<typename T>
+bool JsonRef::is() const {
+    if(!type_matches<T>(type()))
+        return false;
+    if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>){
+        if(wrapper.type() == JSON_TYPE::NUMBER)
+            store->decode_number(wrapper);
+        return integer_fits<T>(store->get_integer(wrapper));
+    }
+    return true;
+}
+
+template<typename T>
+T JsonRef::as() const {
+
+    JSON_TYPE value_type = type();
+
+    if(!type_matches<T>(value_type)){
+        const char* expected = std::is_same_v<T, bool> ? "bool"
+                             : std::is_floating_point_v<T> ? "number"
+                             : std::is_integral_v<T> ? "integer"
+                             : std::is_same_v<T, std::string_view> ? "string"
+                             : std::is_same_v<T, JsonArrayView> ? "array"
+                             : "object";
+        view_error(std::string("expected ") + expected + ", value is " + view_type_name(value_type) + ".");
+    }
+
+    if constexpr (std::is_same_v<T, bool>){
+        return wrapper.type() == JSON_TYPE::TRUE;
+    }
+    else if constexpr (std::is_arithmetic_v<T>){
+        if(wrapper.type() == JSON_TYPE::NUMBER)
+            store->decode_number(wrapper);
+        if(value_type == JSON_TYPE::INTEGER){
+            json_int integer = store->get_integer(wrapper);
+            if constexpr (std::is_integral_v<T>){
+                if(!integer_fits<T>(integer))
+                    view_error("integer " + std::to_string(integer) + " is out of range of the requested type.");
+            }
+            return (T)integer;
+        }
+        return (T)store->get_float(wrapper);
+    }
+    else if constexpr (std::is_same_v<T, std::string_view>){
+        return store->get_string_view(wrapper);
+    }
+    else {
+        // Object entries are kv wrappers in the same vector type as array entries
+        const std::vector<JsonWrapper>& entries = std::is_same_v<T, JsonArrayView>
+                                                    ? store->arrays[wrapper.store_id()]
+                                                    : store->objects[wrapper.store_id()];
+        return T { store, entries.data(), entries.data() + entries.size() };
+    }
+}
+
+JsonRef JsonRef::operator[](size_t index) const {
+    return as<JsonArrayView>()[index];
+}
+
+JsonRef JsonRef::operator[](std::string_view key) const {
+    return as<JsonObjectView>().find(key);
+}